@@ -0,0 +1,121 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mmanager.h"
+
+/*
+ * Measures how the time of `mmanager_compact()` grows with the number of
+ * blocks in the heap. For every block count, the heap is filled with blocks of
+ * random sizes, a random half of them is freed, and the remaining blocks are
+ * compacted. Results are written as CSV to stdout:
+ *   blocks,moved,bytes_moved,seconds,ns_per_block
+ *
+ * Usage: compaction_bench [max blocks] [repetitions]
+ *
+ * Block counts start at 1024 and double up to `max blocks`; the fastest of
+ * `repetitions` runs is reported for each. Only the compaction is timed; with
+ * large block counts, the run time is dominated by freeing the blocks.
+ *
+ * Configure with -DCMAKE_BUILD_TYPE=Release for representative numbers.
+ */
+
+
+#define DEFAULT_MAX_BLOCKS (1 << 15)
+#define DEFAULT_REPETITIONS 3
+#define MIN_BLOCKS 1024
+#define MIN_BLOCK_SIZE 16
+#define MAX_BLOCK_SIZE 256
+#define HEADER_SIZE 16
+
+
+// Fills a fresh heap with `n` blocks, frees half of them, compacts it and
+// returns the time spent compacting. Stores the number of moved blocks and
+// bytes in `*moved` and `*bytes_moved`.
+static uint64_t run(size_t n, uint64_t seed, size_t *moved, size_t *bytes_moved);
+
+// xorshift64* pseudo-random number generator.
+static uint64_t next_random(uint64_t *state);
+
+static uint64_t now_ns(void);
+
+
+int main(int argc, char **argv) {
+    size_t max_blocks = argc > 1 ? strtoull(argv[1], NULL, 0) : DEFAULT_MAX_BLOCKS;
+    int repetitions = argc > 2 ? atoi(argv[2]) : DEFAULT_REPETITIONS;
+    if (max_blocks < MIN_BLOCKS || repetitions <= 0) {
+        fprintf(stderr, "usage: %s [max blocks >= %d] [repetitions]\n", argv[0], MIN_BLOCKS);
+        return 1;
+    }
+
+    printf("blocks,moved,bytes_moved,seconds,ns_per_block\n");
+    for (size_t n = MIN_BLOCKS; n <= max_blocks; n *= 2) {
+        uint64_t best_ns = UINT64_MAX;
+        size_t moved = 0;
+        size_t bytes_moved = 0;
+        for (int i = 0; i < repetitions; ++i) {
+            uint64_t ns = run(n, i + 1, &moved, &bytes_moved);
+            if (ns < best_ns) {
+                best_ns = ns;
+            }
+        }
+
+        printf("%zu,%zu,%zu,%.6f,%.1f\n", n, moved, bytes_moved, best_ns / 1e9, (double)best_ns / n);
+        fflush(stdout);
+    }
+
+    return 0;
+}
+
+static uint64_t run(size_t n, uint64_t seed, size_t *moved, size_t *bytes_moved) {
+    mmanager_initialize(n * (HEADER_SIZE + MAX_BLOCK_SIZE) + HEADER_SIZE, FIRST_FIT);
+
+    void **blocks = malloc(n * sizeof(*blocks));
+    uint64_t state = seed * 0x9e3779b97f4a7c15ull;
+    for (size_t i = 0; i < n; ++i) {
+        // Keep blocks 16-byte aligned.
+        size_t size = (MIN_BLOCK_SIZE + next_random(&state) % (MAX_BLOCK_SIZE - MIN_BLOCK_SIZE + 1)) & ~(size_t)15;
+        blocks[i] = allocate(size);
+    }
+
+    // Free from the end of the heap, so that every free is cheap.
+    for (size_t i = n; i-- > 0; ) {
+        if (next_random(&state) & 1) {
+            deallocate(blocks[i]);
+        }
+    }
+
+    void **before = malloc(n * sizeof(*before));
+    void **after = malloc(n * sizeof(*after));
+
+    uint64_t start = now_ns();
+    *moved = mmanager_compact(before, after);
+    uint64_t ns = now_ns() - start;
+
+    *bytes_moved = 0;
+    for (size_t i = 0; i < *moved; ++i) {
+        *bytes_moved += mmanager_usable_size(after[i]);
+    }
+
+    free(before);
+    free(after);
+    free(blocks);
+    mmanager_destroy();
+    return ns;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
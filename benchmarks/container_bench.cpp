@@ -0,0 +1,170 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include "mmanager.hpp"
+
+/*
+ * Compares the throughput of standard containers using the default allocator,
+ * mmanager_allocator<T> and mmanager_memory_resource (through the pmr
+ * containers). Every workload is run once per allocator and results are
+ * written as CSV to stdout:
+ *   container,allocator,ops,seconds,ops_per_sec
+ *
+ * Workloads:
+ *   vector         push_back into many short vectors, so that growth and
+ *                  release dominate.
+ *   unordered_map  Insert and erase random keys in a bounded map.
+ *   list           Push to the back and pop from the front of a bounded list.
+ *
+ * Usage: container_bench [ops] [vector|unordered_map|list|all]
+ *
+ * Configure with -DCMAKE_BUILD_TYPE=Release for representative numbers.
+ */
+
+
+#define DEFAULT_OPS 200000
+#define ARENA_SIZE (1ul << 30)
+#define VECTOR_LENGTH 256
+#define MAP_KEYS 65536
+#define LIST_LENGTH 4096
+
+
+namespace {
+
+// xorshift64* pseudo-random number generator.
+uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+// Runs `workload` `ops` times and prints a CSV row.
+template <class Workload>
+void run(const char *container, const char *allocator, uint64_t ops, Workload workload) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t checksum = workload(ops);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%s,%s,%llu,%.3f,%.0f\n", container, allocator, (unsigned long long)ops, seconds, ops / seconds);
+    fflush(stdout);
+
+    // Keep the work from being optimized away.
+    if (checksum == 1) {
+        fprintf(stderr, "checksum %llu\n", (unsigned long long)checksum);
+    }
+}
+
+template <class Vector, class... Args>
+uint64_t vector_workload(uint64_t ops, Args &&...args) {
+    uint64_t checksum = 0;
+    for (uint64_t done = 0; done < ops; done += VECTOR_LENGTH) {
+        Vector vector(args...);
+        for (uint64_t i = 0; i < VECTOR_LENGTH; ++i) {
+            vector.push_back(i);
+        }
+        checksum += vector.back();
+    }
+    return checksum;
+}
+
+template <class Map, class... Args>
+uint64_t unordered_map_workload(uint64_t ops, Args &&...args) {
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    uint64_t checksum = 0;
+    Map map(args...);
+    for (uint64_t i = 0; i < ops; ++i) {
+        uint64_t key = next_random(&state) % MAP_KEYS;
+        auto it = map.find(key);
+        if (it != map.end()) {
+            checksum += it->second;
+            map.erase(it);
+        }
+        else {
+            map.emplace(key, i);
+        }
+    }
+    return checksum + map.size();
+}
+
+template <class List, class... Args>
+uint64_t list_workload(uint64_t ops, Args &&...args) {
+    uint64_t checksum = 0;
+    List list(args...);
+    for (uint64_t i = 0; i < ops; ++i) {
+        list.push_back(i);
+        if (list.size() > LIST_LENGTH) {
+            checksum += list.front();
+            list.pop_front();
+        }
+    }
+    return checksum;
+}
+
+} // namespace
+
+
+int main(int argc, char **argv) {
+    uint64_t ops = argc > 1 ? strtoull(argv[1], NULL, 0) : DEFAULT_OPS;
+    const char *which = argc > 2 ? argv[2] : "all";
+    if (ops == 0) {
+        fprintf(stderr, "usage: %s [ops] [vector|unordered_map|list|all]\n", argv[0]);
+        return 1;
+    }
+
+    mmanager_initialize(ARENA_SIZE, FIRST_FIT);
+    std::pmr::memory_resource *resource = mmanager_get_memory_resource();
+    bool all = strcmp(which, "all") == 0;
+
+    printf("container,allocator,ops,seconds,ops_per_sec\n");
+
+    if (all || strcmp(which, "vector") == 0) {
+        run("vector", "std", ops, [](uint64_t n) {
+            return vector_workload<std::vector<uint64_t>>(n);
+        });
+        run("vector", "mmanager_allocator", ops, [](uint64_t n) {
+            return vector_workload<std::vector<uint64_t, mmanager_allocator<uint64_t>>>(n);
+        });
+        run("vector", "mmanager_memory_resource", ops, [resource](uint64_t n) {
+            return vector_workload<std::pmr::vector<uint64_t>>(n, resource);
+        });
+    }
+
+    if (all || strcmp(which, "unordered_map") == 0) {
+        using Pair = std::pair<const uint64_t, uint64_t>;
+        run("unordered_map", "std", ops, [](uint64_t n) {
+            return unordered_map_workload<std::unordered_map<uint64_t, uint64_t>>(n);
+        });
+        run("unordered_map", "mmanager_allocator", ops, [](uint64_t n) {
+            return unordered_map_workload<std::unordered_map<uint64_t, uint64_t, std::hash<uint64_t>,
+                std::equal_to<uint64_t>, mmanager_allocator<Pair>>>(n);
+        });
+        run("unordered_map", "mmanager_memory_resource", ops, [resource](uint64_t n) {
+            return unordered_map_workload<std::pmr::unordered_map<uint64_t, uint64_t>>(n, resource);
+        });
+    }
+
+    if (all || strcmp(which, "list") == 0) {
+        run("list", "std", ops, [](uint64_t n) {
+            return list_workload<std::list<uint64_t>>(n);
+        });
+        run("list", "mmanager_allocator", ops, [](uint64_t n) {
+            return list_workload<std::list<uint64_t, mmanager_allocator<uint64_t>>>(n);
+        });
+        run("list", "mmanager_memory_resource", ops, [resource](uint64_t n) {
+            return list_workload<std::pmr::list<uint64_t>>(n, resource);
+        });
+    }
+
+    mmanager_destroy();
+    return 0;
+}
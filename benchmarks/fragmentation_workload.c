@@ -0,0 +1,329 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmanager.h"
+
+/*
+ * Synthetic workload generator for comparing allocation policies. Every step
+ * allocates one block whose size and lifetime (in steps) are drawn from the
+ * configured distributions, then frees all blocks whose lifetime has expired.
+ * Fragmentation is sampled periodically and written as CSV to stdout:
+ *   policy,step,live_blocks,allocated_bytes,free_bytes,largest_free_block,fragmentation,failed
+ * followed by a summary line per policy on stderr.
+ *
+ * Usage: fragmentation_workload [options]
+ *   -s uniform|lognormal|bimodal|powerlaw   size distribution (default lognormal)
+ *   -l exponential|uniform|bimodal          lifetime distribution (default exponential)
+ *   -m <bytes>   smallest block size (default 8)
+ *   -M <bytes>   largest block size (default 4096)
+ *   -L <steps>   mean lifetime (default 1000)
+ *   -n <steps>   number of steps (default 100000)
+ *   -a <bytes>   arena size (default 64 MiB)
+ *   -i <steps>   sampling interval (default 1000)
+ *   -p first|best|worst|all                 policies to run (default all)
+ *   -r <seed>    random seed (default 1)
+ */
+
+
+enum size_distribution {
+    SIZE_UNIFORM,
+    SIZE_LOGNORMAL,
+    SIZE_BIMODAL,
+    SIZE_POWERLAW
+};
+
+enum lifetime_distribution {
+    LIFETIME_EXPONENTIAL,
+    LIFETIME_UNIFORM,
+    LIFETIME_BIMODAL
+};
+
+struct workload {
+    enum size_distribution size_distribution;
+    enum lifetime_distribution lifetime_distribution;
+    size_t min_size;
+    size_t max_size;
+    double mean_lifetime;
+    size_t steps;
+    size_t arena_size;
+    size_t sample_interval;
+    uint64_t seed;
+};
+
+// A live block, kept in a min-heap ordered by the step at which it dies.
+struct live_block {
+    size_t death;
+    void *ptr;
+};
+
+struct heap {
+    struct live_block *blocks;
+    size_t count;
+    size_t capacity;
+};
+
+
+// Runs `workload` against `policy`, printing samples and a summary.
+static void run(const struct workload *workload, enum AllocationPolicy policy);
+
+// Draws a block size from the workload's size distribution.
+static size_t draw_size(const struct workload *workload, uint64_t *state);
+
+// Draws a lifetime (at least one step) from the workload's lifetime distribution.
+static size_t draw_lifetime(const struct workload *workload, uint64_t *state);
+
+// Min-heap helpers.
+static void heap_push(struct heap *heap, struct live_block block);
+static struct live_block heap_pop(struct heap *heap);
+
+// Returns a uniformly distributed double in (0, 1).
+static double uniform(uint64_t *state);
+
+// Returns a standard normally distributed double (Box-Muller).
+static double normal(uint64_t *state);
+
+// Returns the index of `name` in `names`, or -1 if it is not present.
+static int lookup(const char *name, const char **names, int n_names);
+
+
+static const char *size_names[] = { "uniform", "lognormal", "bimodal", "powerlaw" };
+static const char *lifetime_names[] = { "exponential", "uniform", "bimodal" };
+static const char *policy_names[] = { "first", "best", "worst" };
+
+
+int main(int argc, char **argv) {
+    struct workload workload = {
+        SIZE_LOGNORMAL, LIFETIME_EXPONENTIAL, 8, 4096, 1000.0, 100000, 64ul << 20, 1000, 1
+    };
+    int policy = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:l:m:M:L:n:a:i:p:r:")) != -1) {
+        switch (opt) {
+            case 's': workload.size_distribution = lookup(optarg, size_names, 4); break;
+            case 'l': workload.lifetime_distribution = lookup(optarg, lifetime_names, 3); break;
+            case 'm': workload.min_size = strtoull(optarg, NULL, 0); break;
+            case 'M': workload.max_size = strtoull(optarg, NULL, 0); break;
+            case 'L': workload.mean_lifetime = atof(optarg); break;
+            case 'n': workload.steps = strtoull(optarg, NULL, 0); break;
+            case 'a': workload.arena_size = strtoull(optarg, NULL, 0); break;
+            case 'i': workload.sample_interval = strtoull(optarg, NULL, 0); break;
+            case 'p': policy = strcmp(optarg, "all") == 0 ? -1 : lookup(optarg, policy_names, 3); break;
+            case 'r': workload.seed = strtoull(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "usage: %s [-s dist] [-l dist] [-m min] [-M max] [-L lifetime] [-n steps] "
+                    "[-a arena] [-i interval] [-p policy] [-r seed]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if ((int)workload.size_distribution < 0 || (int)workload.lifetime_distribution < 0 || policy < -1
+        || workload.min_size == 0 || workload.min_size > workload.max_size || workload.sample_interval == 0) {
+        fprintf(stderr, "ERROR: invalid workload parameters.\n");
+        return 1;
+    }
+
+    printf("policy,step,live_blocks,allocated_bytes,free_bytes,largest_free_block,fragmentation,failed\n");
+    for (int i = FIRST_FIT; i <= WORST_FIT; ++i) {
+        if (policy == -1 || policy == i) {
+            run(&workload, i);
+        }
+    }
+
+    return 0;
+}
+
+static void run(const struct workload *workload, enum AllocationPolicy policy) {
+    mmanager_initialize(workload->arena_size, policy);
+
+    // Every policy sees exactly the same sequence of requests.
+    uint64_t state = workload->seed * 0x9e3779b97f4a7c15ull + 1;
+    struct heap live = { NULL, 0, 0 };
+    size_t failed = 0;
+    double fragmentation_sum = 0.0;
+    double max_fragmentation = 0.0;
+    size_t samples = 0;
+
+    for (size_t step = 1; step <= workload->steps; ++step) {
+        // Free the blocks that die at this step.
+        while (live.count > 0 && live.blocks[0].death <= step) {
+            deallocate(heap_pop(&live).ptr);
+        }
+
+        size_t size = draw_size(workload, &state);
+        size_t lifetime = draw_lifetime(workload, &state);
+        void *ptr = allocate(size);
+        if (ptr) {
+            struct live_block block = { step + lifetime, ptr };
+            heap_push(&live, block);
+        }
+        else {
+            ++failed;
+        }
+
+        if (step % workload->sample_interval == 0) {
+            struct mmanager_stats stats;
+            mmanager_get_stats(&stats);
+            double fragmentation = stats.free_bytes
+                ? 1.0 - (double)stats.largest_free_block / (double)stats.free_bytes : 0.0;
+
+            fragmentation_sum += fragmentation;
+            ++samples;
+            if (fragmentation > max_fragmentation) {
+                max_fragmentation = fragmentation;
+            }
+
+            printf("%s,%zu,%zu,%zu,%zu,%zu,%.4f,%zu\n", policy_names[policy], step, live.count,
+                stats.allocated_bytes, stats.free_bytes, stats.largest_free_block, fragmentation, failed);
+        }
+    }
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    fprintf(stderr, "%s fit: sizes=%s lifetimes=%s failed=%zu peak_allocated=%zu high_water=%zu "
+        "mean_fragmentation=%.4f max_fragmentation=%.4f\n", policy_names[policy],
+        size_names[workload->size_distribution], lifetime_names[workload->lifetime_distribution], failed,
+        stats.peak_allocated_bytes, stats.heap_high_water, samples ? fragmentation_sum / samples : 0.0,
+        max_fragmentation);
+
+    while (live.count > 0) {
+        deallocate(heap_pop(&live).ptr);
+    }
+    free(live.blocks);
+    mmanager_destroy();
+}
+
+static size_t draw_size(const struct workload *workload, uint64_t *state) {
+    double min = (double)workload->min_size;
+    double max = (double)workload->max_size;
+    double size;
+
+    switch (workload->size_distribution) {
+        case SIZE_UNIFORM:
+            size = min + uniform(state) * (max - min + 1);
+            break;
+
+        case SIZE_LOGNORMAL:
+            // Median at the geometric mean of the bounds, most mass within them.
+            size = exp((log(min) + log(max)) / 2 + normal(state) * (log(max) - log(min)) / 6);
+            break;
+
+        case SIZE_BIMODAL:
+            // Mostly small objects with occasional large buffers.
+            if (uniform(state) < 0.9) {
+                size = min + uniform(state) * (min * 3);
+            }
+            else {
+                size = max / 2 + uniform(state) * (max / 2);
+            }
+            break;
+
+        case SIZE_POWERLAW:
+        default:
+            // Pareto distribution with shape 1.5.
+            size = min * pow(uniform(state), -1.0 / 1.5);
+            break;
+    }
+
+    if (size < min) {
+        size = min;
+    }
+    if (size > max) {
+        size = max;
+    }
+    return (size_t)size;
+}
+
+static size_t draw_lifetime(const struct workload *workload, uint64_t *state) {
+    double mean = workload->mean_lifetime;
+    double lifetime;
+
+    switch (workload->lifetime_distribution) {
+        case LIFETIME_EXPONENTIAL:
+            lifetime = -log(uniform(state)) * mean;
+            break;
+
+        case LIFETIME_UNIFORM:
+            lifetime = uniform(state) * 2 * mean;
+            break;
+
+        case LIFETIME_BIMODAL:
+        default:
+            // Mostly short-lived temporaries plus a few long-lived objects,
+            // keeping the overall mean at `mean`.
+            if (uniform(state) < 0.9) {
+                lifetime = -log(uniform(state)) * mean * 0.1;
+            }
+            else {
+                lifetime = -log(uniform(state)) * mean * 9.1;
+            }
+            break;
+    }
+
+    return lifetime < 1.0 ? 1 : (size_t)lifetime;
+}
+
+static void heap_push(struct heap *heap, struct live_block block) {
+    if (heap->count == heap->capacity) {
+        heap->capacity = heap->capacity ? 2 * heap->capacity : 1024;
+        heap->blocks = realloc(heap->blocks, heap->capacity * sizeof(*heap->blocks));
+    }
+
+    size_t i = heap->count++;
+    while (i > 0 && heap->blocks[(i - 1) / 2].death > block.death) {
+        heap->blocks[i] = heap->blocks[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap->blocks[i] = block;
+}
+
+static struct live_block heap_pop(struct heap *heap) {
+    struct live_block top = heap->blocks[0];
+    struct live_block last = heap->blocks[--heap->count];
+
+    size_t i = 0;
+    while (2 * i + 1 < heap->count) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < heap->count && heap->blocks[child + 1].death < heap->blocks[child].death) {
+            ++child;
+        }
+        if (last.death <= heap->blocks[child].death) {
+            break;
+        }
+        heap->blocks[i] = heap->blocks[child];
+        i = child;
+    }
+    heap->blocks[i] = last;
+
+    return top;
+}
+
+static double uniform(uint64_t *state) {
+    // xorshift64*, top 53 bits mapped to (0, 1).
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return ((x * 0x2545f4914f6cdd1dull >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static double normal(uint64_t *state) {
+    double u1 = uniform(state);
+    double u2 = uniform(state);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static int lookup(const char *name, const char **names, int n_names) {
+    for (int i = 0; i < n_names; ++i) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,104 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "basic_mmanager.hpp"
+#include "mmanager.h"
+
+/*
+ * Compares the single-threaded allocate/deallocate throughput of the C API,
+ * which takes a mutex and switches on the policy at run time, with the C API
+ * initialized with MMANAGER_NO_LOCKING and with basic_mmanager instances whose
+ * policy, lock and statistics are chosen at compile time. The difference
+ * between the first two rows is the cost of the uncontended lock. Results are
+ * written as CSV to stdout:
+ *   allocator,ops,seconds,ops_per_sec
+ *
+ * Usage: template_bench [ops]
+ *
+ * Configure with -DCMAKE_BUILD_TYPE=Release for representative numbers.
+ */
+
+
+#define DEFAULT_OPS 2000000
+#define ARENA_SIZE (64ul << 20)
+#define SLOTS 64
+#define MIN_BLOCK_SIZE 16
+#define MAX_BLOCK_SIZE 512
+
+
+namespace {
+
+// xorshift64* pseudo-random number generator.
+uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+// Repeatedly replaces random blocks in a small set of slots and prints a CSV row.
+template <class Allocate, class Deallocate>
+void run(const char *name, uint64_t ops, Allocate allocate_fn, Deallocate deallocate_fn) {
+    void *slots[SLOTS] = {};
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < ops; ++i) {
+        uint64_t random = next_random(&state);
+        size_t slot = random % SLOTS;
+        if (slots[slot]) {
+            deallocate_fn(slots[slot]);
+        }
+        slots[slot] = allocate_fn(MIN_BLOCK_SIZE + (random >> 32) % (MAX_BLOCK_SIZE - MIN_BLOCK_SIZE + 1));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (void *ptr : slots) {
+        if (ptr) {
+            deallocate_fn(ptr);
+        }
+    }
+
+    printf("%s,%llu,%.3f,%.0f\n", name, (unsigned long long)ops, seconds, ops / seconds);
+    fflush(stdout);
+}
+
+template <class Heap>
+void run_template(const char *name, uint64_t ops) {
+    Heap heap(ARENA_SIZE);
+    run(name, ops, [&heap](size_t size) { return heap.allocate(size); },
+        [&heap](void *ptr) { heap.deallocate(ptr); });
+}
+
+} // namespace
+
+
+int main(int argc, char **argv) {
+    uint64_t ops = argc > 1 ? strtoull(argv[1], NULL, 0) : DEFAULT_OPS;
+    if (ops == 0) {
+        fprintf(stderr, "usage: %s [ops]\n", argv[0]);
+        return 1;
+    }
+
+    printf("allocator,ops,seconds,ops_per_sec\n");
+
+    mmanager_initialize(ARENA_SIZE, FIRST_FIT);
+    run("c_api", ops, [](size_t size) { return allocate(size); }, [](void *ptr) { deallocate(ptr); });
+    mmanager_destroy();
+
+    struct mmanager_options options = { ARENA_SIZE, FIRST_FIT, MMANAGER_NO_LOCKING };
+    mmanager_initialize_with_options(&options);
+    run("c_api_no_lock", ops, [](size_t size) { return allocate(size); }, [](void *ptr) { deallocate(ptr); });
+    mmanager_destroy();
+
+    run_template<basic_mmanager<mmanager_first_fit, mmanager_mutex_lock, mmanager_header,
+        mmanager_counting_stats>>("template_mutex_stats", ops);
+    run_template<basic_mmanager<mmanager_first_fit, mmanager_spin_lock>>("template_spin", ops);
+    run_template<basic_mmanager<mmanager_first_fit, mmanager_no_lock>>("template_no_lock", ops);
+
+    return 0;
+}
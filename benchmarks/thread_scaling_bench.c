@@ -0,0 +1,337 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mmanager.h"
+
+/*
+ * Measures how allocate/deallocate throughput scales with the number of
+ * threads. Two workloads are run for every thread count:
+ *
+ *   larson   Each thread repeatedly replaces random blocks in its own set of
+ *            slots. At the end of every round it trades its slot set with a
+ *            set left behind by another thread, so that blocks are freed by
+ *            threads other than the one that allocated them.
+ *   xmalloc  Each thread allocates a batch of blocks and publishes it, then
+ *            takes a batch published by any thread and frees it
+ *            (producer/consumer with cross-thread frees).
+ *
+ * Results are written as CSV to stdout:
+ *   pattern,threads,arenas,ops,seconds,ops_per_sec,ops_per_sec_per_thread,failed
+ *
+ * Usage: thread_scaling_bench [max threads] [duration ms] [larson|xmalloc|all] [arenas]
+ *
+ * `arenas` is the number of arenas the heap is split into (default 1). Pass 0
+ * to use one arena per thread.
+ *
+ * Configure with -DCMAKE_BUILD_TYPE=Release for representative numbers.
+ */
+
+
+#define DEFAULT_MAX_THREADS 64
+#define DEFAULT_DURATION_MS 1000
+#define ARENA_SIZE (512ul << 20)
+#define MIN_BLOCK_SIZE 16
+#define MAX_BLOCK_SIZE 512
+#define LARSON_SLOTS 256
+#define LARSON_ROUND_OPS 1024
+#define XMALLOC_BATCH 64
+#define XMALLOC_QUEUE_BATCHES 4096
+#define STOP_CHECK_INTERVAL 64
+
+
+enum pattern {
+    LARSON,
+    XMALLOC
+};
+
+struct thread_args {
+    enum pattern pattern;
+    int index;
+    uint64_t seed;
+    uint64_t ops;
+    uint64_t failed;
+};
+
+// Slot sets left behind by larson threads for others to pick up.
+struct larson_exchange {
+    pthread_mutex_t lock;
+    void ***sets;
+    int n_sets;
+};
+
+// Batches of blocks published by xmalloc threads.
+struct xmalloc_queue {
+    pthread_mutex_t lock;
+    void ***batches;
+    size_t head;
+    size_t count;
+};
+
+
+static atomic_bool stop;
+static pthread_barrier_t start_barrier;
+static struct larson_exchange exchange;
+static struct xmalloc_queue queue;
+
+
+// Runs `pattern` with `n_threads` threads and `n_arenas` arenas for
+// `duration_ms` and prints a CSV row.
+static void run(enum pattern pattern, int n_threads, int n_arenas, long duration_ms);
+
+// Thread entry points.
+static void *larson_thread(void *arg);
+static void *xmalloc_thread(void *arg);
+
+// Returns a random block size in [MIN_BLOCK_SIZE, MAX_BLOCK_SIZE].
+static size_t random_size(uint64_t *state);
+
+// xorshift64* pseudo-random number generator.
+static uint64_t next_random(uint64_t *state);
+
+// Returns the monotonic clock in seconds.
+static double now_seconds(void);
+
+
+static const char *pattern_names[] = { "larson", "xmalloc" };
+
+
+int main(int argc, char **argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : DEFAULT_MAX_THREADS;
+    long duration_ms = argc > 2 ? atol(argv[2]) : DEFAULT_DURATION_MS;
+    const char *which = argc > 3 ? argv[3] : "all";
+    int arenas = argc > 4 ? atoi(argv[4]) : 1;
+
+    if (max_threads < 1 || duration_ms < 1 || arenas < 0) {
+        fprintf(stderr, "usage: %s [max threads] [duration ms] [larson|xmalloc|all] [arenas]\n", argv[0]);
+        return 1;
+    }
+
+    printf("pattern,threads,arenas,ops,seconds,ops_per_sec,ops_per_sec_per_thread,failed\n");
+    for (int pattern = LARSON; pattern <= XMALLOC; ++pattern) {
+        if (strcmp(which, "all") != 0 && strcmp(which, pattern_names[pattern]) != 0) {
+            continue;
+        }
+        for (int n_threads = 1; n_threads <= max_threads; n_threads *= 2) {
+            run(pattern, n_threads, arenas ? arenas : n_threads, duration_ms);
+        }
+    }
+
+    return 0;
+}
+
+static void run(enum pattern pattern, int n_threads, int n_arenas, long duration_ms) {
+    struct mmanager_options options = { ARENA_SIZE, FIRST_FIT, 0, n_arenas, MMANAGER_ARENA_ROUND_ROBIN };
+    mmanager_initialize_with_options(&options);
+
+    pthread_t *threads = malloc(n_threads * sizeof(*threads));
+    struct thread_args *args = calloc(n_threads, sizeof(*args));
+
+    // Prepare shared state. Larson threads start with empty slot sets and there
+    // is one spare set per thread so that every thread can trade.
+    pthread_mutex_init(&exchange.lock, NULL);
+    exchange.n_sets = 2 * n_threads;
+    exchange.sets = malloc(exchange.n_sets * sizeof(*exchange.sets));
+    for (int i = 0; i < exchange.n_sets; ++i) {
+        exchange.sets[i] = calloc(LARSON_SLOTS, sizeof(void *));
+    }
+    pthread_mutex_init(&queue.lock, NULL);
+    queue.batches = calloc(XMALLOC_QUEUE_BATCHES, sizeof(*queue.batches));
+    queue.head = 0;
+    queue.count = 0;
+
+    atomic_store(&stop, false);
+    pthread_barrier_init(&start_barrier, NULL, n_threads + 1);
+
+    for (int i = 0; i < n_threads; ++i) {
+        args[i].pattern = pattern;
+        args[i].index = i;
+        args[i].seed = 0x9e3779b97f4a7c15ull * (i + 1);
+        pthread_create(&threads[i], NULL, pattern == LARSON ? larson_thread : xmalloc_thread, &args[i]);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    double start = now_seconds();
+    struct timespec duration = { duration_ms / 1000, (duration_ms % 1000) * 1000000 };
+    nanosleep(&duration, NULL);
+    atomic_store(&stop, true);
+
+    uint64_t ops = 0;
+    uint64_t failed = 0;
+    for (int i = 0; i < n_threads; ++i) {
+        pthread_join(threads[i], NULL);
+        ops += args[i].ops;
+        failed += args[i].failed;
+    }
+    double seconds = now_seconds() - start;
+
+    printf("%s,%d,%d,%llu,%.3f,%.0f,%.0f,%llu\n", pattern_names[pattern], n_threads, n_arenas, (unsigned long long)ops,
+        seconds, ops / seconds, ops / seconds / n_threads, (unsigned long long)failed);
+    fflush(stdout);
+
+    // Release whatever the threads left behind.
+    for (int i = 0; i < exchange.n_sets; ++i) {
+        for (int j = 0; j < LARSON_SLOTS; ++j) {
+            if (exchange.sets[i][j]) {
+                deallocate(exchange.sets[i][j]);
+            }
+        }
+        free(exchange.sets[i]);
+    }
+    free(exchange.sets);
+    for (size_t i = 0; i < queue.count; ++i) {
+        void **batch = queue.batches[(queue.head + i) % XMALLOC_QUEUE_BATCHES];
+        for (int j = 0; j < XMALLOC_BATCH; ++j) {
+            if (batch[j]) {
+                deallocate(batch[j]);
+            }
+        }
+        free(batch);
+    }
+    free(queue.batches);
+
+    pthread_barrier_destroy(&start_barrier);
+    pthread_mutex_destroy(&exchange.lock);
+    pthread_mutex_destroy(&queue.lock);
+    free(args);
+    free(threads);
+    mmanager_destroy();
+}
+
+static void *larson_thread(void *arg) {
+    struct thread_args *args = arg;
+    uint64_t state = args->seed;
+
+    // Take ownership of this thread's initial slot set.
+    pthread_mutex_lock(&exchange.lock);
+    void **slots = exchange.sets[args->index];
+    exchange.sets[args->index] = NULL;
+    pthread_mutex_unlock(&exchange.lock);
+
+    pthread_barrier_wait(&start_barrier);
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        for (int i = 0; i < LARSON_ROUND_OPS; ++i) {
+            size_t slot = next_random(&state) % LARSON_SLOTS;
+            if (slots[slot]) {
+                deallocate(slots[slot]);
+                ++args->ops;
+            }
+            slots[slot] = allocate(random_size(&state));
+            if (!slots[slot]) {
+                ++args->failed;
+            }
+            ++args->ops;
+
+            if (i % STOP_CHECK_INTERVAL == 0 && atomic_load_explicit(&stop, memory_order_relaxed)) {
+                break;
+            }
+        }
+
+        // Trade slot sets with another thread, whose blocks we will free next round.
+        pthread_mutex_lock(&exchange.lock);
+        int other = (int)(next_random(&state) % exchange.n_sets);
+        for (int i = 0; i < exchange.n_sets && !exchange.sets[other]; ++i) {
+            other = (other + 1) % exchange.n_sets;
+        }
+        if (exchange.sets[other]) {
+            void **taken = exchange.sets[other];
+            exchange.sets[other] = slots;
+            slots = taken;
+        }
+        pthread_mutex_unlock(&exchange.lock);
+    }
+
+    // Leave the slot set behind so its blocks are released after the run.
+    pthread_mutex_lock(&exchange.lock);
+    for (int i = 0; i < exchange.n_sets; ++i) {
+        if (!exchange.sets[i]) {
+            exchange.sets[i] = slots;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&exchange.lock);
+
+    return NULL;
+}
+
+static void *xmalloc_thread(void *arg) {
+    struct thread_args *args = arg;
+    uint64_t state = args->seed;
+
+    pthread_barrier_wait(&start_barrier);
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        // Produce a batch.
+        void **batch = malloc(XMALLOC_BATCH * sizeof(*batch));
+        for (int i = 0; i < XMALLOC_BATCH; ++i) {
+            batch[i] = allocate(random_size(&state));
+            if (!batch[i]) {
+                ++args->failed;
+            }
+            ++args->ops;
+        }
+
+        // Publish it and take the oldest batch, most likely produced by another thread.
+        void **consumed = NULL;
+        pthread_mutex_lock(&queue.lock);
+        if (queue.count < XMALLOC_QUEUE_BATCHES) {
+            queue.batches[(queue.head + queue.count) % XMALLOC_QUEUE_BATCHES] = batch;
+            ++queue.count;
+            batch = NULL;
+        }
+        if (queue.count > 0) {
+            consumed = queue.batches[queue.head];
+            queue.head = (queue.head + 1) % XMALLOC_QUEUE_BATCHES;
+            --queue.count;
+        }
+        pthread_mutex_unlock(&queue.lock);
+
+        // Consume it.
+        if (consumed) {
+            for (int i = 0; i < XMALLOC_BATCH; ++i) {
+                if (consumed[i]) {
+                    deallocate(consumed[i]);
+                    ++args->ops;
+                }
+            }
+            free(consumed);
+        }
+        if (batch) {
+            for (int i = 0; i < XMALLOC_BATCH; ++i) {
+                if (batch[i]) {
+                    deallocate(batch[i]);
+                    ++args->ops;
+                }
+            }
+            free(batch);
+        }
+
+    }
+
+    return NULL;
+}
+
+static size_t random_size(uint64_t *state) {
+    return MIN_BLOCK_SIZE + next_random(state) % (MAX_BLOCK_SIZE - MIN_BLOCK_SIZE + 1);
+}
+
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dull;
+}
+
+static double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
@@ -0,0 +1,337 @@
+#ifndef BASIC_MMANAGER_HPP_
+#define BASIC_MMANAGER_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <sys/mman.h>
+
+/*
+ * Header-only front-end to the mmanager block allocator. `basic_mmanager` uses
+ * the same block layout and algorithms as mmanager.c (an address-ordered free
+ * list, splitting and coalescing), but the search policy, the locking
+ * strategy and the statistics are template parameters. Each instance owns its
+ * own arena, and with `mmanager_no_lock` and `mmanager_no_stats` the whole
+ * allocation path can be inlined into the caller.
+ *
+ *   basic_mmanager<mmanager_first_fit, mmanager_no_lock> heap(1 << 20);
+ *   void *ptr = heap.allocate(64);
+ *   heap.deallocate(ptr);
+ */
+
+
+/* * * * * * * * * * * * * * * * * * *
+ * Search policies.
+ * * * * * * * * * * * * * * * * * * */
+
+// Returns the first free block that fits.
+struct mmanager_first_fit {
+    template <class Header>
+    static Header *search(Header *free_list, std::size_t size) {
+        for (Header *current_block = free_list; current_block; current_block = current_block->next) {
+            if (current_block->size() >= size) {
+                return current_block;
+            }
+        }
+        return nullptr;
+    }
+};
+
+// Returns the smallest free block that fits, the lowest one if several are
+// equally small, like BEST_FIT in mmanager.c. The search stops at the first
+// exact fit, which mmanager.c would pick as well.
+struct mmanager_best_fit {
+    template <class Header>
+    static Header *search(Header *free_list, std::size_t size) {
+        Header *best_fit_block = nullptr;
+        for (Header *current_block = free_list; current_block; current_block = current_block->next) {
+            if (current_block->size() >= size
+                && (!best_fit_block || current_block->size() < best_fit_block->size())) {
+                best_fit_block = current_block;
+                if (current_block->size() == size) {
+                    break;
+                }
+            }
+        }
+        return best_fit_block;
+    }
+};
+
+// Returns the largest free block if it fits, the lowest one if several are
+// equally large. Unlike WORST_FIT in mmanager.c, which only takes a block
+// larger than the request, this also takes a block that fits exactly.
+struct mmanager_worst_fit {
+    template <class Header>
+    static Header *search(Header *free_list, std::size_t size) {
+        Header *worst_fit_block = nullptr;
+        for (Header *current_block = free_list; current_block; current_block = current_block->next) {
+            if (current_block->size() >= size
+                && (!worst_fit_block || current_block->size() > worst_fit_block->size())) {
+                worst_fit_block = current_block;
+            }
+        }
+        return worst_fit_block;
+    }
+};
+
+
+/* * * * * * * * * * * * * * * * * * *
+ * Lock policies.
+ * * * * * * * * * * * * * * * * * * */
+
+// For instances used by a single thread.
+struct mmanager_no_lock {
+    void lock() {}
+    void unlock() {}
+};
+
+struct mmanager_mutex_lock {
+    std::mutex mutex;
+
+    void lock() { mutex.lock(); }
+    void unlock() { mutex.unlock(); }
+};
+
+// Test-and-test-and-set spin lock, for short critical sections with little
+// contention.
+struct mmanager_spin_lock {
+    std::atomic<bool> locked{false};
+
+    void lock() {
+        while (locked.exchange(true, std::memory_order_acquire)) {
+            while (locked.load(std::memory_order_relaxed)) {
+            }
+        }
+    }
+    void unlock() { locked.store(false, std::memory_order_release); }
+};
+
+
+/* * * * * * * * * * * * * * * * * * *
+ * Statistics policies.
+ * * * * * * * * * * * * * * * * * * */
+
+// Keeps no statistics.
+struct mmanager_no_stats {
+    void on_allocate(std::size_t, std::size_t) {}
+    void on_deallocate(std::size_t) {}
+};
+
+// Keeps the counters of `struct mmanager_stats` that mmanager.c maintains on
+// every allocation.
+struct mmanager_counting_stats {
+    std::size_t allocated_bytes = 0;
+    std::size_t allocated_blocks = 0;
+    std::size_t peak_allocated_bytes = 0;
+    std::size_t heap_high_water = 0;
+
+    // `block_end` is the arena offset of the end of the allocated block.
+    void on_allocate(std::size_t size, std::size_t block_end) {
+        allocated_bytes += size;
+        ++allocated_blocks;
+        if (allocated_bytes > peak_allocated_bytes) {
+            peak_allocated_bytes = allocated_bytes;
+        }
+        if (block_end > heap_high_water) {
+            heap_high_water = block_end;
+        }
+    }
+    void on_deallocate(std::size_t size) {
+        allocated_bytes -= size;
+        --allocated_blocks;
+    }
+};
+
+
+/* * * * * * * * * * * * * * * * * * *
+ * Header layouts.
+ * * * * * * * * * * * * * * * * * * */
+
+// The block header of mmanager.c: a 48-bit block size, spare flag bits and the
+// list link, 16 bytes in total. A header layout `H` must provide:
+//
+//   std::size_t size() const      the size of the block memory;
+//   void set_size(std::size_t)    sets it;
+//   char *memory()                the block memory, which follows the header;
+//   static H *from_memory(void *) the header of the block memory at a pointer;
+//   H *next                       the free list link;
+//   flags                         an integer member, set to 0 for new blocks.
+//
+// sizeof(H) must keep the block memory suitably aligned.
+struct mmanager_header {
+    std::size_t block_size : 48;
+    std::size_t flags : 16;
+    mmanager_header *next;
+
+    std::size_t size() const { return block_size; }
+    void set_size(std::size_t size) { block_size = size; }
+    char *memory() { return reinterpret_cast<char *>(this + 1); }
+    static mmanager_header *from_memory(void *ptr) { return static_cast<mmanager_header *>(ptr) - 1; }
+};
+
+
+template <class Policy = mmanager_first_fit, class LockPolicy = mmanager_mutex_lock,
+    class HeaderLayout = mmanager_header, class Stats = mmanager_no_stats>
+class basic_mmanager : private LockPolicy, private Stats {
+public:
+    using header_type = HeaderLayout;
+    using stats_type = Stats;
+
+    static constexpr std::size_t header_size = sizeof(header_type);
+
+    // Maps an arena of `size` bytes. Throws std::bad_alloc if it cannot be
+    // mapped or has no room for a block.
+    explicit basic_mmanager(std::size_t size) : size_(size) {
+        if (size <= header_size) {
+            throw std::bad_alloc();
+        }
+        memory_ = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (memory_ == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+
+        free_list_ = static_cast<header_type *>(memory_);
+        free_list_->set_size(size - header_size);
+        free_list_->flags = 0;
+        free_list_->next = nullptr;
+    }
+
+    ~basic_mmanager() {
+        munmap(memory_, size_);
+    }
+
+    basic_mmanager(const basic_mmanager &) = delete;
+    basic_mmanager &operator=(const basic_mmanager &) = delete;
+
+    // Returns a pointer to a memory block of `size` bytes, or nullptr if no
+    // suitable block could be found.
+    void *allocate(std::size_t size) {
+        std::lock_guard<LockPolicy> guard(lock_policy());
+
+        header_type *allocated_block_header = Policy::search(free_list_, size);
+        if (!allocated_block_header) {
+            return nullptr;
+        }
+
+        // Allocated blocks are in no list, as in mmanager.c.
+        remove_from_list(free_list_, allocated_block_header);
+        split_block(allocated_block_header, size);
+
+        stats_policy().on_allocate(allocated_block_header->size(),
+            allocated_block_header->memory() + allocated_block_header->size() - static_cast<char *>(memory_));
+        return allocated_block_header->memory();
+    }
+
+    // Frees the memory block pointed to by `ptr`, which must not be nullptr.
+    void deallocate(void *ptr) {
+        std::lock_guard<LockPolicy> guard(lock_policy());
+
+        header_type *dealloc_block_header = header_type::from_memory(ptr);
+        stats_policy().on_deallocate(dealloc_block_header->size());
+
+        add_to_list(free_list_, dealloc_block_header);
+        coalesce_free_blocks();
+    }
+
+    // Returns the number of bytes usable in the block pointed to by `ptr`.
+    static std::size_t usable_size(void *ptr) {
+        return header_type::from_memory(ptr)->size();
+    }
+
+    // Returns the amount of available memory in bytes.
+    std::size_t available_memory() {
+        std::lock_guard<LockPolicy> guard(lock_policy());
+
+        std::size_t size = 0;
+        for (header_type *current_block = free_list_; current_block; current_block = current_block->next) {
+            size += current_block->size();
+        }
+        return size;
+    }
+
+    // Returns the statistics policy, e.g. the counters of mmanager_counting_stats.
+    // Not synchronized with concurrent allocations.
+    const Stats &stats() const {
+        return *this;
+    }
+
+    std::size_t arena_size() const {
+        return size_;
+    }
+
+private:
+    LockPolicy &lock_policy() {
+        return *this;
+    }
+
+    Stats &stats_policy() {
+        return *this;
+    }
+
+    // Gives any memory of `header_address` beyond `size` back to the free list.
+    void split_block(header_type *header_address, std::size_t size) {
+        if (header_address->size() - size > header_size) {
+            header_type *new_free_block_header = reinterpret_cast<header_type *>(header_address->memory() + size);
+            new_free_block_header->set_size(header_address->size() - (header_size + size));
+            new_free_block_header->flags = 0;
+            add_to_list(free_list_, new_free_block_header);
+
+            header_address->set_size(size);
+        }
+    }
+
+    // Inserts `header_address` into the address-ordered `list`.
+    static void add_to_list(header_type *&list, header_type *header_address) {
+        if (!list || header_address < list) {
+            header_address->next = list;
+            list = header_address;
+            return;
+        }
+
+        header_type *current_block = list;
+        while (current_block->next && current_block->next < header_address) {
+            current_block = current_block->next;
+        }
+        header_address->next = current_block->next;
+        current_block->next = header_address;
+    }
+
+    static void remove_from_list(header_type *&list, header_type *header_address) {
+        if (header_address == list) {
+            list = header_address->next;
+            return;
+        }
+
+        header_type *current_block = list;
+        while (current_block && current_block->next != header_address) {
+            current_block = current_block->next;
+        }
+        if (current_block) {
+            current_block->next = header_address->next;
+        }
+    }
+
+    // Merges physically contiguous free blocks.
+    void coalesce_free_blocks() {
+        header_type *current_block_header = free_list_;
+        while (current_block_header && current_block_header->next) {
+            header_type *next_block_header = current_block_header->next;
+            if (current_block_header->memory() + current_block_header->size()
+                == reinterpret_cast<char *>(next_block_header)) {
+                current_block_header->set_size(current_block_header->size() + header_size + next_block_header->size());
+                current_block_header->next = next_block_header->next;
+            }
+            else {
+                current_block_header = next_block_header;
+            }
+        }
+    }
+
+    std::size_t size_;
+    void *memory_;
+    header_type *free_list_;
+};
+
+#endif // BASIC_MMANAGER_HPP_
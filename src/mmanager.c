@@ -1,388 +1,3523 @@
+#define _GNU_SOURCE
 #include <assert.h>
+#include <execinfo.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <math.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "mmanager.h"
+#include "mmanager_dump.h"
+#include "mmanager_trace.h"
+
+// Sanitizer builds (see the top-level CMakeLists.txt) annotate the heap so
+// that AddressSanitizer and Valgrind see every block as a separate allocation.
+// This file itself is not instrumented by AddressSanitizer, so that the
+// allocator can touch headers and free memory that are poisoned for the rest
+// of the program, and calls the poisoning functions directly because the
+// ASAN_POISON_MEMORY_REGION() macros expand to nothing without instrumentation.
+#ifdef MMANAGER_ASAN
+#include <sanitizer/asan_interface.h>
+#endif
+#ifdef MMANAGER_VALGRIND
+#include <valgrind/memcheck.h>
+#endif
 
 
 #define HEADER_SIZE sizeof(header_t)
 
+// Number of bits of the first header word that hold the block size. The
+// remaining bits are per-block flags, which keeps headers at 16 bytes.
+#define BLOCK_SIZE_BITS 48
+
+// Number of header bits that hold the index of the block's arena.
+#define ARENA_INDEX_BITS 8
+#define MAX_ARENAS (1 << ARENA_INDEX_BITS)
+
+// Deferred frees of blocks up to QUICK_LIST_MAX_SIZE bytes are kept in quick
+// lists of QUICK_LIST_SPACING-byte size classes for reuse without coalescing.
+#define QUICK_LIST_SPACING 16
+#define QUICK_LIST_MAX_SIZE 256
+#define QUICK_LISTS (QUICK_LIST_MAX_SIZE / QUICK_LIST_SPACING)
+
 
 typedef struct header {
-    size_t block_size; 
-    struct header *next;
+    size_t block_size : BLOCK_SIZE_BITS;
+    size_t sampled : 1; // Block is tracked by the sampling profiler.
+    size_t arena : ARENA_INDEX_BITS; // Arena the allocated block belongs to.
+    size_t handle : 1; // Block is owned by a handle.
+    size_t pinned : 1; // Handle block must not be moved by compaction.
+    size_t trimmed : 1; // Pages of the free block were returned to the kernel.
+    size_t allocated : 1; // Block is allocated, cleared when it is freed.
+    union {
+        struct header *next; // Next block of the list a free block is in.
+        uint64_t check; // `header_check()` of an allocated block, 0 once freed.
+    };
     char block_memory[0]; // Must be the last field of this struct.
 } header_t;
 
 
+// One shard of the heap with its own lock and block lists. Each arena covers a
+// contiguous part of the mapping and is kept on its own cache lines.
+struct arena {
+    pthread_mutex_t lock;
+    unsigned index;
+    size_t size;
+    void *memory;
+    // Allocated blocks are in no list; walks find them by their `allocated`
+    // bit, so allocating and freeing do no list work for them.
+    header_t *free_list;
+
+    // Blocks freed by threads whose home is another arena, linked through
+    // their first word. Pushed without the lock and drained by whoever locks
+    // the arena next.
+    header_t *remote_frees;
+    size_t remote_free_count;
+
+    // Blocks freed while coalescing is deferred, linked through `next` and not
+    // yet part of the free list. Small ones go to the quick list of their size
+    // class, the rest to `pending_frees`. `pending_free_count` counts both.
+    header_t *pending_frees;
+    header_t *quick_lists[QUICK_LISTS];
+    size_t pending_free_count;
+
+    // Memory from `untouched` to the end of the arena was never written since
+    // it was mapped, and is therefore still zero. [zero_start, zero_end) is
+    // the part of the last claimed block known to be zero, for callocate().
+    char *untouched;
+    char *zero_start;
+    char *zero_end;
+
+    // Where the last compaction of the arena ran out of budget: the block it
+    // stopped at and the end of the compacted part below it, which the next
+    // compaction starts from. Forgotten when a block at or below
+    // `compact_resume` changes. A handles-only position is only resumed by
+    // another handles-only compaction.
+    header_t *compact_resume;
+    char *compact_destination;
+    bool compact_resume_handles_only;
+
+    // Statistics maintained by allocate/deallocate.
+    size_t allocated_bytes;
+    size_t allocated_blocks;
+    size_t peak_allocated_bytes;
+    size_t heap_high_water; // Offset from the start of the whole mapping.
+} __attribute__((aligned(64)));
+
 struct mmanager {
     enum AllocationPolicy allocation_policy;
+    unsigned flags; // MMANAGER_* initialization flags.
+    size_t coalesce_threshold; // Pending frees that trigger coalescing.
+    enum mmanager_invalid_free_action invalid_free_action;
+    size_t invalid_frees; // Rejected deallocate() and reallocate() calls.
+    size_t heap_corruptions; // Damaged blocks found by frees and checks.
+    enum mmanager_arena_assignment arena_assignment;
     size_t size;
     void *memory;
-    header_t *free_list;
-    header_t *alloc_list;
+    size_t mapped_size; // Length of the mapping, at least `size`.
+    size_t trim_unit; // Free memory is returned to the kernel in aligned units of this size.
+    size_t n_arenas;
+    size_t compact_cursor; // Arena where incremental compaction resumes.
+    uint64_t header_key; // Secret mixed into `header_check()`, chosen per heap.
+    struct arena arenas[MAX_ARENAS];
+};
+
+// Old and new address of a block moved by compaction.
+struct relocation {
+    void *before;
+    void *after;
+};
+
+// Moves of the last compaction that was not given address arrays, sorted by
+// old address. Protected by `lock`, which is taken before the arena locks.
+struct relocation_map {
+    pthread_mutex_t lock;
+    struct relocation *entries;
+    size_t capacity;
+    size_t count;
+};
+
+// A compaction pass in progress. Moves are recorded in `before_addresses` and
+// `after_addresses`, or in `relocations` if those are NULL, and counted against
+// the budgets, where 0 means no limit.
+struct compaction {
+    void **before_addresses;
+    void **after_addresses;
+    size_t max_bytes;
+    size_t max_blocks;
+    size_t moved_bytes;
+    size_t moved_blocks;
+    enum mmanager_trace_op trace_op;
+    struct relocation *relocations;
+    bool handles_only; // Leave other blocks in place and record nothing.
+};
+
+// Background maintenance thread. `lock` and `cond` let `mmanager_destroy()`
+// wake it up to stop.
+struct maintenance {
+    bool running;
+    bool stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint64_t interval_ns;
+    unsigned duty_cycle;
+    size_t next_arena;
+    uint64_t check_interval_ns; // Period of `mmanager_check()` runs, 0 if off.
+    uint64_t next_check_ns;
+};
+
+
+// Allocation tracer state. Records are staged in `buffer` and written to `fd`
+// whenever the buffer fills up. `active` only changes while all arenas are
+// locked; the rest is protected by `lock`, which nests inside the arena locks.
+struct tracer {
+    bool active;
+    pthread_mutex_t lock;
+    int fd;
+    struct mmanager_trace_record *buffer;
+    size_t capacity;
+    size_t count;
+};
+
+
+#define DEFAULT_TRACE_BUFFER_RECORDS 4096
+#define DUMP_BUFFER_RECORDS 4096
+#define DEFAULT_PROFILER_SAMPLE_PERIOD (512 * 1024)
+#define PROFILER_MAX_DEPTH 64
+#define PROFILER_BUCKETS 1024
+#define PROFILER_INITIAL_SAMPLES 1024
+#define PROFILER_BUCKETS_PER_CHUNK 64
+#define PROFILER_WRITE_BUFFER 65536
+
+// Handle blocks start with their handle, so that compaction can find the handle
+// table entry of a block it moves. Keeps the user memory 16-byte aligned.
+#define HANDLE_PREFIX_SIZE 16
+
+#define DEFAULT_COALESCE_THRESHOLD 64
+
+#define DEFAULT_GUARD_SLOTS 64
+
+#define HUGE_INITIAL_BLOCKS 64
+
+#define HUGE_PAGE_SIZE (2ul * 1024 * 1024)
+
+// Trailing canary of blocks with MMANAGER_CANARIES, and the byte freed blocks
+// are filled with under MMANAGER_POISON_FREE.
+#define CANARY_SIZE 16
+#define CANARY_PATTERN 0xcafef00dcafef00dull
+#define FREE_POISON 0xdd
+
+#define DEFAULT_MAINTENANCE_INTERVAL_MS 10
+#define DEFAULT_MAINTENANCE_DUTY_CYCLE 5
+// Bytes of handle blocks the maintenance thread moves per arena and run.
+#define MAINTENANCE_COMPACT_BYTES (256 * 1024)
+
+
+// Call stack captured for a sampled allocation.
+struct profile_stack {
+    int depth;
+    void *frames[PROFILER_MAX_DEPTH];
 };
 
+// Allocation counters of all samples taken at one call stack.
+struct profile_bucket {
+    struct profile_bucket *next;
+    uint64_t hash;
+    struct profile_stack stack;
+    size_t live_count;
+    size_t live_bytes;
+    size_t total_count;
+    size_t total_bytes;
+};
+
+// Buckets are carved out of chunks that are only released when the profiler stops.
+struct profile_bucket_chunk {
+    struct profile_bucket_chunk *next;
+    size_t used;
+    struct profile_bucket buckets[PROFILER_BUCKETS_PER_CHUNK];
+};
+
+// A sampled allocation that has not been deallocated yet.
+struct profile_sample {
+    void *ptr;
+    size_t size;
+    struct profile_bucket *bucket;
+};
+
+// Slot of the handle table. `block` is NULL while the slot is free, in which
+// case `next_free` is the handle of the next free slot. `block` and `pins` are
+// protected by the lock of arena `arena`.
+struct handle_entry {
+    header_t *block;
+    mm_handle_t next_free;
+    uint32_t pins;
+    uint32_t arena;
+};
+
+// Indirection table of handle blocks. The table is reserved for the largest
+// possible number of handles when the first one is allocated, so that entries
+// never move. `lock` protects the free slots and is never held together with
+// an arena lock.
+struct handle_table {
+    pthread_mutex_t lock;
+    struct handle_entry *entries;
+    size_t capacity;
+    size_t used;
+    mm_handle_t free_slot;
+};
+
+// Page of the guarded region. `ptr` and `size` describe the block placed at
+// the end of the page, kept after it is freed for fault reports.
+struct guard_slot {
+    void *ptr;
+    size_t size;
+    bool allocated;
+};
+
+// Region for sampled allocations that are placed right below an inaccessible
+// guard page. Slots alternate with guard pages, starting and ending with one,
+// and freed slots are made inaccessible as well. `lock` protects the slots and
+// is never held together with an arena lock.
+struct guard_region {
+    pthread_mutex_t lock;
+    size_t sample_rate; // One in `sample_rate` allocations is guarded, 0 if off.
+    char *memory;
+    size_t size;
+    size_t page_size;
+    struct guard_slot *slots;
+    size_t n_slots;
+    size_t next_slot; // Where the search for a free slot starts.
+    size_t allocated_slots;
+    struct sigaction previous_action;
+};
 
-static struct mmanager memory_manager = { -1, 0, NULL, NULL, NULL };
-static pthread_mutex_t lock;
+// A block larger than the mmap threshold, mapped on its own. `ptr` is the
+// start of the mapping and `size` its length.
+struct huge_block {
+    void *ptr;
+    size_t size;
+};
+
+// Blocks that bypass the arenas. `blocks` is an open-addressed table of the
+// live mappings keyed by address. `lock` protects the table and is never held
+// together with an arena lock.
+struct huge_blocks {
+    pthread_mutex_t lock;
+    size_t threshold; // Larger requests are mapped on their own, 0 if off.
+    size_t page_size;
+    struct huge_block *blocks;
+    size_t capacity;
+    size_t count;
+    size_t mapped_bytes;
+};
+
+// Sampling heap profiler state. `samples` is an open-addressed table of live
+// samples keyed by pointer. Protected by `lock`, which nests inside the
+// arena locks.
+struct profiler {
+    bool active;
+    size_t sample_period;
+    pthread_mutex_t lock;
+    struct profile_bucket *buckets[PROFILER_BUCKETS];
+    struct profile_bucket_chunk *chunks;
+    struct profile_sample *samples;
+    size_t samples_capacity;
+    size_t samples_count;
+};
+
+
+static struct mmanager memory_manager = { .allocation_policy = -1 };
+static struct tracer tracer = { false, PTHREAD_MUTEX_INITIALIZER, -1, NULL, 0, 0 };
+static struct profiler profiler = { .active = false, .lock = PTHREAD_MUTEX_INITIALIZER };
+static struct handle_table handles = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static struct relocation_map relocation_map = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static struct maintenance maintenance = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+static struct guard_region guard = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static struct huge_blocks huge = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// Bytes this thread may still allocate before the next profiler sample, and
+// the state of its random number generator.
+static __thread ssize_t bytes_until_sample = -1;
+static __thread uint64_t sample_random_state = 0;
+
+// Ticket used to assign this thread an arena round-robin (0 until assigned),
+// and the counter tickets are taken from.
+static __thread unsigned arena_ticket = 0;
+static unsigned next_arena_ticket = 0;
+
+// Allocations this thread makes before the next guarded one.
+static __thread size_t allocations_until_guard = 0;
 
 
 // Returns the header to a free block of memory using the first-fit search policy.
 // Returns NULL if no suitable free block could be found.
-static header_t *first_fit_block_search(size_t block_size);
+static header_t *first_fit_block_search(struct arena *arena, size_t block_size);
 
 // Returns the header to a free block of memory using the best-fit search policy.
 // Returns NULL if no suitable free block could be found.
-static header_t *best_fit_block_search(size_t block_size);
+static header_t *best_fit_block_search(struct arena *arena, size_t block_size);
 
 // Returns the header to a free block of memory using the worst-fit search policy.
 // Returns NULL if no suitable free block could be found.
-static header_t *worst_fit_block_search(size_t block_size);
+static header_t *worst_fit_block_search(struct arena *arena, size_t block_size);
 
 // Adds the block specified by `header_address` to the allocator's free list.
-static void add_to_free_list(header_t *header_address);
+static void add_to_free_list(struct arena *arena, header_t *header_address);
 
 // Removes the block specified by `header_address` from the allocator's free list.
 // Assumes `header_address` is in the free list.
-static void remove_from_free_list(header_t *header_address);
+static void remove_from_free_list(struct arena *arena, header_t *header_address);
+
+// Eliminates contiguous free blocks in the free list.
+static void coalesce_free_blocks(struct arena *arena);
+
+// Charges an allocation of `size` bytes to the calling thread's sampling budget.
+// Returns true and captures the caller's stack in `stack` if the allocation
+// should be sampled.
+static bool profiler_should_sample(size_t size, struct profile_stack *stack);
+
+// Starts tracking the allocated block `header_address` as a sample taken at
+// `stack`. Assumes the block's arena is locked.
+static void profiler_record(header_t *header_address, size_t size, const struct profile_stack *stack);
+
+// Stops tracking the sampled block at `ptr`. Assumes the block's arena is locked.
+static void profiler_forget(void *ptr);
+
+// Updates the tracked address of a sampled block moved by compaction. Assumes
+// the block's arena is locked.
+static void profiler_move(void *before, void *after);
+
+// Maps the guarded region and installs the fault handler that reports guard
+// page hits. Returns false if the region could not be mapped.
+static bool guard_initialize(size_t sample_rate, size_t n_slots);
+
+// Unmaps the guarded region and restores the previous fault handler.
+static void guard_destroy(void);
+
+// Counts an allocation against the calling thread's guard sampling interval.
+// Returns true if it should be guarded.
+static inline bool guard_should_sample(void);
+
+// Returns true if `ptr` points into the guarded region.
+static inline bool guard_owns(const void *ptr);
+
+// Returns a block of `size` bytes aligned to `alignment` that ends at a guard
+// page, or NULL if the block does not fit in a page or all slots are in use.
+static void *guard_allocate(size_t alignment, size_t size);
+
+// Frees the guarded block at `ptr` and makes its page inaccessible.
+static void guard_deallocate(void *ptr);
+
+// Same as `validate_free()` for a pointer into the guarded region.
+static bool guard_validate_free(void *ptr, const char *caller);
+
+// Returns the slot of the page containing `ptr`, or NULL if it is a guard page.
+static struct guard_slot *guard_slot_of(const void *ptr);
+
+// Enables mapping requests larger than `threshold` bytes on their own.
+static void huge_initialize(size_t threshold);
+
+// Unmaps every mapped block and the table that tracks them.
+static void huge_destroy(void);
+
+// Returns true if `ptr` may be a mapped block, i.e. the bypass is enabled and
+// `ptr` is outside the arenas.
+static inline bool huge_candidate(const void *ptr);
+
+// Maps a block of `size` bytes aligned to `alignment`. Returns NULL if the
+// alignment exceeds a page or the mapping fails.
+static void *huge_allocate(size_t alignment, size_t size);
+
+// Unmaps the block at `ptr`. Returns false if `ptr` is not a mapped block.
+static bool huge_deallocate(void *ptr);
+
+// Resizes the mapped block at `ptr` to `new_size` bytes with mremap(), moving
+// it if needed. Returns NULL, leaving the block alone, if it cannot be resized.
+static void *huge_reallocate(void *ptr, size_t new_size);
+
+// Returns the size of the mapped block at `ptr`, or 0 if it is not one.
+static size_t huge_size(void *ptr);
+
+// Returns the slot of `ptr` in the mapped block table, or the empty slot where
+// it would be inserted. Assumes `huge.lock` is held.
+static size_t huge_slot(const void *ptr);
+
+// Adds `block` to the table, growing it if needed. Returns false if the table
+// is full and could not be grown. Assumes `huge.lock` is held.
+static bool huge_insert(struct huge_block block);
+
+// Removes the entry in `slot` from the table. Assumes `huge.lock` is held.
+static void huge_remove(size_t slot);
+
+// SIGSEGV handler that reports faults in the guarded region, then passes
+// every fault on to the previous handler.
+static void guard_fault_handler(int signal, siginfo_t *info, void *context);
+
+// Hands a fault to the handler that was installed before the guarded region.
+// The default action is restored for the retried access only if there was no
+// handler, since the process is about to terminate then.
+static void guard_chain_fault(int signal, siginfo_t *info, void *context);
+
+// Signal-safe formatting for fault reports. Append `text`, or `value` in
+// hexadecimal (with a 0x prefix) or decimal, to the `length` bytes already in
+// `message`, which holds `size` bytes, and return the new length.
+static size_t append_text(char *message, size_t size, size_t length, const char *text);
+static size_t append_hex(char *message, size_t size, size_t length, uintptr_t value);
+static size_t append_decimal(char *message, size_t size, size_t length, size_t value);
+
+// Returns the keyed checksum of the address, size and arena of the block
+// `header_address`, which is kept in its `check` word while it is allocated.
+static inline uint64_t header_check(const header_t *header_address);
+
+// Returns a fresh secret for `header_check()`.
+static uint64_t new_header_key(void);
+
+// Returns true if `ptr` is the address of an allocated block. Otherwise counts
+// and reports the bad call to `caller` as configured by the invalid free action,
+// and returns false. Takes constant time.
+static bool validate_free(void *ptr, const char *caller);
+
+// Counts and reports a bad free of `ptr`, described by `problem`, as
+// configured by the invalid free action.
+static void report_invalid_free(void *ptr, const char *caller, const char *problem);
+
+// Counts and reports the damaged block at `ptr`, found by `caller` and described
+// by `problem`, as configured by the invalid free action.
+static void report_corruption(void *ptr, const char *caller, const char *problem);
+
+// Reports a heap error as configured by the invalid free action.
+static void report_heap_error(const char *kind, void *ptr, const char *caller, const char *problem);
+
+// Returns the bytes reserved at the end of every block for its canary.
+static inline size_t canary_size(void);
+
+// Writes the canary at the end of the allocated block `header_address` if
+// canaries are enabled.
+static void write_canary(header_t *header_address);
+
+// Returns false if canaries are enabled and the canary of the allocated block
+// `header_address` was overwritten.
+static bool canary_intact(const header_t *header_address);
+
+// Returns true if the `size` bytes at `memory` all hold the free poison, or
+// zero for pages that were never written or were trimmed.
+static bool poison_intact(const char *memory, size_t size);
+
+// Walks `arena` once in address order and reports every inconsistency with its
+// lists, headers, canaries and poisoned memory. Returns the number of problems.
+// Assumes the arena is locked.
+static size_t check_arena(struct arena *arena);
+
+// Marks the arenas as inaccessible to the program when the allocator is set
+// up, and as accessible again when it is destroyed.
+static void annotate_heap_created(void);
+static void annotate_heap_destroyed(void);
+
+// Makes the usable part of the block `header_address` accessible as a new
+// allocation.
+static inline void annotate_block_allocated(header_t *header_address);
+
+// Makes the block `header_address` inaccessible as it is freed.
+static inline void annotate_block_freed(header_t *header_address);
+
+// Updates the accessible part of the allocated block `header_address`, which
+// was resized in place from `old_size` bytes.
+static inline void annotate_block_resized(header_t *header_address, size_t old_size);
+
+// Moves the accessible part of an allocated block from `before` to the block
+// `header_address`.
+static inline void annotate_block_moved(void *before, header_t *header_address);
+
+// Tells Valgrind that the header written at `header_address` is allocator
+// metadata that may be read and written.
+static inline void annotate_header(header_t *header_address);
+
+// Let the allocator itself access `size` bytes at `ptr` that are inaccessible
+// to the program, and take that access away again.
+static inline void annotate_internal_access(void *ptr, size_t size);
+static inline void annotate_internal_done(void *ptr, size_t size);
+
+// Maps `size` bytes for the arenas, backed by huge pages with
+// MMANAGER_HUGE_PAGES, and sets the mapped size and trim unit. Returns NULL if
+// the memory could not be mapped.
+static void *map_arenas(size_t size);
+
+// Returns `size` bytes of zeroed memory for allocator bookkeeping, or NULL if the
+// memory could not be mapped. Bookkeeping never uses malloc() so that it keeps
+// working when malloc() itself is implemented on top of this allocator.
+static void *metadata_map(size_t size);
+
+// Releases memory obtained from `metadata_map()`.
+static void metadata_unmap(void *ptr, size_t size);
+
+// Writes `size` bytes from `data` to `fd`, retrying on partial writes. Returns
+// false if the write failed.
+static bool write_all(int fd, const void *data, size_t size);
+
+// Take and release the lock of `arena`, unless locking was disabled with
+// MMANAGER_NO_LOCKING.
+static inline void lock_arena(struct arena *arena);
+static inline void unlock_arena(struct arena *arena);
+
+// Take and release the locks of all arenas, in index order.
+static void lock_all_arenas(void);
+static void unlock_all_arenas(void);
+
+// Returns the arena the calling thread allocates from by default.
+static struct arena *thread_arena(void);
+
+// Locks and returns `home`, or any other arena whose lock is free if `home` is
+// contended. Blocks on `home` if every arena is busy.
+static struct arena *lock_any_arena(struct arena *home);
+
+// Pushes the allocated block `header_address` onto the remote-free queue of
+// `arena` without taking its lock.
+static void push_remote_free(struct arena *arena, header_t *header_address);
+
+// Deallocates every block in the remote-free queue of `arena`. Assumes the
+// arena is locked.
+static void drain_remote_frees(struct arena *arena);
+
+// Queues the freed block `header_address` without coalescing, and coalesces
+// all queued blocks once MMANAGER_DEFERRED_COALESCING's threshold is reached.
+// Assumes the arena is locked.
+static void defer_free(struct arena *arena, header_t *header_address);
+
+// Returns the quick list index of blocks of `size` bytes.
+static size_t quick_list_index(size_t size);
+
+// Reuses a deferred free block of the size class of `size` if there is one
+// large enough. Returns NULL otherwise. Assumes the arena is locked.
+static header_t *take_quick_block(struct arena *arena, size_t size);
+
+// Adds the blocks freed while coalescing was deferred to the free list and
+// merges contiguous free blocks. Assumes the arena is locked.
+static void flush_pending_frees(struct arena *arena);
+
+// Brings the free list of `arena` up to date with all frees, for operations
+// that look at the whole arena. Assumes the arena is locked.
+static void settle_arena(struct arena *arena);
+
+// Returns the whole pages inside free blocks of `arena` to the kernel. Assumes
+// the arena is locked.
+static void trim_free_blocks(struct arena *arena);
+
+// Runs the maintenance work on `arena`: settles it, compacts handle blocks,
+// moving at most `max_bytes` bytes (0 for no limit), and trims free pages.
+// Assumes the arena is locked.
+static void maintain_arena(struct arena *arena, size_t max_bytes);
+
+// Body of the background maintenance thread.
+static void *maintenance_thread(void *arg);
+
+// Returns the time of the monotonic clock in nanoseconds.
+static uint64_t monotonic_ns(void);
+
+// Allocates a block of `size` bytes (aligned to `alignment` unless it is 0),
+// trying the calling thread's arena first and then the others. On success the
+// block's arena is left locked and returned through `arena_out`. Returns NULL
+// with no arena locked if no arena has a suitable free block.
+static header_t *allocate_from_arenas(size_t alignment, size_t size, struct arena **arena_out);
+
+// Finds a free block of at least `size` bytes using the current allocation
+// policy, splits off any excess and claims the block. Returns
+// NULL if no suitable free block could be found. Assumes the arena is locked.
+static header_t *allocate_block(struct arena *arena, size_t size);
+
+// Removes the free block `header_address` from the free list, splits off any
+// memory beyond `size` bytes as a new free block and claims the block. Assumes
+// the arena is locked.
+static header_t *take_free_block(struct arena *arena, header_t *header_address, size_t size);
+
+// Marks the block `header_address`, which is in no list, as allocated and
+// counts it. Assumes the arena is locked.
+static header_t *claim_block(struct arena *arena, header_t *header_address);
+
+// Sets the known-zero range of `arena` to the part of the block
+// `header_address`, about to be claimed, that is untouched or trimmed memory.
+static void find_zero_memory(struct arena *arena, const header_t *header_address);
+
+// Forgets where compaction of `arena` stopped if the block `header_address`
+// is at or below that position.
+static inline void forget_compact_resume(struct arena *arena, const header_t *header_address);
+
+// Moves the untouched memory mark of `arena` past the block `header_address`
+// and the header that may follow it.
+static void touch_block(struct arena *arena, const header_t *header_address);
+
+// Moves the untouched memory mark of `arena` up to `end`.
+static inline void touch_memory(struct arena *arena, char *end);
+
+// Fills the `size` bytes at `memory` in `arena` with the free poison if
+// MMANAGER_POISON_FREE is set. The memory is no longer known to be zero.
+static void poison_free_memory(struct arena *arena, void *memory, size_t size);
+
+// Finds a free block with room for `size` bytes starting at a multiple of
+// `alignment` and allocates it, leaving any leading gap in the free list.
+// Returns NULL if no suitable free block could be found. Assumes the arena is locked.
+static header_t *allocate_aligned_block(struct arena *arena, size_t alignment, size_t size);
+
+// Shrinks the block `header_address` to `size` bytes if the excess can hold a
+// new free block, which is added to the free list. Assumes the arena is locked.
+static void split_block(struct arena *arena, header_t *header_address, size_t size);
+
+// Tries to resize the allocated block `header_address` to `new_size` bytes
+// without moving it, by shrinking it or by absorbing the free block that
+// follows it. Returns false if that is not possible. Assumes the arena is locked.
+static bool resize_block(struct arena *arena, header_t *header_address, size_t new_size);
+
+// Completes a reallocation of `ptr` that produced `new_block_header` (NULL if it
+// failed): accounts the block as a fresh profiler sample if `stack` is given
+// and records the trace. Assumes the arena of the new block is locked.
+static void *finish_reallocation(void *ptr, header_t *new_block_header, size_t new_size,
+    const struct profile_stack *stack);
+
+// Locks the relocation map and makes `compaction` record its moves there if it
+// was given no address arrays.
+static void start_relocations(struct compaction *compaction);
+
+// Publishes the moves recorded by `start_relocations()` and unlocks the map.
+static void finish_relocations(struct compaction *compaction);
+
+// Makes room in the relocation map for `n` more moves of `compaction`. Returns
+// false if the map could not be grown. Assumes the map is locked.
+static bool reserve_relocations(struct compaction *compaction, size_t n);
+
+// Orders relocations by old address.
+static int compare_relocations(const void *a, const void *b);
+
+// Moves allocated blocks of `arena` down into the lowest free block, in address
+// order, until the arena is compact or the budget of `compaction` runs out.
+// Returns true if the arena is compact. Assumes the arena is locked.
+static bool compact_arena(struct arena *arena, struct compaction *compaction);
+
+// Returns a free slot of the handle table, creating the table on first use, or
+// MM_NULL_HANDLE if it is full.
+static mm_handle_t take_handle_slot(void);
+
+// Returns the slot of `handle` to the free slots.
+static void release_handle_slot(mm_handle_t handle);
+
+// Moves the allocated block `header_address` back to the free list and merges
+// contiguous free blocks, or only queues it as a pending free while coalescing
+// is deferred. Assumes the arena is locked.
+static void deallocate_block(struct arena *arena, header_t *header_address);
+
+// Appends a record for operation `op` on `ptr` to the trace buffer, flushing the
+// buffer to the trace file if it is full. Callers hold the arena lock of the
+// block the record refers to, so that records follow the order of operations
+// on the heap.
+static void trace_record(enum mmanager_trace_op op, void *ptr, uint64_t arg);
+
+// Writes all buffered trace records to the trace file. Assumes the tracer lock
+// is held.
+static void trace_flush(void);
+
+
+void mmanager_initialize(size_t size, enum AllocationPolicy allocation_policy) {
+    struct mmanager_options options = { size, allocation_policy, 0 };
+    mmanager_initialize_with_options(&options);
+}
+
+void mmanager_initialize_with_options(const struct mmanager_options *options) {
+    size_t size = options->size;
+    size_t n_arenas = options->arenas ? options->arenas : 1;
+    if (n_arenas > MAX_ARENAS) {
+        n_arenas = MAX_ARENAS;
+    }
+
+    // Obtain 'size' bytes for the allocator and set allocation algorithm. The
+    // memory is mapped directly rather than taken from malloc() so that it can
+    // back malloc() itself (see mmanager_preload.c). Fresh mappings are
+    // zero-filled, so the user memory starts out as 0.
+    memory_manager.flags = options->flags;
+    memory_manager.memory = map_arenas(size);
+    if (!memory_manager.memory) {
+        fprintf(stderr, "ERROR: failed to obtain %lu memory for the allocator.\n", size);
+        raise(SIGABRT);
+    }
+    memory_manager.size = size;
+    memory_manager.allocation_policy = options->allocation_policy;
+    memory_manager.invalid_free_action = options->invalid_free_action;
+    memory_manager.invalid_frees = 0;
+    memory_manager.heap_corruptions = 0;
+    memory_manager.coalesce_threshold = options->coalesce_threshold
+        ? options->coalesce_threshold : DEFAULT_COALESCE_THRESHOLD;
+    memory_manager.arena_assignment = options->arena_assignment;
+    memory_manager.n_arenas = n_arenas;
+    memory_manager.compact_cursor = 0;
+    memory_manager.header_key = new_header_key();
+
+    // Split the memory evenly between the arenas, keeping them aligned to the
+    // header size. The last arena also gets the remainder.
+    size_t arena_size = size / n_arenas & ~(HEADER_SIZE - 1);
+    if ((memory_manager.flags & MMANAGER_HUGE_PAGES) && arena_size >= HUGE_PAGE_SIZE) {
+        // Start every arena on a huge page.
+        arena_size &= ~(HUGE_PAGE_SIZE - 1);
+    }
+    assert(arena_size > HEADER_SIZE);
+
+    for (size_t i = 0; i < n_arenas; ++i) {
+        struct arena *arena = &memory_manager.arenas[i];
+        arena->index = i;
+        arena->memory = (char *)memory_manager.memory + i * arena_size;
+        arena->size = i + 1 < n_arenas ? arena_size : size - i * arena_size;
+
+        // Set initial free block properties.
+        arena->free_list = (header_t *)arena->memory;
+        arena->free_list->block_size = arena->size - HEADER_SIZE;
+        arena->free_list->sampled = 0;
+        arena->free_list->handle = 0;
+        arena->free_list->pinned = 0;
+        arena->free_list->trimmed = 0;
+        arena->free_list->allocated = 0;
+        arena->free_list->next = NULL;
+
+        // Set remote-free queue to empty.
+        arena->remote_frees = NULL;
+        arena->remote_free_count = 0;
+        arena->pending_frees = NULL;
+        memset(arena->quick_lists, 0, sizeof(arena->quick_lists));
+        arena->pending_free_count = 0;
+        arena->untouched = arena->memory + HEADER_SIZE;
+        arena->compact_resume = NULL;
+
+        // Reset statistics.
+        arena->allocated_bytes = 0;
+        arena->allocated_blocks = 0;
+        arena->peak_allocated_bytes = 0;
+        arena->heap_high_water = 0;
+
+        // Initialize mutex.
+        pthread_mutex_init(&arena->lock, NULL);
+    }
+
+    // The maintenance thread needs the arena locks.
+    size_t check_interval_ms = options->check_interval_ms;
+    if (options->flags & MMANAGER_NO_LOCKING) {
+        memory_manager.flags &= ~MMANAGER_BACKGROUND_MAINTENANCE;
+        check_interval_ms = 0;
+    }
+    if ((memory_manager.flags & MMANAGER_BACKGROUND_MAINTENANCE) || check_interval_ms) {
+        // Without maintenance work, the thread only wakes up for the checks.
+        unsigned interval_ms = options->maintenance_interval_ms
+            ? options->maintenance_interval_ms : DEFAULT_MAINTENANCE_INTERVAL_MS;
+        if (!(memory_manager.flags & MMANAGER_BACKGROUND_MAINTENANCE)) {
+            interval_ms = check_interval_ms;
+        }
+        unsigned duty_cycle = options->maintenance_duty_cycle
+            ? options->maintenance_duty_cycle : DEFAULT_MAINTENANCE_DUTY_CYCLE;
+        maintenance.check_interval_ns = (uint64_t)check_interval_ms * 1000000;
+        maintenance.next_check_ns = monotonic_ns() + maintenance.check_interval_ns;
+        maintenance.interval_ns = (uint64_t)interval_ms * 1000000;
+        maintenance.duty_cycle = duty_cycle < 100 ? duty_cycle : 100;
+        maintenance.next_arena = 0;
+        maintenance.stop = false;
+        maintenance.running = pthread_create(&maintenance.thread, NULL, maintenance_thread, NULL) == 0;
+    }
+
+    if (options->guard_sample_rate) {
+        guard_initialize(options->guard_sample_rate, options->guard_slots ? options->guard_slots : DEFAULT_GUARD_SLOTS);
+    }
+    if (options->mmap_threshold) {
+        huge_initialize(options->mmap_threshold);
+    }
+
+    annotate_heap_created();
+}
+
+void mmanager_destroy(void) {
+    if (maintenance.running) {
+        pthread_mutex_lock(&maintenance.lock);
+        maintenance.stop = true;
+        pthread_cond_signal(&maintenance.cond);
+        pthread_mutex_unlock(&maintenance.lock);
+        pthread_join(maintenance.thread, NULL);
+        maintenance.running = false;
+    }
+
+    mmanager_trace_stop();
+    mmanager_profiler_stop();
+    guard_destroy();
+    huge_destroy();
+    annotate_heap_destroyed();
+    munmap(memory_manager.memory, memory_manager.mapped_size);
+    memory_manager.memory = NULL;
+    for (size_t i = 0; i < memory_manager.n_arenas; ++i) {
+        pthread_mutex_destroy(&memory_manager.arenas[i].lock);
+    }
+    memory_manager.n_arenas = 0;
+
+    metadata_unmap(handles.entries, handles.capacity * sizeof(*handles.entries));
+    handles.entries = NULL;
+    handles.capacity = 0;
+    handles.used = 0;
+    handles.free_slot = MM_NULL_HANDLE;
+
+    metadata_unmap(relocation_map.entries, relocation_map.capacity * sizeof(*relocation_map.entries));
+    relocation_map.entries = NULL;
+    relocation_map.capacity = 0;
+    relocation_map.count = 0;
+}
+
+void *allocate(size_t size) {
+    assert(size > 0);
+    void *ptr = NULL;
+
+    if (guard.sample_rate && guard_should_sample() && (ptr = guard_allocate(0, size))) {
+        return ptr;
+    }
+    if (huge.threshold && size > huge.threshold && (ptr = huge_allocate(0, size))) {
+        return ptr;
+    }
+
+    struct profile_stack stack;
+    bool sampled = __atomic_load_n(&profiler.active, __ATOMIC_RELAXED) && profiler_should_sample(size, &stack);
+
+    struct arena *arena;
+    header_t *allocated_block_header = allocate_from_arenas(0, size, &arena);
+    if (allocated_block_header) {
+        ptr = (void *)allocated_block_header->block_memory;
+        if (sampled) {
+            profiler_record(allocated_block_header, size, &stack);
+        }
+    }
+
+    if (tracer.active) {
+        trace_record(MMANAGER_TRACE_ALLOCATE, ptr, size);
+    }
+    if (allocated_block_header) {
+        unlock_arena(arena);
+    }
+
+    return ptr;
+}
+
+void *allocate_debug(size_t size, int *i) {
+    assert(size > 0);
+    void *ptr = NULL;
+
+    struct arena *arena;
+    header_t *allocated_block_header = allocate_from_arenas(0, size, &arena);
+    if (allocated_block_header) {
+        ptr = (void *)allocated_block_header->block_memory;
+        unlock_arena(arena);
+    }
+
+    return ptr;
+}
+
+void *callocate(size_t n, size_t size) {
+    void *memory = NULL;
+
+    size_t total;
+    if (__builtin_mul_overflow(n, size, &total)) {
+        return NULL;
+    }
+
+    if (guard.sample_rate && guard_should_sample() && (memory = guard_allocate(0, total))) {
+        memset(memory, 0, total);
+        return memory;
+    }
+    // Fresh mappings are already zero.
+    if (huge.threshold && total > huge.threshold && (memory = huge_allocate(0, total))) {
+        return memory;
+    }
+
+    struct profile_stack stack;
+    bool sampled = __atomic_load_n(&profiler.active, __ATOMIC_RELAXED) && profiler_should_sample(total, &stack);
+
+    // Only the part of the block that is not known to be zero is cleared.
+    char *zero_start = NULL;
+    char *zero_end = NULL;
+
+    struct arena *arena;
+    header_t *allocated_block_header = allocate_from_arenas(0, total, &arena);
+    if (allocated_block_header) {
+        memory = (void *)allocated_block_header->block_memory;
+        zero_start = arena->zero_start;
+        zero_end = arena->zero_end;
+        if (sampled) {
+            profiler_record(allocated_block_header, total, &stack);
+        }
+    }
+
+    if (tracer.active) {
+        trace_record(MMANAGER_TRACE_CALLOCATE, memory, total);
+    }
+    if (!allocated_block_header) {
+        return NULL;
+    }
+    unlock_arena(arena);
+
+    char *end = (char *)memory + total;
+    if (zero_start > end) {
+        zero_start = end;
+    }
+    memset(memory, 0, zero_start - (char *)memory);
+    if (zero_end < end) {
+        memset(zero_end, 0, end - zero_end);
+    }
+    return memory;
+}
+
+void *allocate_aligned(size_t alignment, size_t size) {
+    assert(size > 0);
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+    void *ptr = NULL;
+
+    if (guard.sample_rate && guard_should_sample() && (ptr = guard_allocate(alignment, size))) {
+        return ptr;
+    }
+    if (huge.threshold && size > huge.threshold && (ptr = huge_allocate(alignment, size))) {
+        return ptr;
+    }
+
+    struct profile_stack stack;
+    bool sampled = __atomic_load_n(&profiler.active, __ATOMIC_RELAXED) && profiler_should_sample(size, &stack);
+
+    struct arena *arena;
+    header_t *allocated_block_header = allocate_from_arenas(alignment, size, &arena);
+    if (allocated_block_header) {
+        ptr = (void *)allocated_block_header->block_memory;
+        if (sampled) {
+            profiler_record(allocated_block_header, size, &stack);
+        }
+    }
+
+    if (tracer.active) {
+        trace_record(MMANAGER_TRACE_ALLOCATE, ptr, size);
+    }
+    if (allocated_block_header) {
+        unlock_arena(arena);
+    }
+
+    return ptr;
+}
+
+void *reallocate(void *ptr, size_t new_size) {
+    if (!ptr) {
+        return new_size > 0 ? allocate(new_size) : NULL;
+    }
+    if (new_size == 0) {
+        deallocate(ptr);
+        return NULL;
+    }
+
+    // Guarded blocks are never resized in place.
+    if (guard_owns(ptr)) {
+        if (!guard_validate_free(ptr, "reallocate")) {
+            return NULL;
+        }
+        size_t old_size = mmanager_usable_size(ptr);
+        void *new_ptr = allocate(new_size);
+        if (new_ptr) {
+            memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+            guard_deallocate(ptr);
+        }
+        return new_ptr;
+    }
+
+    // Mapped blocks stay mapped and are resized without copying.
+    if (huge_candidate(ptr) && huge_size(ptr)) {
+        return huge_reallocate(ptr, new_size);
+    }
+
+    if (!validate_free(ptr, "reallocate")) {
+        return NULL;
+    }
+
+    // Blocks growing past the threshold move out of the arena.
+    size_t old_size = mmanager_usable_size(ptr);
+    if (huge.threshold && new_size > huge.threshold && new_size > old_size) {
+        void *new_ptr = huge_allocate(0, new_size);
+        if (new_ptr) {
+            memcpy(new_ptr, ptr, old_size);
+            deallocate(ptr);
+            return new_ptr;
+        }
+    }
+
+    void *new_ptr = NULL;
+    bool done = false;
+    struct profile_stack stack;
+    bool sampled = __atomic_load_n(&profiler.active, __ATOMIC_RELAXED) && profiler_should_sample(new_size, &stack);
+
+    header_t *block_header = (header_t *)((char *)ptr - HEADER_SIZE);
+    struct arena *arena = &memory_manager.arenas[block_header->arena];
+    lock_arena(arena);
+    {
+        header_t *new_block_header = NULL;
+        drain_remote_frees(arena);
+
+        // Prefer resizing in place, otherwise move the contents to a new block
+        // in the same arena.
+        if (resize_block(arena, block_header, new_size)) {
+            new_block_header = block_header;
+        }
+        else if ((new_block_header = allocate_block(arena, new_size))) {
+            memcpy(new_block_header->block_memory, block_header->block_memory, block_header->block_size - canary_size());
+            if (block_header->sampled) {
+                profiler_forget(ptr);
+            }
+            deallocate_block(arena, block_header);
+        }
+
+        if (new_block_header || memory_manager.n_arenas == 1) {
+            new_ptr = finish_reallocation(ptr, new_block_header, new_size, sampled ? &stack : NULL);
+            done = true;
+        }
+    }
+    unlock_arena(arena);
+
+    if (done) {
+        return new_ptr;
+    }
+
+    // The block's arena is full, so move the block to another arena.
+    struct arena *new_arena;
+    header_t *new_block_header = allocate_from_arenas(0, new_size, &new_arena);
+    if (new_block_header) {
+        memcpy(new_block_header->block_memory, block_header->block_memory, block_header->block_size - canary_size());
+    }
+    new_ptr = finish_reallocation(ptr, new_block_header, new_size, sampled ? &stack : NULL);
+    if (!new_block_header) {
+        return NULL;
+    }
+    unlock_arena(new_arena);
+
+    lock_arena(arena);
+    {
+        if (block_header->sampled) {
+            profiler_forget(ptr);
+        }
+        deallocate_block(arena, block_header);
+    }
+    unlock_arena(arena);
+
+    return new_ptr;
+}
+
+size_t mmanager_usable_size(void *ptr) {
+    if (guard_owns(ptr)) {
+        return guard_slot_of(ptr)->size;
+    }
+    if (huge_candidate(ptr)) {
+        size_t size = huge_size(ptr);
+        if (size) {
+            return size;
+        }
+    }
+    header_t *block_header = (header_t *)((char *)ptr - HEADER_SIZE);
+    return block_header->block_size - canary_size();
+}
+
+void deallocate(void *ptr) {
+    assert(ptr != NULL);
+
+    if (guard_owns(ptr)) {
+        if (guard_validate_free(ptr, "deallocate")) {
+            guard_deallocate(ptr);
+        }
+        return;
+    }
+    if (huge_candidate(ptr) && huge_deallocate(ptr)) {
+        return;
+    }
+
+    if (!validate_free(ptr, "deallocate")) {
+        return;
+    }
+
+    header_t *dealloc_block_header = (header_t *)((char *)ptr - HEADER_SIZE);
+    struct arena *arena = &memory_manager.arenas[dealloc_block_header->arena];
+
+    // Leave blocks of other arenas to their owners rather than contending for
+    // their locks. The queue link needs room for a pointer in the block.
+    if (memory_manager.n_arenas > 1 && !(memory_manager.flags & MMANAGER_NO_LOCKING)
+        && arena != thread_arena() && dealloc_block_header->block_size >= sizeof(header_t *)) {
+        // Catch a second free of the block while it is queued. The check word
+        // stays until the owner drains it, which tells it apart from a free
+        // block that got lost.
+        dealloc_block_header->allocated = 0;
+        push_remote_free(arena, dealloc_block_header);
+        return;
+    }
+
+    lock_arena(arena);
+    {
+        if (tracer.active) {
+            trace_record(MMANAGER_TRACE_DEALLOCATE, ptr, dealloc_block_header->block_size);
+        }
+
+        if (dealloc_block_header->sampled) {
+            profiler_forget(ptr);
+        }
+
+        deallocate_block(arena, dealloc_block_header);
+    }
+    unlock_arena(arena);
+}
+
+size_t mmanager_compact(void **before_addresses, void **after_addresses) {
+    struct compaction compaction = { before_addresses, after_addresses, 0, 0, 0, 0, MMANAGER_TRACE_COMPACT };
+    start_relocations(&compaction);
+
+    lock_all_arenas();
+    {
+        // Moves are recorded after this marker so that a replay knows how to
+        // remap the pointers of relocated blocks.
+        if (tracer.active) {
+            trace_record(MMANAGER_TRACE_COMPACT, NULL, 0);
+        }
+
+        // Blocks never move between arenas, so each one is compacted on its own.
+        for (size_t i = 0; i < memory_manager.n_arenas; ++i) {
+            struct arena *arena = &memory_manager.arenas[i];
+
+            // Queued blocks must not be moved, so free them first.
+            settle_arena(arena);
+            compact_arena(arena, &compaction);
+        }
+    }
+    unlock_all_arenas();
+    finish_relocations(&compaction);
+
+    // Return size of the argument arrays.
+    return compaction.moved_blocks;
+}
+
+size_t mmanager_compact_incremental(size_t max_bytes, size_t max_blocks,
+    void **before_addresses, void **after_addresses) {
+    struct compaction compaction = {
+        before_addresses, after_addresses, max_bytes, max_blocks, 0, 0, MMANAGER_TRACE_COMPACT_STEP
+    };
+    start_relocations(&compaction);
+
+    // Only one arena is locked at a time, starting where the previous call ran
+    // out of budget.
+    size_t n_arenas = memory_manager.n_arenas;
+    size_t first = __atomic_load_n(&memory_manager.compact_cursor, __ATOMIC_RELAXED) % n_arenas;
+    for (size_t i = 0; i < n_arenas; ++i) {
+        struct arena *arena = &memory_manager.arenas[(first + i) % n_arenas];
+        bool compact;
+
+        lock_arena(arena);
+        {
+            settle_arena(arena);
+            compact = compact_arena(arena, &compaction);
+        }
+        unlock_arena(arena);
+
+        if (!compact) {
+            __atomic_store_n(&memory_manager.compact_cursor, arena->index, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    finish_relocations(&compaction);
+
+    return compaction.moved_blocks;
+}
+
+void *mmanager_relocate(void *ptr) {
+    void *new_ptr = ptr;
+
+    pthread_mutex_lock(&relocation_map.lock);
+    {
+        size_t low = 0;
+        size_t high = relocation_map.count;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            struct relocation *relocation = &relocation_map.entries[middle];
+            if (relocation->before == ptr) {
+                new_ptr = relocation->after;
+                break;
+            }
+            if ((char *)relocation->before < (char *)ptr) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+    }
+    pthread_mutex_unlock(&relocation_map.lock);
+
+    return new_ptr;
+}
+
+void mmanager_fixup(void **ptrs, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (ptrs[i]) {
+            ptrs[i] = mmanager_relocate(ptrs[i]);
+        }
+    }
+}
+
+size_t mmanager_check(void) {
+    size_t problems = 0;
+    for (size_t i = 0; i < memory_manager.n_arenas; ++i) {
+        struct arena *arena = &memory_manager.arenas[i];
+        lock_arena(arena);
+        {
+            settle_arena(arena);
+            problems += check_arena(arena);
+        }
+        unlock_arena(arena);
+    }
+    return problems;
+}
+
+void mmanager_maintain(void) {
+    for (size_t i = 0; i < memory_manager.n_arenas; ++i) {
+        struct arena *arena = &memory_manager.arenas[i];
+        lock_arena(arena);
+        {
+            maintain_arena(arena, 0);
+        }
+        unlock_arena(arena);
+    }
+}
+
+mm_handle_t allocate_handle(size_t size) {
+    assert(size > 0);
+    if (size > SIZE_MAX - HANDLE_PREFIX_SIZE) {
+        return MM_NULL_HANDLE;
+    }
+    size_t block_size = size + HANDLE_PREFIX_SIZE;
+
+    mm_handle_t handle = take_handle_slot();
+    if (handle == MM_NULL_HANDLE) {
+        return MM_NULL_HANDLE;
+    }
+    struct handle_entry *entry = &handles.entries[handle - 1];
+
+    struct profile_stack stack;
+    bool sampled = __atomic_load_n(&profiler.active, __ATOMIC_RELAXED) && profiler_should_sample(block_size, &stack);
+
+    struct arena *arena;
+    header_t *allocated_block_header = allocate_from_arenas(0, block_size, &arena);
+    if (allocated_block_header) {
+        *(mm_handle_t *)allocated_block_header->block_memory = handle;
+        allocated_block_header->handle = 1;
+        entry->block = allocated_block_header;
+        entry->pins = 0;
+        entry->arena = arena->index;
+        if (sampled) {
+            profiler_record(allocated_block_header, block_size, &stack);
+        }
+    }
+
+    if (tracer.active) {
+        trace_record(MMANAGER_TRACE_ALLOCATE, allocated_block_header ? allocated_block_header->block_memory : NULL,
+            block_size);
+    }
+    if (!allocated_block_header) {
+        release_handle_slot(handle);
+        return MM_NULL_HANDLE;
+    }
+    unlock_arena(arena);
+
+    return handle;
+}
+
+void deallocate_handle(mm_handle_t handle) {
+    assert(handle != MM_NULL_HANDLE);
+    struct handle_entry *entry = &handles.entries[handle - 1];
+    struct arena *arena = &memory_manager.arenas[entry->arena];
+
+    lock_arena(arena);
+    {
+        header_t *dealloc_block_header = entry->block;
+        assert(entry->pins == 0);
+
+        if (tracer.active) {
+            trace_record(MMANAGER_TRACE_DEALLOCATE, dealloc_block_header->block_memory,
+                dealloc_block_header->block_size);
+        }
+
+        if (dealloc_block_header->sampled) {
+            profiler_forget(dealloc_block_header->block_memory);
+        }
+
+        entry->block = NULL;
+        deallocate_block(arena, dealloc_block_header);
+    }
+    unlock_arena(arena);
+
+    release_handle_slot(handle);
+}
+
+void *mm_pin(mm_handle_t handle) {
+    assert(handle != MM_NULL_HANDLE);
+    struct handle_entry *entry = &handles.entries[handle - 1];
+    struct arena *arena = &memory_manager.arenas[entry->arena];
+    void *ptr;
+
+    // Compaction moves blocks under the arena lock, so the block cannot move
+    // between looking it up and marking it pinned.
+    lock_arena(arena);
+    {
+        ++entry->pins;
+        entry->block->pinned = 1;
+        ptr = entry->block->block_memory + HANDLE_PREFIX_SIZE;
+    }
+    unlock_arena(arena);
+
+    return ptr;
+}
+
+void mm_unpin(mm_handle_t handle) {
+    assert(handle != MM_NULL_HANDLE);
+    struct handle_entry *entry = &handles.entries[handle - 1];
+    struct arena *arena = &memory_manager.arenas[entry->arena];
+
+    lock_arena(arena);
+    {
+        assert(entry->pins > 0);
+        if (--entry->pins == 0) {
+            // Compaction may move the block again.
+            entry->block->pinned = 0;
+            forget_compact_resume(arena, entry->block);
+        }
+    }
+    unlock_arena(arena);
+}
+
+size_t mmanager_available_memory(void) {
+    size_t size = 0;
+
+    for (size_t i = 0; i < memory_manager.n_arenas; ++i) {
+        struct arena *arena = &memory_manager.arenas[i];
+        lock_arena(arena);
+        {
+            settle_arena(arena);
+            header_t *current_block = (header_t *)arena->free_list;
+            while (current_block) {
+                size += current_block->block_size;
+                current_block = current_block->next;
+            }
+        }
+        unlock_arena(arena);
+    }
+
+    return size;
+}
+
+void mmanager_get_stats(struct mmanager_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->arena_size = memory_manager.size;
+    stats->guarded_blocks = __atomic_load_n(&guard.allocated_slots, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&huge.lock);
+    {
+        stats->mapped_blocks = huge.count;
+        stats->mapped_bytes = huge.mapped_bytes;
+    }
+    pthread_mutex_unlock(&huge.lock);
+    stats->invalid_frees = __atomic_load_n(&memory_manager.invalid_frees, __ATOMIC_RELAXED);
+    stats->heap_corruptions = __atomic_load_n(&memory_manager.heap_corruptions, __ATOMIC_RELAXED);
+
+    for (size_t i = 0; i < memory_manager.n_arenas; ++i) {
+        struct arena *arena = &memory_manager.arenas[i];
+        lock_arena(arena);
+        {
+            settle_arena(arena);
+            stats->remote_frees += arena->remote_free_count;
+            stats->allocated_bytes += arena->allocated_bytes;
+            stats->allocated_blocks += arena->allocated_blocks;
+            stats->peak_allocated_bytes += arena->peak_allocated_bytes;
+            if (arena->heap_high_water > stats->heap_high_water) {
+                stats->heap_high_water = arena->heap_high_water;
+            }
+
+            header_t *current_block = arena->free_list;
+            while (current_block) {
+                stats->free_bytes += current_block->block_size;
+                ++stats->free_blocks;
+                if (current_block->block_size > stats->largest_free_block) {
+                    stats->largest_free_block = current_block->block_size;
+                }
+                current_block = current_block->next;
+            }
+        }
+        unlock_arena(arena);
+    }
+}
+
+int mmanager_trace_start(const char *path, size_t buffer_records) {
+    if (buffer_records == 0) {
+        buffer_records = DEFAULT_TRACE_BUFFER_RECORDS;
+    }
+
+    struct mmanager_trace_record *buffer = metadata_map(buffer_records * sizeof(*buffer));
+    if (!buffer) {
+        return -1;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        metadata_unmap(buffer, buffer_records * sizeof(*buffer));
+        return -1;
+    }
+
+    struct mmanager_trace_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MMANAGER_TRACE_MAGIC, sizeof(header.magic));
+    header.version = MMANAGER_TRACE_VERSION;
+    header.allocation_policy = (uint32_t)memory_manager.allocation_policy;
+    header.arena_size = memory_manager.size;
+    if (!write_all(fd, &header, sizeof(header))) {
+        close(fd);
+        metadata_unmap(buffer, buffer_records * sizeof(*buffer));
+        return -1;
+    }
+
+    // Stop any trace that is already running before installing the new one.
+    mmanager_trace_stop();
+
+    lock_all_arenas();
+    pthread_mutex_lock(&tracer.lock);
+    {
+        tracer.fd = fd;
+        tracer.buffer = buffer;
+        tracer.capacity = buffer_records;
+        tracer.count = 0;
+        tracer.active = true;
+    }
+    pthread_mutex_unlock(&tracer.lock);
+    unlock_all_arenas();
+
+    return 0;
+}
+
+void mmanager_trace_stop(void) {
+    int fd = -1;
+    struct mmanager_trace_record *buffer = NULL;
+    size_t capacity = 0;
+
+    lock_all_arenas();
+    pthread_mutex_lock(&tracer.lock);
+    {
+        if (tracer.active) {
+            trace_flush();
+            fd = tracer.fd;
+            buffer = tracer.buffer;
+            capacity = tracer.capacity;
+
+            tracer.active = false;
+            tracer.fd = -1;
+            tracer.buffer = NULL;
+            tracer.capacity = 0;
+        }
+    }
+    pthread_mutex_unlock(&tracer.lock);
+    unlock_all_arenas();
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    metadata_unmap(buffer, capacity * sizeof(*buffer));
+}
+
+
+/* * * * * * * * * * * * * * * * * * *
+ * Locking.
+ * * * * * * * * * * * * * * * * * * */
+
+static inline void lock_arena(struct arena *arena) {
+    if (!(memory_manager.flags & MMANAGER_NO_LOCKING)) {
+        pthread_mutex_lock(&arena->lock);
+    }
+}
+
+static inline void unlock_arena(struct arena *arena) {
+    if (!(memory_manager.flags & MMANAGER_NO_LOCKING)) {
+        pthread_mutex_unlock(&arena->lock);
+    }
+}
+
+static void lock_all_arenas(void) {
+    for (size_t i = 0; i < memory_manager.n_arenas; ++i) {
+        lock_arena(&memory_manager.arenas[i]);
+    }
+}
+
+static void unlock_all_arenas(void) {
+    for (size_t i = memory_manager.n_arenas; i > 0; --i) {
+        unlock_arena(&memory_manager.arenas[i - 1]);
+    }
+}
+
+static struct arena *thread_arena(void) {
+    size_t n_arenas = memory_manager.n_arenas;
+    if (n_arenas <= 1) {
+        return &memory_manager.arenas[0];
+    }
+
+    if (memory_manager.arena_assignment == MMANAGER_ARENA_CPU) {
+        int cpu = sched_getcpu();
+        return &memory_manager.arenas[cpu > 0 ? (size_t)cpu % n_arenas : 0];
+    }
+
+    if (arena_ticket == 0) {
+        arena_ticket = __atomic_add_fetch(&next_arena_ticket, 1, __ATOMIC_RELAXED);
+    }
+    return &memory_manager.arenas[(arena_ticket - 1) % n_arenas];
+}
+
+static struct arena *lock_any_arena(struct arena *home) {
+    size_t n_arenas = memory_manager.n_arenas;
+    if (n_arenas == 1 || (memory_manager.flags & MMANAGER_NO_LOCKING)) {
+        lock_arena(home);
+        return home;
+    }
+
+    if (pthread_mutex_trylock(&home->lock) == 0) {
+        return home;
+    }
+    for (size_t i = 1; i < n_arenas; ++i) {
+        struct arena *arena = &memory_manager.arenas[(home->index + i) % n_arenas];
+        if (pthread_mutex_trylock(&arena->lock) == 0) {
+            return arena;
+        }
+    }
+
+    pthread_mutex_lock(&home->lock);
+    return home;
+}
+
+static header_t *allocate_from_arenas(size_t alignment, size_t size, struct arena **arena_out) {
+    size_t n_arenas = memory_manager.n_arenas;
+    struct arena *first_arena = lock_any_arena(thread_arena());
+    struct arena *arena = first_arena;
+
+    for (size_t i = 1; ; ++i) {
+        drain_remote_frees(arena);
+        header_t *allocated_block_header = alignment
+            ? allocate_aligned_block(arena, alignment, size) : allocate_block(arena, size);
+        if (!allocated_block_header && arena->pending_free_count) {
+            // The deferred frees may hold a fit.
+            flush_pending_frees(arena);
+            allocated_block_header = alignment
+                ? allocate_aligned_block(arena, alignment, size) : allocate_block(arena, size);
+        }
+        if (allocated_block_header) {
+            *arena_out = arena;
+            return allocated_block_header;
+        }
+        unlock_arena(arena);
+
+        // This arena is full; try the next one.
+        if (i == n_arenas) {
+            return NULL;
+        }
+        arena = &memory_manager.arenas[(first_arena->index + i) % n_arenas];
+        lock_arena(arena);
+    }
+}
+
+static void push_remote_free(struct arena *arena, header_t *header_address) {
+    // Multiple producers, one consumer that always takes the whole list, so a
+    // plain Treiber stack push is safe from ABA.
+    header_t **link = (header_t **)header_address->block_memory;
+    header_t *head = __atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED);
+    do {
+        *link = head;
+    } while (!__atomic_compare_exchange_n(&arena->remote_frees, &head, header_address, true,
+        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_add_fetch(&arena->remote_free_count, 1, __ATOMIC_RELAXED);
+}
+
+static void drain_remote_frees(struct arena *arena) {
+    if (!__atomic_load_n(&arena->remote_frees, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    header_t *current_block = __atomic_exchange_n(&arena->remote_frees, NULL, __ATOMIC_ACQUIRE);
+    while (current_block) {
+        header_t *next_block = *(header_t **)current_block->block_memory;
+
+        if (tracer.active) {
+            trace_record(MMANAGER_TRACE_DEALLOCATE, current_block->block_memory, current_block->block_size);
+        }
+        if (current_block->sampled) {
+            profiler_forget(current_block->block_memory);
+        }
+        deallocate_block(arena, current_block);
+
+        current_block = next_block;
+    }
+}
+
+static void defer_free(struct arena *arena, header_t *header_address) {
+    header_t **list = header_address->block_size <= QUICK_LIST_MAX_SIZE
+        ? &arena->quick_lists[quick_list_index(header_address->block_size)] : &arena->pending_frees;
+    header_address->next = *list;
+    *list = header_address;
+
+    if (++arena->pending_free_count >= memory_manager.coalesce_threshold
+        && (memory_manager.flags & MMANAGER_DEFERRED_COALESCING)) {
+        flush_pending_frees(arena);
+    }
+}
+
+static size_t quick_list_index(size_t size) {
+    return size ? (size - 1) / QUICK_LIST_SPACING : 0;
+}
+
+static header_t *take_quick_block(struct arena *arena, size_t size) {
+    if (size > QUICK_LIST_MAX_SIZE) {
+        return NULL;
+    }
+
+    // Only the most recently freed block of the class is looked at, so this
+    // stays O(1).
+    header_t **list = &arena->quick_lists[quick_list_index(size)];
+    header_t *quick_block = *list;
+    if (!quick_block || quick_block->block_size < size) {
+        return NULL;
+    }
+    *list = quick_block->next;
+    --arena->pending_free_count;
+
+    return claim_block(arena, quick_block);
+}
+
+static void flush_pending_frees(struct arena *arena) {
+    if (!arena->pending_free_count) {
+        return;
+    }
+
+    // Gather the quick lists into the pending list.
+    header_t *pending = arena->pending_frees;
+    for (size_t i = 0; i < QUICK_LISTS; ++i) {
+        header_t *quick_block = arena->quick_lists[i];
+        while (quick_block) {
+            header_t *next_quick_block = quick_block->next;
+            quick_block->next = pending;
+            pending = quick_block;
+            quick_block = next_quick_block;
+        }
+        arena->quick_lists[i] = NULL;
+    }
+
+    // Sort the pending blocks by address (merge sort on the list), then merge
+    // them into the free list in one pass.
+    for (size_t run = 1; ; run *= 2) {
+        header_t *sorted = NULL;
+        header_t **sorted_tail = &sorted;
+        size_t merges = 0;
+        while (pending) {
+            header_t *left = pending;
+            header_t *right = left;
+            size_t left_size = 0;
+            while (right && left_size < run) {
+                right = right->next;
+                ++left_size;
+            }
+            size_t right_size = run;
+            while (left_size > 0 || (right_size > 0 && right)) {
+                header_t *taken;
+                if (left_size == 0 || (right_size > 0 && right && right < left)) {
+                    taken = right;
+                    right = right->next;
+                    --right_size;
+                }
+                else {
+                    taken = left;
+                    left = left->next;
+                    --left_size;
+                }
+                *sorted_tail = taken;
+                sorted_tail = &taken->next;
+            }
+            pending = right;
+            ++merges;
+        }
+        *sorted_tail = NULL;
+        pending = sorted;
+        if (merges <= 1) {
+            break;
+        }
+    }
+
+    header_t **link = &arena->free_list;
+    while (pending) {
+        while (*link && *link < pending) {
+            link = &(*link)->next;
+        }
+        header_t *next_pending = pending->next;
+        pending->next = *link;
+        *link = pending;
+        link = &pending->next;
+        pending = next_pending;
+    }
+    arena->pending_frees = NULL;
+    arena->pending_free_count = 0;
+
+    coalesce_free_blocks(arena);
+}
+
+static void settle_arena(struct arena *arena) {
+    drain_remote_frees(arena);
+    flush_pending_frees(arena);
+}
+
+static void trim_free_blocks(struct arena *arena) {
+    size_t unit = memory_manager.trim_unit;
+    for (header_t *current_block = arena->free_list; current_block; current_block = current_block->next) {
+        if (current_block->trimmed) {
+            continue;
+        }
+
+        // Keep the header and anything past the block mapped. With huge pages,
+        // only whole huge pages are released so that none is split.
+        uintptr_t start = ((uintptr_t)current_block->block_memory + unit - 1) & ~(unit - 1);
+        uintptr_t end = ((uintptr_t)current_block->block_memory + current_block->block_size) & ~(unit - 1);
+        if (end > start && madvise((void *)start, end - start, MADV_DONTNEED) != 0) {
+            // The memory is not known to be zero then.
+            continue;
+        }
+        current_block->trimmed = 1;
+    }
+}
+
+static void maintain_arena(struct arena *arena, size_t max_bytes) {
+    settle_arena(arena);
+
+    // The moves are traced, but without a marker: they depend on timing and
+    // are not replayed.
+    struct compaction compaction = { NULL, NULL, max_bytes, 0, 0, 0, MMANAGER_TRACE_COMPACT, NULL, true };
+    compact_arena(arena, &compaction);
+
+    trim_free_blocks(arena);
+}
+
+static void *maintenance_thread(void *arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&maintenance.lock);
+    while (!maintenance.stop) {
+        pthread_mutex_unlock(&maintenance.lock);
+
+        // Visit arenas in turn until the share of the interval given by the
+        // duty cycle is used up. Busy arenas are skipped rather than waited for.
+        uint64_t start = monotonic_ns();
+        uint64_t budget = maintenance.interval_ns * maintenance.duty_cycle / 100;
+        size_t n_arenas = memory_manager.flags & MMANAGER_BACKGROUND_MAINTENANCE ? memory_manager.n_arenas : 0;
+        for (size_t i = 0; i < n_arenas && monotonic_ns() - start < budget; ++i) {
+            struct arena *arena = &memory_manager.arenas[maintenance.next_arena];
+            maintenance.next_arena = (maintenance.next_arena + 1) % n_arenas;
+            if (pthread_mutex_trylock(&arena->lock) == 0) {
+                maintain_arena(arena, MAINTENANCE_COMPACT_BYTES);
+                pthread_mutex_unlock(&arena->lock);
+            }
+        }
+
+        // Heap checks run whole, and count against the duty cycle.
+        if (maintenance.check_interval_ns && monotonic_ns() >= maintenance.next_check_ns) {
+            mmanager_check();
+            maintenance.next_check_ns = monotonic_ns() + maintenance.check_interval_ns;
+        }
+
+        // Rest for the remainder of the interval, and long enough to keep the
+        // time spent working at the duty cycle if the run overshot its budget.
+        uint64_t worked = monotonic_ns() - start;
+        uint64_t rest = maintenance.interval_ns > worked ? maintenance.interval_ns - worked : 0;
+        uint64_t min_rest = worked * (100 - maintenance.duty_cycle) / maintenance.duty_cycle;
+        if (rest < min_rest) {
+            rest = min_rest;
+        }
+
+        struct timespec wake_up;
+        clock_gettime(CLOCK_MONOTONIC, &wake_up);
+        uint64_t wake_up_ns = (uint64_t)wake_up.tv_nsec + rest;
+        wake_up.tv_sec += wake_up_ns / 1000000000;
+        wake_up.tv_nsec = wake_up_ns % 1000000000;
+
+        pthread_mutex_lock(&maintenance.lock);
+        while (!maintenance.stop
+            && pthread_cond_timedwait(&maintenance.cond, &maintenance.lock, &wake_up) == 0) {
+        }
+    }
+    pthread_mutex_unlock(&maintenance.lock);
+
+    return NULL;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+
+/* * * * * * * * * * * * * * * * * * *
+ * Memory allocation policies.
+ * * * * * * * * * * * * * * * * * * */
+
+static header_t *first_fit_block_search(struct arena *arena, size_t block_size) {
+    header_t *current_block = (header_t *)arena->free_list;
+    while (current_block) {
+        if (current_block->block_size >= block_size) {
+            return current_block;
+        }
+        current_block = current_block->next;
+    }
+    return NULL;
+}
+
+static header_t *best_fit_block_search(struct arena *arena, size_t block_size) {
+    // To find the best fitting block, we take the difference between the size
+    // of `current_block` and `block_size`. Let this difference be `delta`. We
+    // then iterate through the free list to find the minimal delta.
+
+    header_t *best_fit_block = NULL;
+    header_t *current_block = (header_t *)arena->free_list;
+    size_t min_delta = SIZE_MAX;
+
+    while (current_block) {
+        // Check if `current_block` can fit `block_size`.
+        if (current_block->block_size >= block_size) {
+            size_t delta = current_block->block_size - block_size;
+            if (delta < min_delta) {
+                min_delta = delta;
+                best_fit_block = current_block;
+            }
+        }
+        current_block = current_block->next;
+    }
+
+    return best_fit_block;
+}
+
+static header_t *worst_fit_block_search(struct arena *arena, size_t block_size) {
+
+    // To find the worst fitting block, we take the difference between the size
+    // of `current_block` and `block_size`. Let this difference be `delta`. We
+    // then iterate through the free list to find the maximal delta.
+
+    header_t *worst_fit_block = NULL;
+    header_t *current_block = (header_t *)arena->free_list;
+    size_t max_delta = 0;
+
+    while (current_block) {
+        // Check if `current_block` can fit `block_size`.
+        if (current_block->block_size >= block_size) {
+            size_t delta = current_block->block_size - block_size;
+            if (delta > max_delta) {
+                max_delta = delta;
+                worst_fit_block = current_block;
+            }
+        }
+        current_block = current_block->next;
+    }
+
+    return worst_fit_block;
+}
+
+
+/* * * * * * * * * * * * * * * * * * *
+ * Block management.
+ * * * * * * * * * * * * * * * * * * */
+
+static header_t *allocate_block(struct arena *arena, size_t size) {
+    if (size > SIZE_MAX - canary_size()) {
+        return NULL;
+    }
+    size += canary_size();
+    header_t *free_block_header = take_quick_block(arena, size);
+    if (free_block_header) {
+        write_canary(free_block_header);
+        return free_block_header;
+    }
+
+    switch (memory_manager.allocation_policy) {
+        case FIRST_FIT:
+            free_block_header = first_fit_block_search(arena, size);
+            break;
+
+        case BEST_FIT:
+            free_block_header = best_fit_block_search(arena, size);
+            break;
+
+        case WORST_FIT:
+            free_block_header = worst_fit_block_search(arena, size);
+            break;
+
+        default:
+            fprintf(stderr, "ERROR: no allocation algorithm specified.\n");
+            raise(SIGABRT);
+    }
+
+    if (!free_block_header) {
+        return NULL;
+    }
+
+    header_t *allocated_block_header = take_free_block(arena, free_block_header, size);
+    write_canary(allocated_block_header);
+    return allocated_block_header;
+}
+
+static header_t *take_free_block(struct arena *arena, header_t *header_address, size_t size) {
+    // Rename `header_address` to `allocated_block_header` for clarity.
+    header_t *allocated_block_header = header_address;
+    // Remove it from free list.
+    remove_from_free_list(arena, allocated_block_header);
+
+    // Give any memory beyond `size` back to the free list.
+    split_block(arena, allocated_block_header, size);
+
+    return claim_block(arena, allocated_block_header);
+}
+
+static header_t *claim_block(struct arena *arena, header_t *header_address) {
+    // Rename `header_address` to `allocated_block_header` for clarity.
+    header_t *allocated_block_header = header_address;
+
+    forget_compact_resume(arena, allocated_block_header);
+    find_zero_memory(arena, allocated_block_header);
+    touch_block(arena, allocated_block_header);
+    allocated_block_header->sampled = 0;
+    allocated_block_header->handle = 0;
+    allocated_block_header->pinned = 0;
+    allocated_block_header->trimmed = 0;
+    allocated_block_header->arena = arena->index;
+    allocated_block_header->allocated = 1;
+    allocated_block_header->check = header_check(allocated_block_header);
+
+    // Update statistics.
+    arena->allocated_bytes += allocated_block_header->block_size;
+    ++arena->allocated_blocks;
+    if (arena->allocated_bytes > arena->peak_allocated_bytes) {
+        arena->peak_allocated_bytes = arena->allocated_bytes;
+    }
+    size_t block_end = (size_t)(allocated_block_header->block_memory + allocated_block_header->block_size
+        - (char *)memory_manager.memory);
+    if (block_end > arena->heap_high_water) {
+        arena->heap_high_water = block_end;
+    }
+
+    annotate_block_allocated(allocated_block_header);
+    return allocated_block_header;
+}
+
+static void find_zero_memory(struct arena *arena, const header_t *header_address) {
+    char *start = (char *)header_address->block_memory;
+    char *end = start + header_address->block_size;
+    arena->zero_start = arena->untouched < start ? start : arena->untouched < end ? arena->untouched : end;
+    arena->zero_end = end;
+
+    if (header_address->trimmed) {
+        // Only whole trim units were returned to the kernel.
+        size_t unit = memory_manager.trim_unit;
+        char *first_page = (char *)(((uintptr_t)start + unit - 1) & ~(unit - 1));
+        char *last_page = (char *)((uintptr_t)end & ~(unit - 1));
+        if (first_page >= last_page) {
+            return;
+        }
+        if (arena->zero_start <= last_page) {
+            if (first_page < arena->zero_start) {
+                arena->zero_start = first_page;
+            }
+        }
+        else {
+            arena->zero_start = first_page;
+            arena->zero_end = last_page;
+        }
+    }
+}
+
+static inline void forget_compact_resume(struct arena *arena, const header_t *header_address) {
+    if (header_address <= arena->compact_resume) {
+        arena->compact_resume = NULL;
+    }
+}
+
+static void touch_block(struct arena *arena, const header_t *header_address) {
+    touch_memory(arena, (char *)header_address->block_memory + header_address->block_size + HEADER_SIZE);
+}
+
+static inline void touch_memory(struct arena *arena, char *end) {
+    if (end > arena->untouched) {
+        arena->untouched = end;
+    }
+}
+
+static void poison_free_memory(struct arena *arena, void *memory, size_t size) {
+    if (memory_manager.flags & MMANAGER_POISON_FREE) {
+        annotate_internal_access(memory, size);
+        memset(memory, FREE_POISON, size);
+        annotate_internal_done(memory, size);
+        touch_memory(arena, (char *)memory + size);
+    }
+}
+
+static header_t *allocate_aligned_block(struct arena *arena, size_t alignment, size_t size) {
+    // Aligned requests always use first fit: the usable part of a block depends
+    // on its address, so the size-based policies do not apply directly.
+    if (size > SIZE_MAX - canary_size()) {
+        return NULL;
+    }
+    size += canary_size();
+    header_t *current_block = arena->free_list;
+    while (current_block) {
+        uintptr_t start = (uintptr_t)current_block->block_memory;
+        uintptr_t aligned = (start + alignment - 1) & ~(uintptr_t)(alignment - 1);
+
+        // A leading gap must be large enough to stay behind as a free block.
+        while (aligned != start && aligned - start <= HEADER_SIZE) {
+            aligned += alignment;
+        }
+
+        // Compared without adding, so that sizes near SIZE_MAX cannot wrap.
+        if (aligned - start <= current_block->block_size && size <= current_block->block_size - (aligned - start)) {
+            if (aligned == start) {
+                header_t *allocated_block_header = take_free_block(arena, current_block, size);
+                write_canary(allocated_block_header);
+                return allocated_block_header;
+            }
+
+            // Carve the aligned block out of the end of the free block.
+            header_t *aligned_block_header = (header_t *)(aligned - HEADER_SIZE);
+            annotate_header(aligned_block_header);
+            aligned_block_header->block_size = current_block->block_size - (aligned - start);
+            aligned_block_header->sampled = 0;
+            aligned_block_header->handle = 0;
+            aligned_block_header->pinned = 0;
+            aligned_block_header->trimmed = current_block->trimmed;
+            current_block->block_size = (char *)aligned_block_header - current_block->block_memory;
+
+            aligned_block_header->next = current_block->next;
+            current_block->next = aligned_block_header;
+            header_t *allocated_block_header = take_free_block(arena, aligned_block_header, size);
+            write_canary(allocated_block_header);
+            return allocated_block_header;
+        }
+        current_block = current_block->next;
+    }
+    return NULL;
+}
+
+static void split_block(struct arena *arena, header_t *header_address, size_t size) {
+    // Check if there is more memory in this block for future allocation.
+    if (header_address->block_size - size > HEADER_SIZE) {
+        // Create a new free block.
+        header_t *new_free_block_header = (header_t *)(header_address->block_memory + size);
+        annotate_header(new_free_block_header);
+        new_free_block_header->block_size = header_address->block_size - (HEADER_SIZE + size);
+        new_free_block_header->sampled = 0;
+        // The header is written before the first whole page of the remainder.
+        new_free_block_header->trimmed = header_address->trimmed;
+        new_free_block_header->allocated = 0;
+
+        // Add `new_free_block_header` to free list.
+        add_to_free_list(arena, new_free_block_header);
+
+        // Set the size of the remaining block.
+        header_address->block_size = size;
+    }
+}
+
+static bool resize_block(struct arena *arena, header_t *header_address, size_t new_size) {
+    forget_compact_resume(arena, header_address);
+    size_t old_size = header_address->block_size;
+    if (new_size > SIZE_MAX - canary_size()) {
+        return false;
+    }
+    new_size += canary_size();
+
+    if (new_size > old_size) {
+        // Growing requires the physically next block to be free and big enough.
+        header_t *next_block_header = (header_t *)(header_address->block_memory + header_address->block_size);
+        if ((char *)next_block_header >= (char *)arena->memory + arena->size
+            || old_size + HEADER_SIZE + next_block_header->block_size < new_size) {
+            return false;
+        }
+
+        header_t *current_block = arena->free_list;
+        while (current_block && current_block < next_block_header) {
+            current_block = current_block->next;
+        }
+        if (current_block != next_block_header) {
+            return false;
+        }
+
+        remove_from_free_list(arena, next_block_header);
+        header_address->block_size += HEADER_SIZE + next_block_header->block_size;
+    }
+
+    // Give back whatever is not needed. Only coalesce if a free block was created.
+    size_t size_before_split = header_address->block_size;
+    split_block(arena, header_address, new_size);
+    if (header_address->block_size != size_before_split) {
+        header_t *new_free_block_header = (header_t *)(header_address->block_memory + header_address->block_size);
+        annotate_internal_done(new_free_block_header->block_memory, new_free_block_header->block_size);
+        poison_free_memory(arena, new_free_block_header->block_memory, new_free_block_header->block_size);
+        coalesce_free_blocks(arena);
+    }
+    annotate_block_resized(header_address, old_size);
+    touch_block(arena, header_address);
+    write_canary(header_address);
+
+    header_address->check = header_check(header_address);
+    arena->allocated_bytes += header_address->block_size - old_size;
+    if (arena->allocated_bytes > arena->peak_allocated_bytes) {
+        arena->peak_allocated_bytes = arena->allocated_bytes;
+    }
+    size_t block_end = (size_t)(header_address->block_memory + header_address->block_size
+        - (char *)memory_manager.memory);
+    if (block_end > arena->heap_high_water) {
+        arena->heap_high_water = block_end;
+    }
+
+    return true;
+}
+
+static void *finish_reallocation(void *ptr, header_t *new_block_header, size_t new_size,
+    const struct profile_stack *stack) {
+    void *new_ptr = NULL;
+
+    if (new_block_header) {
+        new_ptr = (void *)new_block_header->block_memory;
+        // The resized block is accounted as a fresh allocation.
+        if (new_block_header->sampled) {
+            profiler_forget(new_ptr);
+        }
+        if (stack) {
+            profiler_record(new_block_header, new_size, stack);
+        }
+    }
+
+    if (tracer.active) {
+        trace_record(MMANAGER_TRACE_REALLOCATE, ptr, new_size);
+        trace_record(MMANAGER_TRACE_MOVE, ptr, new_ptr
+            ? (uint64_t)((char *)new_ptr - (char *)memory_manager.memory) : MMANAGER_TRACE_NULL_ID);
+    }
+
+    return new_ptr;
+}
+
+static bool compact_arena(struct arena *arena, struct compaction *compaction) {
+    // Allocated blocks are slid down, in address order, to `destination`, the
+    // end of the compacted part of the arena. Each gap left below a block that
+    // stays where it is (because it is pinned or the budget ran out) and the
+    // space after the last block become the new free list.
+    // Any block of the arena may move, or only handle blocks if
+    // `compaction->handles_only`. A compaction that runs out of budget records
+    // where it stopped, and the next one continues from there.
+    if (!compaction->handles_only && !compaction->before_addresses
+        && !reserve_relocations(compaction, arena->allocated_blocks)) {
+        return false;
+    }
+
+    char *destination = arena->memory;
+    char *position = arena->memory;
+    if (arena->compact_resume && (compaction->handles_only || !arena->compact_resume_handles_only)) {
+        destination = arena->compact_destination;
+        position = (char *)arena->compact_resume;
+    }
+    arena->compact_resume = NULL;
+    char *arena_end = (char *)arena->memory + arena->size;
+    bool compact = true;
+    // Until a block moves, each gap is an old free block and keeps its state.
+    bool moved = false;
+
+    // The free blocks below `destination` stay; the rest of the free list is
+    // rebuilt from the gaps.
+    header_t **free_link = &arena->free_list;
+    while (*free_link && (char *)*free_link < destination) {
+        free_link = &(*free_link)->next;
+    }
+
+    // The old free blocks above the current block, kept in case the budget
+    // runs out before they are passed. The physical walk meets the free blocks
+    // in free list order, so a block is free exactly when it is the next one.
+    header_t *old_free_block = *free_link;
+    while (old_free_block && (char *)old_free_block < position) {
+        old_free_block = old_free_block->next;
+    }
+
+    // Everything written lies below `position`, so the blocks ahead are intact.
+    header_t *current_alloc_block = NULL;
+    while (position < arena_end) {
+        current_alloc_block = (header_t *)position;
+        char *block_end = current_alloc_block->block_memory + current_alloc_block->block_size;
+        position = block_end;
+        if (current_alloc_block == old_free_block) {
+            old_free_block = current_alloc_block->next;
+            continue;
+        }
+
+        // A block freed by another thread since the arena was settled is
+        // neither allocated nor in the free list yet. It stays where it is
+        // and keeps its queue link.
+        bool movable = current_alloc_block->allocated && !current_alloc_block->pinned
+            && (current_alloc_block->handle || !compaction->handles_only);
+        if ((char *)current_alloc_block != destination && movable) {
+            // Stop when the budget is spent, but always move at least one block
+            // per pass so that a block larger than the byte budget cannot stall it.
+            if ((compaction->max_blocks && compaction->moved_blocks == compaction->max_blocks)
+                || (compaction->max_bytes && compaction->moved_blocks > 0
+                    && compaction->moved_bytes + current_alloc_block->block_size > compaction->max_bytes)) {
+                compact = false;
+                break;
+            }
+
+            // An incremental pass is only recorded once it moves something. Its
+            // `id` carries the block budget.
+            if (tracer.active && compaction->trace_op == MMANAGER_TRACE_COMPACT_STEP
+                && compaction->moved_blocks == 0) {
+                trace_record(MMANAGER_TRACE_COMPACT_STEP, (char *)memory_manager.memory + compaction->max_blocks,
+                    compaction->max_bytes);
+            }
+
+            // The block may overlap its new location.
+            void *before = current_alloc_block->block_memory;
+            header_t *moved_block = (header_t *)destination;
+            size_t span = block_end - destination;
+            annotate_internal_access(destination, span);
+            memmove(moved_block, current_alloc_block, HEADER_SIZE + current_alloc_block->block_size);
+            annotate_internal_done(destination, span);
+            annotate_header(moved_block);
+            annotate_block_moved(before, moved_block);
+            void *after = moved_block->block_memory;
+            block_end = moved_block->block_memory + moved_block->block_size;
+            moved_block->check = header_check(moved_block);
+
+            // Handles of moved blocks follow them.
+            if (moved_block->handle) {
+                handles.entries[*(mm_handle_t *)after - 1].block = moved_block;
+            }
+
+            // Set before- and after-compaction addresses. Handle blocks are
+            // reported with the addresses `mm_pin()` returns.
+            size_t offset = moved_block->handle ? HANDLE_PREFIX_SIZE : 0;
+            if (compaction->handles_only) {
+                // Nobody holds the addresses of unpinned handle blocks.
+            }
+            else if (!compaction->before_addresses) {
+                compaction->relocations[compaction->moved_blocks].before = (char *)before + offset;
+                compaction->relocations[compaction->moved_blocks].after = (char *)after + offset;
+            }
+            else {
+                compaction->before_addresses[compaction->moved_blocks] = (char *)before + offset;
+                compaction->after_addresses[compaction->moved_blocks] = (char *)after + offset;
+            }
+            ++compaction->moved_blocks;
+            compaction->moved_bytes += moved_block->block_size;
+
+            if (moved_block->sampled) {
+                profiler_move(before, after);
+            }
+
+            if (tracer.active) {
+                trace_record(MMANAGER_TRACE_MOVE, before,
+                    (uint64_t)((char *)after - (char *)memory_manager.memory));
+            }
+
+            moved = true;
+        }
+        else if ((char *)current_alloc_block != destination) {
+            // A pinned block stays, and the gap below it becomes a free block.
+            header_t *gap = (header_t *)destination;
+            annotate_header(gap);
+            gap->block_size = (char *)current_alloc_block - gap->block_memory;
+            gap->trimmed &= !moved;
+            gap->allocated = 0;
+            if (moved) {
+                poison_free_memory(arena, gap->block_memory, gap->block_size);
+            }
+            *free_link = gap;
+            free_link = &gap->next;
+        }
+
+        destination = block_end;
+    }
+
+    if (!compact) {
+        // Out of budget: the rest of the arena is left as it was.
+        arena->compact_resume = current_alloc_block;
+        arena->compact_destination = destination;
+        arena->compact_resume_handles_only = compaction->handles_only;
+        if ((char *)current_alloc_block != destination) {
+            header_t *gap = (header_t *)destination;
+            annotate_header(gap);
+            gap->block_size = (char *)current_alloc_block - gap->block_memory;
+            gap->trimmed &= !moved;
+            gap->allocated = 0;
+            if (moved) {
+                poison_free_memory(arena, gap->block_memory, gap->block_size);
+            }
+            *free_link = gap;
+            free_link = &gap->next;
+        }
+        *free_link = old_free_block;
+    }
+    else {
+        if (destination != arena_end) {
+            header_t *tail = (header_t *)destination;
+            annotate_header(tail);
+            tail->block_size = arena_end - tail->block_memory;
+            tail->trimmed &= !moved;
+            tail->allocated = 0;
+            if (moved) {
+                poison_free_memory(arena, tail->block_memory, tail->block_size);
+            }
+            *free_link = tail;
+            free_link = &tail->next;
+        }
+        *free_link = NULL;
+    }
+
+    return compact;
+}
+
+static void deallocate_block(struct arena *arena, header_t *header_address) {
+    forget_compact_resume(arena, header_address);
+    arena->allocated_bytes -= header_address->block_size;
+    --arena->allocated_blocks;
+    header_address->allocated = 0;
+    header_address->check = 0;
+    annotate_block_freed(header_address);
+    poison_free_memory(arena, header_address->block_memory, header_address->block_size);
+
+    // It is merged into the free list later.
+    if (memory_manager.flags & (MMANAGER_BACKGROUND_MAINTENANCE | MMANAGER_DEFERRED_COALESCING)) {
+        defer_free(arena, header_address);
+        return;
+    }
+
+    // Add the block back to free list.
+    add_to_free_list(arena, header_address);
+
+    // Merge any contiguous free blocks.
+    coalesce_free_blocks(arena);
+}
+
+
+/* * * * * * * * * * * * * * * * * * *
+ * Relocation map.
+ * * * * * * * * * * * * * * * * * * */
+
+static void start_relocations(struct compaction *compaction) {
+    if (compaction->before_addresses) {
+        return;
+    }
+
+    pthread_mutex_lock(&relocation_map.lock);
+    relocation_map.count = 0;
+    compaction->relocations = relocation_map.entries;
+}
+
+static void finish_relocations(struct compaction *compaction) {
+    if (compaction->before_addresses) {
+        return;
+    }
+
+    // Arenas are compacted in address order, except that an incremental pass
+    // may wrap around to the first arena.
+    relocation_map.count = compaction->moved_blocks;
+    for (size_t i = 1; i < relocation_map.count; ++i) {
+        if (relocation_map.entries[i - 1].before > relocation_map.entries[i].before) {
+            qsort(relocation_map.entries, relocation_map.count, sizeof(*relocation_map.entries),
+                compare_relocations);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&relocation_map.lock);
+}
+
+static bool reserve_relocations(struct compaction *compaction, size_t n) {
+    size_t needed = compaction->moved_blocks + n;
+    if (needed <= relocation_map.capacity) {
+        return true;
+    }
+
+    size_t capacity = relocation_map.capacity ? relocation_map.capacity : 1024;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    struct relocation *entries = metadata_map(capacity * sizeof(*entries));
+    if (!entries) {
+        return false;
+    }
+
+    if (compaction->moved_blocks > 0) {
+        memcpy(entries, relocation_map.entries, compaction->moved_blocks * sizeof(*entries));
+    }
+    metadata_unmap(relocation_map.entries, relocation_map.capacity * sizeof(*relocation_map.entries));
+    relocation_map.entries = entries;
+    relocation_map.capacity = capacity;
+    compaction->relocations = entries;
+    return true;
+}
+
+static int compare_relocations(const void *a, const void *b) {
+    const char *before_a = ((const struct relocation *)a)->before;
+    const char *before_b = ((const struct relocation *)b)->before;
+    return (before_a > before_b) - (before_a < before_b);
+}
+
+
+/* * * * * * * * * * * * * * * * * * *
+ * Handles.
+ * * * * * * * * * * * * * * * * * * */
+
+static mm_handle_t take_handle_slot(void) {
+    mm_handle_t handle = MM_NULL_HANDLE;
+
+    pthread_mutex_lock(&handles.lock);
+    {
+        // Every handle block takes at least a header and the handle prefix.
+        if (!handles.entries) {
+            size_t capacity = memory_manager.size / (HEADER_SIZE + HANDLE_PREFIX_SIZE);
+            handles.entries = metadata_map(capacity * sizeof(*handles.entries));
+            handles.capacity = handles.entries ? capacity : 0;
+        }
+
+        if (handles.free_slot != MM_NULL_HANDLE) {
+            handle = handles.free_slot;
+            handles.free_slot = handles.entries[handle - 1].next_free;
+        }
+        else if (handles.used < handles.capacity) {
+            handle = ++handles.used;
+        }
+    }
+    pthread_mutex_unlock(&handles.lock);
+
+    return handle;
+}
+
+static void release_handle_slot(mm_handle_t handle) {
+    pthread_mutex_lock(&handles.lock);
+    {
+        handles.entries[handle - 1].next_free = handles.free_slot;
+        handles.free_slot = handle;
+    }
+    pthread_mutex_unlock(&handles.lock);
+}
+
+
+/* * * * * * * * * * * * * * * * * * *
+ * Free validation.
+ * * * * * * * * * * * * * * * * * * */
+
+static inline uint64_t header_check(const header_t *header_address) {
+    // Finalizer of SplitMix64 over the key and the header fields, so that a
+    // header copied from another block or with a few bits flipped fails.
+    uint64_t x = memory_manager.header_key ^ (uint64_t)(uintptr_t)header_address;
+    x += ((uint64_t)header_address->block_size << ARENA_INDEX_BITS | header_address->arena) * 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+static uint64_t new_header_key(void) {
+    uint64_t key = 0;
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        if (read(fd, &key, sizeof(key)) != sizeof(key)) {
+            key = 0;
+        }
+        close(fd);
+    }
+    // Fall back to values that still differ between processes and heaps.
+    if (key == 0) {
+        key = monotonic_ns() ^ ((uint64_t)getpid() << 32) ^ (uint64_t)(uintptr_t)memory_manager.memory;
+    }
+    return key;
+}
+
+static bool validate_free(void *ptr, const char *caller) {
+    // The header must lie in the heap, name an existing arena and carry the
+    // checksum of an allocated block.
+    header_t *header_address = (header_t *)((char *)ptr - HEADER_SIZE);
+    if ((uintptr_t)header_address - (uintptr_t)memory_manager.memory >= memory_manager.size
+        || header_address->arena >= memory_manager.n_arenas
+        || header_address->check != header_check(header_address)) {
+        report_invalid_free(ptr, caller, "invalid free");
+        return false;
+    }
+    if (!header_address->allocated) {
+        report_invalid_free(ptr, caller, "double free");
+        return false;
+    }
+
+    // The block can still be freed after an overflow into its canary.
+    if (!canary_intact(header_address)) {
+        report_corruption(ptr, caller, "write past the end of the block");
+    }
+    return true;
+}
+
+static void report_invalid_free(void *ptr, const char *caller, const char *problem) {
+    __atomic_add_fetch(&memory_manager.invalid_frees, 1, __ATOMIC_RELAXED);
+    report_heap_error(problem, ptr, caller, NULL);
+}
+
+static void report_corruption(void *ptr, const char *caller, const char *problem) {
+    __atomic_add_fetch(&memory_manager.heap_corruptions, 1, __ATOMIC_RELAXED);
+    report_heap_error("heap corruption", ptr, caller, problem);
+}
+
+static void report_heap_error(const char *kind, void *ptr, const char *caller, const char *problem) {
+    if (memory_manager.invalid_free_action == MMANAGER_INVALID_FREE_IGNORE) {
+        return;
+    }
+
+    fprintf(stderr, "mmanager: %s of %p in %s()%s%s\n", kind, ptr, caller,
+        problem ? ": " : "", problem ? problem : "");
+    if (memory_manager.invalid_free_action == MMANAGER_INVALID_FREE_ABORT) {
+        abort();
+    }
+}
+
+
+/* * * * * * * * * * * * * * * * * * *
+ * Heap checking.
+ * * * * * * * * * * * * * * * * * * */
+
+static inline size_t canary_size(void) {
+    return memory_manager.flags & MMANAGER_CANARIES ? CANARY_SIZE : 0;
+}
+
+static void write_canary(header_t *header_address) {
+    if (memory_manager.flags & MMANAGER_CANARIES) {
+        uint64_t canary[2] = { CANARY_PATTERN, CANARY_PATTERN };
+        char *canary_address = header_address->block_memory + header_address->block_size - CANARY_SIZE;
+        annotate_internal_access(canary_address, CANARY_SIZE);
+        memcpy(canary_address, canary, CANARY_SIZE);
+        annotate_internal_done(canary_address, CANARY_SIZE);
+    }
+}
+
+static bool canary_intact(const header_t *header_address) {
+    if (!(memory_manager.flags & MMANAGER_CANARIES)) {
+        return true;
+    }
+    if (header_address->block_size < CANARY_SIZE) {
+        return false;
+    }
+
+    uint64_t canary[2] = { CANARY_PATTERN, CANARY_PATTERN };
+    char *canary_address = (char *)header_address->block_memory + header_address->block_size - CANARY_SIZE;
+    annotate_internal_access(canary_address, CANARY_SIZE);
+    bool intact = memcmp(canary_address, canary, CANARY_SIZE) == 0;
+    annotate_internal_done(canary_address, CANARY_SIZE);
+    return intact;
+}
+
+static bool poison_intact(const char *memory, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (memory[i] != (char)FREE_POISON && memory[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static size_t check_arena(struct arena *arena) {
+    size_t problems = 0;
+    char *arena_end = (char *)arena->memory + arena->size;
+    header_t *free_cursor = arena->free_list;
+    size_t allocated_blocks = 0;
+    bool previous_free = false;
+    bool remote_frees_possible = memory_manager.n_arenas > 1 && !(memory_manager.flags & MMANAGER_NO_LOCKING);
+
+    // The free list is address-ordered, so each block of the physical walk must
+    // be its next entry or allocated.
+    char *position = arena->memory;
+    while (position < arena_end) {
+        header_t *current_block = (header_t *)position;
+        if (position + HEADER_SIZE > arena_end
+            || current_block->block_size > (size_t)(arena_end - current_block->block_memory)) {
+            report_corruption(current_block->block_memory, "mmanager_check", "block runs past the end of the arena");
+            ++problems;
+            break;
+        }
+
+        if (current_block == free_cursor) {
+            if (current_block->allocated) {
+                report_corruption(current_block->block_memory, "mmanager_check", "free block is marked allocated");
+                ++problems;
+            }
+            else if (previous_free) {
+                report_corruption(current_block->block_memory, "mmanager_check", "free blocks were not merged");
+                ++problems;
+            }
+            else if (memory_manager.flags & MMANAGER_POISON_FREE) {
+                annotate_internal_access(current_block->block_memory, current_block->block_size);
+                if (!poison_intact(current_block->block_memory, current_block->block_size)) {
+                    report_corruption(current_block->block_memory, "mmanager_check", "free block was written to");
+                    ++problems;
+                }
+                annotate_internal_done(current_block->block_memory, current_block->block_size);
+            }
+            free_cursor = free_cursor->next;
+            previous_free = true;
+        }
+        else if (current_block->allocated) {
+            if (current_block->arena != arena->index
+                || current_block->check != header_check(current_block)) {
+                report_corruption(current_block->block_memory, "mmanager_check", "damaged block header");
+                ++problems;
+            }
+            else if (!canary_intact(current_block)) {
+                report_corruption(current_block->block_memory, "mmanager_check", "write past the end of the block");
+                ++problems;
+            }
+            ++allocated_blocks;
+            previous_free = false;
+        }
+        else if (remote_frees_possible && current_block->arena == arena->index
+                 && current_block->check == header_check(current_block)) {
+            // Freed by another thread and waiting in the remote-free queue. The
+            // arena counts it as allocated until the queue is drained.
+            ++allocated_blocks;
+            previous_free = false;
+        }
+        else {
+            report_corruption(current_block->block_memory, "mmanager_check", "free block is not in the free list");
+            ++problems;
+            previous_free = false;
+        }
+
+        position = current_block->block_memory + current_block->block_size;
+    }
+
+    if (position == arena_end && free_cursor) {
+        report_corruption(free_cursor, "mmanager_check", "free list links a block that is not in the arena");
+        ++problems;
+    }
+    if (position == arena_end && allocated_blocks != arena->allocated_blocks) {
+        report_corruption(arena->memory, "mmanager_check", "allocated block count does not match");
+        ++problems;
+    }
+
+    return problems;
+}
+
+
+/* * * * * * * * * * * * * * * * * * *
+ * Guarded allocations.
+ * * * * * * * * * * * * * * * * * * */
+
+static bool guard_initialize(size_t sample_rate, size_t n_slots) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = (2 * n_slots + 1) * page_size;
+    char *memory = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    struct guard_slot *slots = metadata_map(n_slots * sizeof(*slots));
+    if (memory == MAP_FAILED || !slots) {
+        if (memory != MAP_FAILED) {
+            munmap(memory, size);
+        }
+        metadata_unmap(slots, n_slots * sizeof(*slots));
+        return false;
+    }
+
+    guard.memory = memory;
+    guard.size = size;
+    guard.page_size = page_size;
+    guard.slots = slots;
+    guard.n_slots = n_slots;
+    guard.next_slot = 0;
+    guard.allocated_slots = 0;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = guard_fault_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &guard.previous_action);
+
+    __atomic_store_n(&guard.sample_rate, sample_rate, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void guard_destroy(void) {
+    if (!guard.sample_rate) {
+        return;
+    }
+
+    guard.sample_rate = 0;
+    sigaction(SIGSEGV, &guard.previous_action, NULL);
+    munmap(guard.memory, guard.size);
+    metadata_unmap(guard.slots, guard.n_slots * sizeof(*guard.slots));
+    guard.memory = NULL;
+    guard.size = 0;
+    guard.slots = NULL;
+    guard.n_slots = 0;
+    guard.allocated_slots = 0;
+}
+
+static inline bool guard_should_sample(void) {
+    if (allocations_until_guard > 0) {
+        --allocations_until_guard;
+        return false;
+    }
+    allocations_until_guard = guard.sample_rate - 1;
+    return true;
+}
+
+static inline bool guard_owns(const void *ptr) {
+    return (uintptr_t)ptr - (uintptr_t)guard.memory < guard.size;
+}
+
+static void *guard_allocate(size_t alignment, size_t size) {
+    // The block ends exactly at the guard page above it, up to the 16 bytes (or
+    // `alignment`) that keep it aligned.
+    if (alignment < 16) {
+        alignment = 16;
+    }
+    if (size > guard.page_size || alignment > guard.page_size) {
+        return NULL;
+    }
+    // A zero-byte block still takes one alignment unit, so that it does not
+    // start at the guard page.
+    size_t rounded_size = size ? (size + alignment - 1) & ~(alignment - 1) : alignment;
+
+    void *ptr = NULL;
+    pthread_mutex_lock(&guard.lock);
+    {
+        // Take the free slot after the last one handed out, so that freed
+        // slots stay inaccessible for as long as possible.
+        for (size_t i = 0; i < guard.n_slots && !ptr; ++i) {
+            size_t index = (guard.next_slot + i) % guard.n_slots;
+            struct guard_slot *slot = &guard.slots[index];
+            if (slot->allocated) {
+                continue;
+            }
+
+            char *page = guard.memory + (2 * index + 1) * guard.page_size;
+            if (mprotect(page, guard.page_size, PROT_READ | PROT_WRITE) != 0) {
+                break;
+            }
+            ptr = page + guard.page_size - rounded_size;
+            slot->ptr = ptr;
+            slot->size = rounded_size;
+            slot->allocated = true;
+            guard.next_slot = index + 1;
+            __atomic_add_fetch(&guard.allocated_slots, 1, __ATOMIC_RELAXED);
+        }
+
+        if (ptr && tracer.active) {
+            trace_record(MMANAGER_TRACE_ALLOCATE, ptr, size);
+        }
+    }
+    pthread_mutex_unlock(&guard.lock);
+
+    return ptr;
+}
+
+static void guard_deallocate(void *ptr) {
+    pthread_mutex_lock(&guard.lock);
+    {
+        struct guard_slot *slot = guard_slot_of(ptr);
+        if (tracer.active) {
+            trace_record(MMANAGER_TRACE_DEALLOCATE, ptr, slot->size);
+        }
+
+        // Later accesses through dangling pointers fault.
+        char *page = (char *)((uintptr_t)ptr & ~(guard.page_size - 1));
+        mprotect(page, guard.page_size, PROT_NONE);
+        slot->allocated = false;
+        __atomic_sub_fetch(&guard.allocated_slots, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&guard.lock);
+}
+
+static bool guard_validate_free(void *ptr, const char *caller) {
+    const char *problem = NULL;
+    pthread_mutex_lock(&guard.lock);
+    {
+        struct guard_slot *slot = guard_slot_of(ptr);
+        if (!slot || slot->ptr != ptr) {
+            problem = "invalid free";
+        }
+        else if (!slot->allocated) {
+            problem = "double free";
+        }
+    }
+    pthread_mutex_unlock(&guard.lock);
+
+    if (problem) {
+        report_invalid_free(ptr, caller, problem);
+        return false;
+    }
+    return true;
+}
+
+static struct guard_slot *guard_slot_of(const void *ptr) {
+    size_t page_index = ((const char *)ptr - guard.memory) / guard.page_size;
+    return page_index % 2 ? &guard.slots[page_index / 2] : NULL;
+}
+
+static void guard_fault_handler(int signal, siginfo_t *info, void *context) {
+    if (guard_owns(info->si_addr)) {
+        char message[160];
+        size_t length = append_text(message, sizeof(message), 0, "mmanager: ");
+        struct guard_slot *slot = guard_slot_of(info->si_addr);
+        if (slot) {
+            length = append_text(message, sizeof(message), length, "use after free at ");
+            length = append_hex(message, sizeof(message), length, (uintptr_t)info->si_addr);
+            length = append_text(message, sizeof(message), length, " of ");
+        }
+        else {
+            // Blocks end at the guard page above them, so this is an overflow
+            // of the block below.
+            size_t page_index = ((char *)info->si_addr - guard.memory) / guard.page_size;
+            slot = page_index > 0 ? &guard.slots[page_index / 2 - 1] : NULL;
+            length = append_text(message, sizeof(message), length, "buffer overflow at ");
+            length = append_hex(message, sizeof(message), length, (uintptr_t)info->si_addr);
+            length = append_text(message, sizeof(message), length, " past ");
+        }
+        length = append_decimal(message, sizeof(message), length, slot ? slot->size : 0);
+        length = append_text(message, sizeof(message), length, "-byte block ");
+        length = append_hex(message, sizeof(message), length, slot ? (uintptr_t)slot->ptr : 0);
+        length = append_text(message, sizeof(message), length, "\n");
+        write_all(STDERR_FILENO, message, length);
+    }
+
+    guard_chain_fault(signal, info, context);
+}
+
+static void guard_chain_fault(int signal, siginfo_t *info, void *context) {
+    const struct sigaction *previous = &guard.previous_action;
+    if (previous->sa_flags & SA_SIGINFO) {
+        previous->sa_sigaction(signal, info, context);
+    }
+    else if (previous->sa_handler == SIG_DFL) {
+        // Returning retries the faulting access, which now terminates.
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = SIG_DFL;
+        sigemptyset(&action.sa_mask);
+        sigaction(signal, &action, NULL);
+    }
+    else if (previous->sa_handler != SIG_IGN) {
+        previous->sa_handler(signal);
+    }
+}
+
+static size_t append_text(char *message, size_t size, size_t length, const char *text) {
+    while (*text && length + 1 < size) {
+        message[length++] = *text++;
+    }
+    message[length] = '\0';
+    return length;
+}
 
-// Adds the block specified by `header_address` to the allocator's alloc list.
-static void add_to_alloc_list(header_t *header_address);
+static size_t append_hex(char *message, size_t size, size_t length, uintptr_t value) {
+    char digits[2 * sizeof(value) + 3];
+    size_t n = sizeof(digits) - 1;
+    digits[n] = '\0';
+    do {
+        digits[--n] = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    } while (value);
+    digits[--n] = 'x';
+    digits[--n] = '0';
+    return append_text(message, size, length, digits + n);
+}
 
-// Removes the block specified by `header_address` from the allocator's alloc list.
-// Assumes `header_address` is in the alloc list.
-static void remove_from_alloc_list(header_t *header_address);
+static size_t append_decimal(char *message, size_t size, size_t length, size_t value) {
+    char digits[3 * sizeof(value) + 1];
+    size_t n = sizeof(digits) - 1;
+    digits[n] = '\0';
+    do {
+        digits[--n] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    return append_text(message, size, length, digits + n);
+}
 
-// Eliminates contiguous free blocks in the free list.
-static void coalesce_free_blocks(void);
 
+/* * * * * * * * * * * * * * * * * * *
+ * Mapped blocks.
+ * * * * * * * * * * * * * * * * * * */
 
-void mmanager_initialize(size_t size, enum AllocationPolicy allocation_policy) {
-    // Obtain 'size' bytes for the allocator and set allocation algorithm.
-    memory_manager.memory = malloc(size);
-    if (!memory_manager.memory) {
-        fprintf(stderr, "ERROR: failed to obtain %lu memory for the allocator.\n", size);
-        raise(SIGABRT);
+static void huge_initialize(size_t threshold) {
+    struct huge_block *blocks = metadata_map(HUGE_INITIAL_BLOCKS * sizeof(*blocks));
+    if (!blocks) {
+        return;
     }
-    memory_manager.size = size;
-    memory_manager.allocation_policy = allocation_policy;
-
-    // Set initial free block properties.
-    memory_manager.free_list = (header_t *)memory_manager.memory;
-    memory_manager.free_list->block_size = memory_manager.size - HEADER_SIZE;
-    memory_manager.free_list->next = NULL;
 
-    // Set alloc list to empty.
-    memory_manager.alloc_list = NULL;
+    huge.page_size = (size_t)sysconf(_SC_PAGESIZE);
+    huge.blocks = blocks;
+    huge.capacity = HUGE_INITIAL_BLOCKS;
+    huge.count = 0;
+    huge.mapped_bytes = 0;
+    huge.threshold = threshold;
+}
 
-    // Set user memory to 0.
-    void *user_memory = (char *)memory_manager.memory + HEADER_SIZE;
-    memset(user_memory, 0, memory_manager.size - HEADER_SIZE);
+static void huge_destroy(void) {
+    if (!huge.threshold) {
+        return;
+    }
 
-    // Initialize mutex.
-    pthread_mutex_init(&lock, NULL);
+    for (size_t i = 0; i < huge.capacity; ++i) {
+        if (huge.blocks[i].ptr) {
+            munmap(huge.blocks[i].ptr, huge.blocks[i].size);
+        }
+    }
+    metadata_unmap(huge.blocks, huge.capacity * sizeof(*huge.blocks));
+    huge.threshold = 0;
+    huge.blocks = NULL;
+    huge.capacity = 0;
+    huge.count = 0;
+    huge.mapped_bytes = 0;
 }
 
-void mmanager_destroy(void) {
-    free(memory_manager.memory);
-    pthread_mutex_destroy(&lock);
+static inline bool huge_candidate(const void *ptr) {
+    return huge.threshold && (uintptr_t)ptr - (uintptr_t)memory_manager.memory >= memory_manager.size;
 }
 
-void *allocate(size_t size) {
-    assert(size > 0);
-    void* ptr = NULL;
-    header_t *free_block_header = NULL;
+static void *huge_allocate(size_t alignment, size_t size) {
+    // Mappings are page-aligned.
+    if (alignment > huge.page_size || size > SIZE_MAX - huge.page_size) {
+        return NULL;
+    }
+    size_t mapped_size = (size + huge.page_size - 1) & ~(huge.page_size - 1);
 
-    pthread_mutex_lock(&lock);
+    void *ptr = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return NULL;
+    }
+
+    bool inserted;
+    pthread_mutex_lock(&huge.lock);
     {
-        switch (memory_manager.allocation_policy) {
-            case FIRST_FIT:
-                free_block_header = first_fit_block_search(size);
-                break;
+        inserted = huge_insert((struct huge_block){ ptr, mapped_size });
+        if (inserted && tracer.active) {
+            trace_record(MMANAGER_TRACE_ALLOCATE, ptr, size);
+        }
+    }
+    pthread_mutex_unlock(&huge.lock);
 
-            case BEST_FIT:
-                free_block_header = best_fit_block_search(size);
-                break;
-            
-            case WORST_FIT:
-                free_block_header = worst_fit_block_search(size);
-                break;
+    if (!inserted) {
+        munmap(ptr, mapped_size);
+        return NULL;
+    }
+    return ptr;
+}
 
-            default:
-                fprintf(stderr, "ERROR: no allocation algorithm specified.\n");
-                raise(SIGABRT);
+static bool huge_deallocate(void *ptr) {
+    struct huge_block block = { NULL, 0 };
+    pthread_mutex_lock(&huge.lock);
+    {
+        size_t slot = huge_slot(ptr);
+        block = huge.blocks[slot];
+        if (block.ptr) {
+            huge_remove(slot);
+            if (tracer.active) {
+                trace_record(MMANAGER_TRACE_DEALLOCATE, ptr, block.size);
+            }
         }
+    }
+    pthread_mutex_unlock(&huge.lock);
 
-        if (free_block_header) {
-            // Rename `free_block_header` to `allocated_block_header` for clarity.
-            header_t *allocated_block_header = free_block_header;
-            // Remove it from free list.
-            remove_from_free_list(allocated_block_header);
-
-            // Check if there is more memory in this block for future allocation.
-            if (allocated_block_header->block_size - size > HEADER_SIZE) {
-                // Create a new free block.
-                header_t *new_free_block_header = (header_t *)(allocated_block_header->block_memory + size);
-                new_free_block_header->block_size = allocated_block_header->block_size - (HEADER_SIZE + size);
+    if (!block.ptr) {
+        return false;
+    }
+    munmap(block.ptr, block.size);
+    return true;
+}
 
-                // Add `new_free_block_header` to free list.
-                add_to_free_list(new_free_block_header);
+static void *huge_reallocate(void *ptr, size_t new_size) {
+    if (new_size > SIZE_MAX - huge.page_size) {
+        return NULL;
+    }
+    size_t mapped_size = (new_size + huge.page_size - 1) & ~(huge.page_size - 1);
 
-                // Set the size of the newly allocated block.
-                allocated_block_header->block_size = size;
+    void *new_ptr = NULL;
+    pthread_mutex_lock(&huge.lock);
+    {
+        // Holding the lock keeps another thread from freeing the block while
+        // it is remapped.
+        size_t slot = huge_slot(ptr);
+        struct huge_block block = huge.blocks[slot];
+        new_ptr = mremap(block.ptr, block.size, mapped_size, MREMAP_MAYMOVE);
+        if (new_ptr == MAP_FAILED) {
+            new_ptr = NULL;
+        }
+        else {
+            huge_remove(slot);
+            huge_insert((struct huge_block){ new_ptr, mapped_size });
+            if (tracer.active) {
+                trace_record(MMANAGER_TRACE_DEALLOCATE, ptr, block.size);
+                trace_record(MMANAGER_TRACE_ALLOCATE, new_ptr, new_size);
             }
-
-            // Add `allocated_block_header` to alloc list.
-            add_to_alloc_list(allocated_block_header);
-            
-            ptr = (void *)allocated_block_header->block_memory;
         }
     }
-    pthread_mutex_unlock(&lock);
+    pthread_mutex_unlock(&huge.lock);
 
-    return ptr;
+    return new_ptr;
 }
 
-void *allocate_debug(size_t size, int *i) {
-    assert(size > 0);
-    void* ptr = NULL;
-    header_t *free_block_header = NULL;
-
-    pthread_mutex_lock(&lock);
+static size_t huge_size(void *ptr) {
+    size_t size;
+    pthread_mutex_lock(&huge.lock);
     {
-        switch (memory_manager.allocation_policy) {
-            case FIRST_FIT:
-                free_block_header = first_fit_block_search(size);
-                break;
+        size = huge.blocks[huge_slot(ptr)].size;
+    }
+    pthread_mutex_unlock(&huge.lock);
+    return size;
+}
 
-            case BEST_FIT:
-                free_block_header = best_fit_block_search(size);
-                break;
-            
-            case WORST_FIT:
-                free_block_header = worst_fit_block_search(size);
-                break;
+static size_t huge_slot(const void *ptr) {
+    size_t mask = huge.capacity - 1;
+    size_t slot = (size_t)(((uintptr_t)ptr * 11400714819323198485ull) >> 20) & mask;
+    while (huge.blocks[slot].ptr && huge.blocks[slot].ptr != ptr) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
 
-            default:
-                fprintf(stderr, "ERROR: no allocation algorithm specified.\n");
-                raise(SIGABRT);
+static bool huge_insert(struct huge_block block) {
+    if (2 * (huge.count + 1) > huge.capacity) {
+        struct huge_block *old_blocks = huge.blocks;
+        size_t old_capacity = huge.capacity;
+        struct huge_block *new_blocks = metadata_map(2 * old_capacity * sizeof(*new_blocks));
+        if (!new_blocks) {
+            if (huge.count + 1 == old_capacity) {
+                return false;
+            }
+        }
+        else {
+            huge.blocks = new_blocks;
+            huge.capacity = 2 * old_capacity;
+            for (size_t i = 0; i < old_capacity; ++i) {
+                if (old_blocks[i].ptr) {
+                    huge.blocks[huge_slot(old_blocks[i].ptr)] = old_blocks[i];
+                }
+            }
+            metadata_unmap(old_blocks, old_capacity * sizeof(*old_blocks));
         }
+    }
 
-        if (free_block_header) {
-            // Rename `free_block_header` to `allocated_block_header` for clarity.
-            header_t *allocated_block_header = free_block_header;
-            // Remove it from free list.
-            remove_from_free_list(allocated_block_header);
+    huge.blocks[huge_slot(block.ptr)] = block;
+    ++huge.count;
+    huge.mapped_bytes += block.size;
+    return true;
+}
 
-            // Check if there is more memory in this block for future allocation.
-            if (allocated_block_header->block_size - size > HEADER_SIZE) {
-                // Create a new free block.
-                header_t *new_free_block_header = (header_t *)(allocated_block_header->block_memory + size);
-                new_free_block_header->block_size = allocated_block_header->block_size - (HEADER_SIZE + size);
+static void huge_remove(size_t slot) {
+    size_t mask = huge.capacity - 1;
+    --huge.count;
+    huge.mapped_bytes -= huge.blocks[slot].size;
+    huge.blocks[slot].ptr = NULL;
+    huge.blocks[slot].size = 0;
+
+    // Re-insert the rest of the probe run so that lookups do not stop early.
+    for (size_t i = (slot + 1) & mask; huge.blocks[i].ptr; i = (i + 1) & mask) {
+        struct huge_block moved = huge.blocks[i];
+        huge.blocks[i].ptr = NULL;
+        huge.blocks[i].size = 0;
+        huge.blocks[huge_slot(moved.ptr)] = moved;
+    }
+}
 
-                // Add `new_free_block_header` to free list.
-                add_to_free_list(new_free_block_header);
 
-                // Set the size of the newly allocated block.
-                allocated_block_header->block_size = size;
-            }
+/* * * * * * * * * * * * * * * * * * *
+ * Allocation tracing.
+ * * * * * * * * * * * * * * * * * * */
 
-            // Add `allocated_block_header` to alloc list.
-            add_to_alloc_list(allocated_block_header);
-            
-            ptr = (void *)allocated_block_header->block_memory;
+static void trace_record(enum mmanager_trace_op op, void *ptr, uint64_t arg) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&tracer.lock);
+    {
+        // Tracing may have stopped if no arena lock is held by the caller.
+        if (tracer.active) {
+            struct mmanager_trace_record *record = &tracer.buffer[tracer.count];
+            record->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+            record->id = ptr ? (uint64_t)((char *)ptr - (char *)memory_manager.memory) : MMANAGER_TRACE_NULL_ID;
+            record->arg = arg;
+            record->thread_id = (uint32_t)syscall(SYS_gettid);
+            record->op = (uint32_t)op;
+
+            if (++tracer.count == tracer.capacity) {
+                trace_flush();
+            }
         }
     }
-    pthread_mutex_unlock(&lock);
-
-    return ptr;
+    pthread_mutex_unlock(&tracer.lock);
 }
 
-void *callocate(size_t n, size_t size) {
-    void *memory = allocate(n * size);
-    memset(memory, 0, n * size);
-    return memory;
+static void trace_flush(void) {
+    if (!write_all(tracer.fd, tracer.buffer, tracer.count * sizeof(*tracer.buffer))) {
+        // Drop the buffer rather than stalling allocations.
+        fprintf(stderr, "ERROR: failed to write allocation trace.\n");
+    }
+    tracer.count = 0;
 }
 
-void *reallocate(void *ptr, size_t new_size) {
-    // TODO: Implement.
 
-    return NULL;
+/* * * * * * * * * * * * * * * * * * *
+ * Sampling profiler.
+ * * * * * * * * * * * * * * * * * * */
+
+// Draws the number of bytes until the next sample from an exponential
+// distribution, which makes sampling a Poisson process over allocated bytes.
+static ssize_t next_sample_interval(void) {
+    if (sample_random_state == 0) {
+        sample_random_state = (uint64_t)(uintptr_t)&sample_random_state | 1;
+    }
+    uint64_t x = sample_random_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    sample_random_state = x;
+
+    // Uniform in (0, 1] from the top 53 bits.
+    double u = ((x * 0x2545f4914f6cdd1dull >> 11) + 1.0) / 9007199254740992.0;
+    return (ssize_t)(-log(u) * (double)profiler.sample_period) + 1;
 }
 
-void deallocate(void *ptr) {
-    assert(ptr != NULL);
+static bool profiler_should_sample(size_t size, struct profile_stack *stack) {
+    if (bytes_until_sample < 0) {
+        bytes_until_sample = next_sample_interval();
+    }
 
-    pthread_mutex_lock(&lock);
-    {
-        header_t *dealloc_block_header = (header_t *)((char *)ptr - HEADER_SIZE);
+    bytes_until_sample -= (ssize_t)size;
+    if (bytes_until_sample > 0) {
+        return false;
+    }
 
-        // Remove the block from alloc list.
-        remove_from_alloc_list(dealloc_block_header);
+    bytes_until_sample = next_sample_interval();
+    // Skip this frame and the allocator entry point.
+    void *frames[PROFILER_MAX_DEPTH + 2];
+    int depth = backtrace(frames, PROFILER_MAX_DEPTH + 2) - 2;
+    stack->depth = depth > 0 ? depth : 0;
+    memcpy(stack->frames, frames + 2, stack->depth * sizeof(*frames));
+    return true;
+}
 
-        // Add the block back to free list.
-        add_to_free_list(dealloc_block_header);
+// Returns the slot of `ptr` in the live sample table, or the empty slot where
+// it would be inserted.
+static size_t profiler_sample_slot(void *ptr) {
+    size_t mask = profiler.samples_capacity - 1;
+    size_t slot = (size_t)(((uintptr_t)ptr * 11400714819323198485ull) >> 20) & mask;
+    while (profiler.samples[slot].ptr && profiler.samples[slot].ptr != ptr) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
 
-        // Merge any contiguous free blocks.
-        coalesce_free_blocks();
+// Inserts `sample` into the live sample table, growing it if needed. Returns
+// false if the table is full and could not be grown.
+static bool profiler_insert_sample(struct profile_sample sample) {
+    if (2 * (profiler.samples_count + 1) > profiler.samples_capacity) {
+        struct profile_sample *old_samples = profiler.samples;
+        size_t old_capacity = profiler.samples_capacity;
+        struct profile_sample *new_samples = metadata_map(2 * old_capacity * sizeof(*new_samples));
+        if (!new_samples) {
+            // Keep going at a higher load factor rather than dropping the sample.
+            if (profiler.samples_count + 1 == old_capacity) {
+                return false;
+            }
+        }
+        else {
+            profiler.samples = new_samples;
+            profiler.samples_capacity = 2 * old_capacity;
+            for (size_t i = 0; i < old_capacity; ++i) {
+                if (old_samples[i].ptr) {
+                    profiler.samples[profiler_sample_slot(old_samples[i].ptr)] = old_samples[i];
+                }
+            }
+            metadata_unmap(old_samples, old_capacity * sizeof(*old_samples));
+        }
     }
-    pthread_mutex_unlock(&lock);
+
+    profiler.samples[profiler_sample_slot(sample.ptr)] = sample;
+    ++profiler.samples_count;
+    return true;
 }
 
-size_t mmanager_compact(void **before_addresses, void **after_addresses) {
-    int index = 0;
+// Removes `ptr` from the live sample table and returns its entry.
+static struct profile_sample profiler_remove_sample(void *ptr) {
+    size_t mask = profiler.samples_capacity - 1;
+    size_t slot = profiler_sample_slot(ptr);
+    struct profile_sample sample = profiler.samples[slot];
+    profiler.samples[slot].ptr = NULL;
+    --profiler.samples_count;
+
+    // Re-insert the rest of the probe run so that lookups do not stop early.
+    for (size_t i = (slot + 1) & mask; profiler.samples[i].ptr; i = (i + 1) & mask) {
+        struct profile_sample moved = profiler.samples[i];
+        profiler.samples[i].ptr = NULL;
+        profiler.samples[profiler_sample_slot(moved.ptr)] = moved;
+    }
+
+    return sample;
+}
+
+static void profiler_record(header_t *header_address, size_t size, const struct profile_stack *stack) {
+    // FNV-1a over the frame addresses.
+    uint64_t hash = 14695981039346656037ull;
+    for (int i = 0; i < stack->depth; ++i) {
+        hash = (hash ^ (uint64_t)(uintptr_t)stack->frames[i]) * 1099511628211ull;
+    }
 
-    pthread_mutex_lock(&lock);
+    pthread_mutex_lock(&profiler.lock);
     {
-        // Check that there is memory allocated and that there is free memory.
-        if (memory_manager.alloc_list && memory_manager.free_list) {
-            header_t *current_alloc_block = memory_manager.alloc_list;
-
-            // To determine if we must move `current_alloc_block`, look at the
-            // address of the first free block. If it is less than the address of
-            // `current_alloc_block`, compaction needs to occur. Otherwise, look
-            // at the next allocated block.
-            // Note: We only have to interact with the head of the free list.
-            while (current_alloc_block) {
-                header_t *first_free_block = memory_manager.free_list;
-
-                if (first_free_block < current_alloc_block) {
-                    // Remove the allocated block and the free block from their lists.
-                    remove_from_alloc_list(current_alloc_block);
-                    remove_from_free_list(first_free_block);
-
-                    // Set before-compaction address.
-                    before_addresses[index] = current_alloc_block->block_memory;
-                    
-                    // Remember the size of `first_free_block` to set it later.
-                    size_t free_block_size = first_free_block->block_size;
-
-                    // Copy header info from `current_alloc_block` to `first_free_block`.
-                    memcpy((void *)first_free_block, (void *)current_alloc_block, HEADER_SIZE);
-
-                    // Move `current_alloc_block` data.
-                    memcpy((void *)first_free_block->block_memory,
-                        (void *)current_alloc_block->block_memory,
-                        current_alloc_block->block_size);
-                    
-                    // At this point, `current_alloc_block` has been entirely moved.
-                    // Redefine for clarity.
-                    current_alloc_block = first_free_block;
-                    first_free_block = (header_t *)(current_alloc_block->block_memory + current_alloc_block->block_size);
-
-                    // Set free block size, since at the moment it stores garbage data.
-                    first_free_block->block_size = free_block_size;
-
-                    // Add the compacted blocks back to their lists.
-                    add_to_alloc_list(current_alloc_block);
-                    add_to_free_list(first_free_block);
-
-                    // Eliminate any contiguous free blocks.
-                    coalesce_free_blocks();
-
-                    // Set after-compaction address.
-                    after_addresses[index] = current_alloc_block->block_memory;
-                    ++index;
+        // The profiler may have been stopped since the sampling decision.
+        if (profiler.active) {
+            struct profile_bucket **head = &profiler.buckets[hash % PROFILER_BUCKETS];
+            struct profile_bucket *bucket = *head;
+            while (bucket && (bucket->hash != hash || bucket->stack.depth != stack->depth
+                || memcmp(bucket->stack.frames, stack->frames, stack->depth * sizeof(void *)) != 0)) {
+                bucket = bucket->next;
+            }
+            if (!bucket) {
+                if (!profiler.chunks || profiler.chunks->used == PROFILER_BUCKETS_PER_CHUNK) {
+                    struct profile_bucket_chunk *chunk = metadata_map(sizeof(*chunk));
+                    if (!chunk) {
+                        pthread_mutex_unlock(&profiler.lock);
+                        return;
+                    }
+                    chunk->next = profiler.chunks;
+                    profiler.chunks = chunk;
                 }
+                bucket = &profiler.chunks->buckets[profiler.chunks->used++];
+                bucket->hash = hash;
+                bucket->stack = *stack;
+                bucket->next = *head;
+                *head = bucket;
+            }
 
-                // Look at next allocated block.
-                current_alloc_block = current_alloc_block->next;
+            struct profile_sample sample = { header_address->block_memory, size, bucket };
+            if (profiler_insert_sample(sample)) {
+                ++bucket->live_count;
+                bucket->live_bytes += size;
+                ++bucket->total_count;
+                bucket->total_bytes += size;
+                header_address->sampled = 1;
             }
         }
     }
-    pthread_mutex_unlock(&lock);
-
-    // Return size of the argument arrays.
-    return index;
+    pthread_mutex_unlock(&profiler.lock);
 }
 
-size_t mmanager_available_memory(void) {
-    size_t size = 0;
-    
-    pthread_mutex_lock(&lock);
+static void profiler_forget(void *ptr) {
+    pthread_mutex_lock(&profiler.lock);
     {
-        header_t *current_block = (header_t *)memory_manager.free_list;
-        while (current_block) {
-            size += current_block->block_size;
-            current_block = current_block->next;
-        }
+        struct profile_sample sample = profiler_remove_sample(ptr);
+        --sample.bucket->live_count;
+        sample.bucket->live_bytes -= sample.size;
+        ((header_t *)((char *)ptr - HEADER_SIZE))->sampled = 0;
     }
-    pthread_mutex_unlock(&lock);
+    pthread_mutex_unlock(&profiler.lock);
+}
 
-    return size;
+static void profiler_move(void *before, void *after) {
+    pthread_mutex_lock(&profiler.lock);
+    {
+        // Removing the old entry leaves room, so the table never needs to grow here.
+        struct profile_sample sample = profiler_remove_sample(before);
+        sample.ptr = after;
+        profiler.samples[profiler_sample_slot(after)] = sample;
+        ++profiler.samples_count;
+    }
+    pthread_mutex_unlock(&profiler.lock);
 }
 
 
 /* * * * * * * * * * * * * * * * * * *
- * Memory allocation policies.
+ * Sanitizer annotations.
  * * * * * * * * * * * * * * * * * * */
 
-static header_t *first_fit_block_search(size_t block_size) {
-    header_t *current_block = (header_t *)memory_manager.free_list;
-    while (current_block) {
-        if (current_block->block_size >= block_size) {
-            return current_block;
-        }
-        current_block = current_block->next;
+// Headers stay poisoned for AddressSanitizer, which does not check this file,
+// while Valgrind checks every access and must see them as defined. The usable
+// part of a block excludes its canary.
+
+static void annotate_heap_created(void) {
+#ifdef MMANAGER_ASAN
+    __asan_poison_memory_region(memory_manager.memory, memory_manager.size);
+#endif
+#ifdef MMANAGER_VALGRIND
+    VALGRIND_CREATE_MEMPOOL(memory_manager.memory, 0, 0);
+#endif
+}
+
+static void annotate_heap_destroyed(void) {
+#ifdef MMANAGER_ASAN
+    // The address range may be mapped again by someone else.
+    __asan_unpoison_memory_region(memory_manager.memory, memory_manager.size);
+#endif
+#ifdef MMANAGER_VALGRIND
+    VALGRIND_DESTROY_MEMPOOL(memory_manager.memory);
+#endif
+}
+
+static inline void annotate_block_allocated(header_t *header_address) {
+    (void)header_address;
+#ifdef MMANAGER_ASAN
+    __asan_unpoison_memory_region(header_address->block_memory, header_address->block_size - canary_size());
+#endif
+#ifdef MMANAGER_VALGRIND
+    VALGRIND_MEMPOOL_ALLOC(memory_manager.memory, header_address->block_memory,
+        header_address->block_size - canary_size());
+#endif
+}
+
+static inline void annotate_block_freed(header_t *header_address) {
+    (void)header_address;
+#ifdef MMANAGER_ASAN
+    __asan_poison_memory_region(header_address->block_memory, header_address->block_size);
+#endif
+#ifdef MMANAGER_VALGRIND
+    VALGRIND_MEMPOOL_FREE(memory_manager.memory, header_address->block_memory);
+#endif
+}
+
+static inline void annotate_block_resized(header_t *header_address, size_t old_size) {
+    (void)header_address;
+    (void)old_size;
+#ifdef MMANAGER_ASAN
+    size_t extent = old_size > header_address->block_size ? old_size : header_address->block_size;
+    __asan_poison_memory_region(header_address->block_memory, extent);
+    __asan_unpoison_memory_region(header_address->block_memory, header_address->block_size - canary_size());
+#endif
+#ifdef MMANAGER_VALGRIND
+    size_t old_usable = old_size - canary_size();
+    size_t new_usable = header_address->block_size - canary_size();
+    VALGRIND_MEMPOOL_CHANGE(memory_manager.memory, header_address->block_memory, header_address->block_memory,
+        new_usable);
+    if (new_usable > old_usable) {
+        VALGRIND_MAKE_MEM_UNDEFINED(header_address->block_memory + old_usable, new_usable - old_usable);
     }
-    return NULL;
+#endif
 }
 
-static header_t *best_fit_block_search(size_t block_size) {
-    // To find the best fitting block, we take the difference between the size
-    // of `current_block` and `block_size`. Let this difference be `delta`. We
-    // then iterate through the free list to find the minimal delta.
+static inline void annotate_block_moved(void *before, header_t *header_address) {
+    (void)before;
+    (void)header_address;
+#ifdef MMANAGER_ASAN
+    __asan_unpoison_memory_region(header_address->block_memory, header_address->block_size - canary_size());
+#endif
+#ifdef MMANAGER_VALGRIND
+    VALGRIND_MEMPOOL_CHANGE(memory_manager.memory, before, header_address->block_memory,
+        header_address->block_size - canary_size());
+    VALGRIND_MAKE_MEM_DEFINED(header_address->block_memory, header_address->block_size - canary_size());
+#endif
+}
 
-    header_t *best_fit_block = NULL;
-    header_t *current_block = (header_t *)memory_manager.free_list;
-    size_t min_delta = SIZE_MAX;
+static inline void annotate_header(header_t *header_address) {
+    (void)header_address;
+#ifdef MMANAGER_VALGRIND
+    VALGRIND_MAKE_MEM_DEFINED(header_address, HEADER_SIZE);
+#endif
+}
 
-    while (current_block) {
-        // Check if `current_block` can fit `block_size`.
-        if (current_block->block_size >= block_size) {
-            size_t delta = current_block->block_size - block_size;
-            if (delta < min_delta) {
-                min_delta = delta;
-                best_fit_block = current_block;
-            }
-        }
-        current_block = current_block->next;
+static inline void annotate_internal_access(void *ptr, size_t size) {
+    (void)ptr;
+    (void)size;
+#ifdef MMANAGER_ASAN
+    // Needed for the intercepted memset(), memcpy() and memcmp().
+    __asan_unpoison_memory_region(ptr, size);
+#endif
+#ifdef MMANAGER_VALGRIND
+    VALGRIND_MAKE_MEM_DEFINED(ptr, size);
+#endif
+}
+
+static inline void annotate_internal_done(void *ptr, size_t size) {
+    (void)ptr;
+    (void)size;
+#ifdef MMANAGER_ASAN
+    __asan_poison_memory_region(ptr, size);
+#endif
+#ifdef MMANAGER_VALGRIND
+    VALGRIND_MAKE_MEM_NOACCESS(ptr, size);
+#endif
+}
+
+
+/* * * * * * * * * * * * * * * * * * *
+ * Bookkeeping memory.
+ * * * * * * * * * * * * * * * * * * */
+
+static void *map_arenas(size_t size) {
+    memory_manager.mapped_size = size;
+    memory_manager.trim_unit = (size_t)sysconf(_SC_PAGESIZE);
+    if (!(memory_manager.flags & MMANAGER_HUGE_PAGES)) {
+        void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        return memory == MAP_FAILED ? NULL : memory;
     }
 
-    return best_fit_block;
+    size_t mapped_size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    memory_manager.mapped_size = mapped_size;
+    memory_manager.trim_unit = HUGE_PAGE_SIZE;
+
+#ifdef MAP_HUGETLB
+    // Explicit huge pages exist only if they were reserved. The mapping is not
+    // MAP_NORESERVE, so that it fails now instead of faulting with SIGBUS later.
+    void *memory = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory != MAP_FAILED) {
+        return memory;
+    }
+#endif
+
+    // Otherwise ask for transparent huge pages. Over-map by a huge page and
+    // keep an aligned range, so that every huge page of the arenas is whole.
+    char *raw = mmap(NULL, mapped_size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+    char *aligned = (char *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+    if (aligned > raw) {
+        munmap(raw, aligned - raw);
+    }
+    munmap(aligned + mapped_size, raw + HUGE_PAGE_SIZE - aligned);
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, mapped_size, MADV_HUGEPAGE);
+#endif
+    return aligned;
 }
 
-static header_t *worst_fit_block_search(size_t block_size) {
+static void *metadata_map(size_t size) {
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
 
-    // To find the worst fitting block, we take the difference between the size
-    // of `current_block` and `block_size`. Let this difference be `delta`. We
-    // then iterate through the free list to find the maximal delta.
+static void metadata_unmap(void *ptr, size_t size) {
+    if (ptr) {
+        munmap(ptr, size);
+    }
+}
 
-    header_t *worst_fit_block = NULL;
-    header_t *current_block = (header_t *)memory_manager.free_list;
-    size_t max_delta = 0;
 
-    while (current_block) {
-        // Check if `current_block` can fit `block_size`.
-        if (current_block->block_size >= block_size) {
-            size_t delta = current_block->block_size - block_size;
-            if (delta > max_delta) {
-                max_delta = delta;
-                worst_fit_block = current_block;
-            }
+/* * * * * * * * * * * * * * * * * * *
+ * File output.
+ * * * * * * * * * * * * * * * * * * */
+
+static bool write_all(int fd, const void *data, size_t size) {
+    const char *current = data;
+    while (size > 0) {
+        ssize_t written = write(fd, current, size);
+        if (written < 0) {
+            return false;
         }
-        current_block = current_block->next;
+        current += written;
+        size -= (size_t)written;
     }
-
-    return worst_fit_block;
+    return true;
 }
 
 
@@ -390,41 +3525,39 @@ static header_t *worst_fit_block_search(size_t block_size) {
  * List helpers.
  * * * * * * * * * * * * * * * * * * */
 
-static void add_to_free_list(header_t *header_address) {
+static void add_to_free_list(struct arena *arena, header_t *header_address) {
     // If the free list is empty, set `header_address` as free list head.
-    if (!memory_manager.free_list) {
-        memory_manager.free_list = header_address;
+    if (!arena->free_list) {
+        header_address->next = NULL;
+        arena->free_list = header_address;
     }
     // If the free list head has a bigger address than `header_address`, set
     // new free list head.
-    else if (header_address < memory_manager.free_list) {
-        header_address->next = memory_manager.free_list;
-        memory_manager.free_list = header_address;
+    else if (header_address < arena->free_list) {
+        header_address->next = arena->free_list;
+        arena->free_list = header_address;
     }
-    // Otherwise, find the first block whose address is greater than `header_address`
-    // and add the new block before it.
+    // Otherwise, find the last block whose address is less than `header_address`
+    // and add the new block after it.
     else {
-        header_t *current_block = memory_manager.free_list;
-        while (current_block) {
-            if (current_block->next && current_block->next > header_address) {
-                header_address->next = current_block->next;
-                current_block->next = header_address;
-                return;
-            }
+        header_t *current_block = arena->free_list;
+        while (current_block->next && current_block->next < header_address) {
             current_block = current_block->next;
         }
+        header_address->next = current_block->next;
+        current_block->next = header_address;
     }
 }
 
-static void remove_from_free_list(header_t *header_address) {
+static void remove_from_free_list(struct arena *arena, header_t *header_address) {
     // If `header_address` is the free list head, set new free list head.
-    if (header_address == memory_manager.free_list) {
-        memory_manager.free_list = header_address->next;
+    if (header_address == arena->free_list) {
+        arena->free_list = header_address->next;
     }
     // Otherwise, look for it in the free list and change its predecessor's `next`
     // pointer.
     else {
-        header_t *current_block = memory_manager.free_list;
+        header_t *current_block = arena->free_list;
         while (current_block->next != header_address) {
             current_block = current_block->next;
         }
@@ -433,70 +3566,27 @@ static void remove_from_free_list(header_t *header_address) {
     }
 }
 
-static void add_to_alloc_list(header_t *header_address) {
-    // If the alloc list is empty, set `header_address` as alloc list head.
-    if (!memory_manager.alloc_list) {
-        memory_manager.alloc_list = header_address;
-    }
-    // If the alloc list head has a bigger address than `header_address`, set
-    // new alloc list head.
-    else if (header_address < memory_manager.alloc_list) {
-        header_address->next = memory_manager.alloc_list;
-        memory_manager.alloc_list = header_address;
-    }
-    // Otherwise, find the first block whose address is greater than `header_address`
-    // and add the new block before it.
-    else {
-        header_t *current_block = memory_manager.alloc_list;
-        while (current_block) {
-            if (current_block->next && current_block->next > header_address) {
-                header_address->next = current_block->next;
-                current_block->next = header_address;
-                return;
-            }
-            // If `current_block->next` is NULL, then we must be at the end of the list.
-            else if (!current_block->next) {
-                // All of the blocks in the alloc list have addresses less than
-                // `header_address`, so add the new block to the end of the list.
-                current_block->next = header_address;
-                header_address->next = NULL;
-            }
-            current_block = current_block->next;
-        }
-    }
-}
-
-static void remove_from_alloc_list(header_t *header_address) {
-    // If `header_address` is the alloc list head, set new alloc list head.
-    if (header_address == memory_manager.alloc_list) {
-        memory_manager.alloc_list = header_address->next;
-    }
-    // Otherwise, look for it in the alloc list and change its predecessor's `next`
-    // pointer.
-    else {
-        header_t *current_block = memory_manager.alloc_list;
-        // Make sure we don't dereference a NULL pointer.
-        while (current_block && current_block->next != header_address) {
-            current_block = current_block->next;
-        }
-        if (current_block) {
-            // Here, current_block->next == header_address.
-            current_block->next = header_address->next;
-        }
+static void coalesce_free_blocks(struct arena *arena) {
+    header_t *current_block_header = arena->free_list;
+    if (!current_block_header) {
+        return;
     }
-}
-
-static void coalesce_free_blocks(void) {
-    header_t *current_block_header = memory_manager.free_list;
     header_t *next_block_header = current_block_header->next;
     while (next_block_header) {
         // If we found contiguous free blocks, merge them together.
         if (current_block_header->block_memory + current_block_header->block_size == (char *)next_block_header) {
             // Add total size of the next block to the current block.
             current_block_header->block_size += (HEADER_SIZE + next_block_header->block_size);
-            remove_from_free_list(next_block_header);
+            current_block_header->trimmed = 0;
+            remove_from_free_list(arena, next_block_header);
 
+            header_t *merged_block_header = next_block_header;
             next_block_header = next_block_header->next;
+            if (memory_manager.flags & MMANAGER_POISON_FREE) {
+                annotate_internal_access(merged_block_header, HEADER_SIZE);
+                memset(merged_block_header, FREE_POISON, HEADER_SIZE);
+            }
+            annotate_internal_done(merged_block_header, HEADER_SIZE);
         }
         // Otherwise, shift to the next pair of blocks.
         else {
@@ -506,28 +3596,262 @@ static void coalesce_free_blocks(void) {
     }
 }
 
+void mmanager_profiler_start(size_t sample_period) {
+    // backtrace() may allocate the first time it is called, so warm it up
+    // before any allocation can be sampled.
+    void *frame;
+    backtrace(&frame, 1);
+
+    pthread_mutex_lock(&profiler.lock);
+    {
+        if (!profiler.samples) {
+            profiler.samples_capacity = PROFILER_INITIAL_SAMPLES;
+            profiler.samples = metadata_map(profiler.samples_capacity * sizeof(*profiler.samples));
+            profiler.samples_count = 0;
+        }
+        profiler.sample_period = sample_period ? sample_period : DEFAULT_PROFILER_SAMPLE_PERIOD;
+        __atomic_store_n(&profiler.active, true, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&profiler.lock);
+}
+
+void mmanager_profiler_stop(void) {
+    // Blocks may still carry the `sampled` flag, so the arena locks are needed
+    // to clear the tables consistently.
+    lock_all_arenas();
+    pthread_mutex_lock(&profiler.lock);
+    {
+        __atomic_store_n(&profiler.active, false, __ATOMIC_RELAXED);
+
+        for (size_t i = 0; i < profiler.samples_capacity; ++i) {
+            void *ptr = profiler.samples[i].ptr;
+            if (ptr) {
+                ((header_t *)((char *)ptr - HEADER_SIZE))->sampled = 0;
+            }
+        }
+        metadata_unmap(profiler.samples, profiler.samples_capacity * sizeof(*profiler.samples));
+        profiler.samples = NULL;
+        profiler.samples_capacity = 0;
+        profiler.samples_count = 0;
+
+        memset(profiler.buckets, 0, sizeof(profiler.buckets));
+        while (profiler.chunks) {
+            struct profile_bucket_chunk *chunk = profiler.chunks;
+            profiler.chunks = chunk->next;
+            metadata_unmap(chunk, sizeof(*chunk));
+        }
+    }
+    pthread_mutex_unlock(&profiler.lock);
+    unlock_all_arenas();
+}
+
+int mmanager_profiler_write(int fd) {
+    char *buffer = metadata_map(PROFILER_WRITE_BUFFER);
+    if (!buffer) {
+        return -1;
+    }
+    size_t length = 0;
+    bool ok = true;
+
+    pthread_mutex_lock(&profiler.lock);
+    {
+        size_t live_count = 0;
+        size_t live_bytes = 0;
+        size_t total_count = 0;
+        size_t total_bytes = 0;
+        for (size_t i = 0; i < PROFILER_BUCKETS; ++i) {
+            for (struct profile_bucket *bucket = profiler.buckets[i]; bucket; bucket = bucket->next) {
+                live_count += bucket->live_count;
+                live_bytes += bucket->live_bytes;
+                total_count += bucket->total_count;
+                total_bytes += bucket->total_bytes;
+            }
+        }
+
+        // Legacy gperftools heap profile, understood by pprof. Counts are raw
+        // samples; the heap_v2 header tells pprof how to scale them.
+        length += snprintf(buffer + length, PROFILER_WRITE_BUFFER - length,
+            "heap profile: %6zu: %8zu [%6zu: %8zu] @ heap_v2/%zu\n",
+            live_count, live_bytes, total_count, total_bytes, profiler.sample_period);
+
+        for (size_t i = 0; ok && i < PROFILER_BUCKETS; ++i) {
+            for (struct profile_bucket *bucket = profiler.buckets[i]; ok && bucket; bucket = bucket->next) {
+                // Flush if the longest possible line might not fit.
+                if (PROFILER_WRITE_BUFFER - length < 128 + 20 * PROFILER_MAX_DEPTH) {
+                    ok = write_all(fd, buffer, length);
+                    length = 0;
+                }
+                length += snprintf(buffer + length, PROFILER_WRITE_BUFFER - length,
+                    "%6zu: %8zu [%6zu: %8zu] @", bucket->live_count, bucket->live_bytes,
+                    bucket->total_count, bucket->total_bytes);
+                for (int frame = 0; frame < bucket->stack.depth; ++frame) {
+                    length += snprintf(buffer + length, PROFILER_WRITE_BUFFER - length,
+                        " %p", bucket->stack.frames[frame]);
+                }
+                buffer[length++] = '\n';
+            }
+        }
+    }
+    pthread_mutex_unlock(&profiler.lock);
+
+    // pprof needs the memory map to symbolize the addresses.
+    length += snprintf(buffer + length, PROFILER_WRITE_BUFFER - length, "\nMAPPED_LIBRARIES:\n");
+    int maps_fd = open("/proc/self/maps", O_RDONLY);
+    if (maps_fd >= 0) {
+        ssize_t n_read;
+        while (ok && (n_read = read(maps_fd, buffer + length, PROFILER_WRITE_BUFFER - length)) > 0) {
+            length += (size_t)n_read;
+            if (length == PROFILER_WRITE_BUFFER) {
+                ok = write_all(fd, buffer, length);
+                length = 0;
+            }
+        }
+        close(maps_fd);
+    }
+
+    if (ok && length > 0) {
+        ok = write_all(fd, buffer, length);
+    }
+    metadata_unmap(buffer, PROFILER_WRITE_BUFFER);
+
+    return ok ? 0 : -1;
+}
+
+int mmanager_dump(int fd) {
+    struct mmanager_dump_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MMANAGER_DUMP_MAGIC, sizeof(MMANAGER_DUMP_MAGIC));
+    header.version = MMANAGER_DUMP_VERSION;
+    header.header_size = HEADER_SIZE;
+
+    // The records are copied while the arenas are locked and written once they
+    // are unlocked. The snapshot is mapped without the locks held, so if the
+    // heap has more blocks than it holds, a larger one is mapped and the walk
+    // is repeated.
+    struct mmanager_dump_record *records = NULL;
+    size_t capacity = 0;
+    size_t needed = DUMP_BUFFER_RECORDS;
+    size_t count = 0;
+    while (needed > capacity) {
+        metadata_unmap(records, capacity * sizeof(*records));
+        capacity = needed + needed / 2;
+        records = metadata_map(capacity * sizeof(*records));
+        if (!records) {
+            return -1;
+        }
+
+        lock_all_arenas();
+        {
+            header.allocation_policy = (uint32_t)memory_manager.allocation_policy;
+            header.arena_size = memory_manager.size;
+
+            needed = 0;
+            for (size_t i = 0; i < memory_manager.n_arenas; ++i) {
+                struct arena *arena = &memory_manager.arenas[i];
+                settle_arena(arena);
+                char *arena_end = (char *)arena->memory + arena->size;
+                for (char *position = arena->memory; position < arena_end; ++needed) {
+                    position = ((header_t *)position)->block_memory + ((header_t *)position)->block_size;
+                }
+            }
+
+            // Walk the arenas block by block; together they tile the whole
+            // mapping. The free list is sorted by address, so a block is free
+            // exactly when it is the next block in its arena's free list.
+            for (size_t i = 0; needed <= capacity && i < memory_manager.n_arenas; ++i) {
+                struct arena *arena = &memory_manager.arenas[i];
+                char *arena_end = (char *)arena->memory + arena->size;
+                header_t *current_block = (header_t *)arena->memory;
+                header_t *next_free_block = arena->free_list;
+                while ((char *)current_block < arena_end) {
+                    enum mmanager_dump_state state = MMANAGER_DUMP_ALLOCATED;
+                    if (current_block == next_free_block) {
+                        state = MMANAGER_DUMP_FREE;
+                        next_free_block = next_free_block->next;
+                    }
+
+                    records[count].offset = (uint64_t)((char *)current_block - (char *)memory_manager.memory);
+                    records[count].size_state = (uint64_t)current_block->block_size
+                        | ((uint64_t)state << MMANAGER_DUMP_STATE_SHIFT);
+                    ++count;
+
+                    current_block = (header_t *)(current_block->block_memory + current_block->block_size);
+                }
+            }
+        }
+        unlock_all_arenas();
+    }
+
+    bool ok = write_all(fd, &header, sizeof(header)) && write_all(fd, records, count * sizeof(*records));
+    metadata_unmap(records, capacity * sizeof(*records));
+
+    return ok ? 0 : -1;
+}
+
+void mmanager_fork_prepare(void) {
+    pthread_mutex_lock(&relocation_map.lock);
+    lock_all_arenas();
+    pthread_mutex_lock(&tracer.lock);
+    pthread_mutex_lock(&profiler.lock);
+    pthread_mutex_lock(&handles.lock);
+    pthread_mutex_lock(&guard.lock);
+    pthread_mutex_lock(&huge.lock);
+}
+
+void mmanager_fork_parent(void) {
+    pthread_mutex_unlock(&huge.lock);
+    pthread_mutex_unlock(&guard.lock);
+    pthread_mutex_unlock(&handles.lock);
+    pthread_mutex_unlock(&profiler.lock);
+    pthread_mutex_unlock(&tracer.lock);
+    unlock_all_arenas();
+    pthread_mutex_unlock(&relocation_map.lock);
+}
+
+void mmanager_fork_child(void) {
+    // The forking thread is the only thread in the child and owns all locks.
+    // The maintenance thread is not restarted; frees stay deferred until an
+    // allocation needs them or the arena is settled.
+    maintenance.running = false;
+    pthread_mutex_unlock(&huge.lock);
+    pthread_mutex_unlock(&guard.lock);
+    pthread_mutex_unlock(&handles.lock);
+    pthread_mutex_unlock(&profiler.lock);
+    pthread_mutex_unlock(&tracer.lock);
+    unlock_all_arenas();
+    pthread_mutex_unlock(&relocation_map.lock);
+}
+
 void mmanager_print_free_list(void) {
     printf("Free list:\n");
-    pthread_mutex_lock(&lock);
+    lock_all_arenas();
     {
-        header_t *current_block = memory_manager.free_list;
-        while (current_block) {
-            printf("\t(%p, %lu, %p)\n", current_block, current_block->block_size, current_block->next);
-            current_block = current_block->next;
+        for (size_t i = 0; i < memory_manager.n_arenas; ++i) {
+            header_t *current_block = memory_manager.arenas[i].free_list;
+            while (current_block) {
+                printf("\t(%p, %lu, %p)\n", current_block, (size_t)current_block->block_size, current_block->next);
+                current_block = current_block->next;
+            }
         }
     }
-    pthread_mutex_unlock(&lock);
+    unlock_all_arenas();
 }
 
 void mmanager_print_alloc_list(void) {
     printf("Alloc list:\n");
-    pthread_mutex_lock(&lock);
+    lock_all_arenas();
     {
-        header_t *current_block = memory_manager.alloc_list;
-        while (current_block) {
-            printf("\t(%p, %lu, %p)\n", current_block, current_block->block_size, current_block->next);
-            current_block = current_block->next;
+        for (size_t i = 0; i < memory_manager.n_arenas; ++i) {
+            struct arena *arena = &memory_manager.arenas[i];
+            char *arena_end = (char *)arena->memory + arena->size;
+            for (char *position = arena->memory; position < arena_end; ) {
+                header_t *current_block = (header_t *)position;
+                if (current_block->allocated) {
+                    printf("\t(%p, %lu)\n", current_block, (size_t)current_block->block_size);
+                }
+                position = current_block->block_memory + current_block->block_size;
+            }
         }
     }
-    pthread_mutex_unlock(&lock);
+    unlock_all_arenas();
 }
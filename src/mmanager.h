@@ -1,6 +1,12 @@
 #ifndef MMANAGER_H_
 #define MMANAGER_H_
 
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 enum AllocationPolicy {
     FIRST_FIT,
     BEST_FIT,
@@ -10,6 +16,94 @@ enum AllocationPolicy {
 // Initializes allocation mechanism.
 void mmanager_initialize(size_t size, enum AllocationPolicy allocation_policy);
 
+// Flags for `struct mmanager_options`.
+enum {
+    // Skip the internal lock on every call. Only valid if the allocator is used
+    // by a single thread or all calls are synchronized by the caller.
+    MMANAGER_NO_LOCKING = 1 << 0,
+    // Defer coalescing of freed blocks, returning free pages to the kernel and
+    // compacting unpinned handle blocks to a background thread. Frees are only
+    // queued, and an allocation that finds no fit merges the queued frees of
+    // its arena first. Ignored with MMANAGER_NO_LOCKING.
+    MMANAGER_BACKGROUND_MAINTENANCE = 1 << 1,
+    // Do not coalesce on every free. Freed blocks are queued instead, small
+    // ones in per-size-class quick lists that allocations of the same class
+    // reuse directly, and are merged into the free list when an allocation
+    // finds no fit or `coalesce_threshold` frees are queued.
+    MMANAGER_DEFERRED_COALESCING = 1 << 2,
+    // Reserve 16 bytes at the end of every block for a canary that is verified
+    // when the block is freed and by `mmanager_check()`.
+    MMANAGER_CANARIES = 1 << 3,
+    // Fill freed blocks with 0xdd so that `mmanager_check()` finds writes to
+    // freed memory.
+    MMANAGER_POISON_FREE = 1 << 4,
+    // Back the arenas with 2 MiB pages to cut TLB misses on large heaps: use
+    // reserved huge pages (MAP_HUGETLB) if there are enough, otherwise align
+    // the arenas to 2 MiB and ask for transparent huge pages. Trimming then
+    // only returns whole huge pages to the kernel.
+    MMANAGER_HUGE_PAGES = 1 << 5
+};
+
+// How threads are assigned to arenas when there are several.
+enum mmanager_arena_assignment {
+    MMANAGER_ARENA_ROUND_ROBIN, // Each new thread gets the next arena.
+    MMANAGER_ARENA_CPU          // Threads use the arena of the CPU they run on.
+};
+
+// What `deallocate()` and `reallocate()` do with a pointer that is not an
+// allocated block, e.g. one that was already freed, and what is done with heap
+// corruption found by them or by `mmanager_check()`.
+enum mmanager_invalid_free_action {
+    MMANAGER_INVALID_FREE_ABORT, // Report it on stderr and abort.
+    MMANAGER_INVALID_FREE_LOG,   // Report it on stderr and ignore the call.
+    MMANAGER_INVALID_FREE_IGNORE // Silently ignore the call.
+};
+
+// Initialization options. Fields that are left zero select the defaults.
+struct mmanager_options {
+    size_t size;                            // Total size of all arenas in bytes.
+    enum AllocationPolicy allocation_policy;
+    unsigned flags;                         // Bitwise OR of MMANAGER_* flags.
+    size_t arenas;                          // Number of arenas, at most 256 (default 1).
+    enum mmanager_arena_assignment arena_assignment;
+    unsigned maintenance_interval_ms;       // Period of the maintenance thread (default 10).
+    unsigned maintenance_duty_cycle;        // Percentage of each period it may work,
+                                            // 1 to 100 (default 5).
+    size_t coalesce_threshold;              // Queued frees that trigger coalescing with
+                                            // MMANAGER_DEFERRED_COALESCING (default 64).
+    size_t guard_sample_rate;               // Guard one in this many allocations (0 disables).
+    size_t guard_slots;                     // Guarded blocks that may be live at once (default 64).
+    enum mmanager_invalid_free_action invalid_free_action; // Default: abort.
+    size_t check_interval_ms;               // Period of `mmanager_check()` in the
+                                            // background (0 disables).
+    size_t mmap_threshold;                  // Requests larger than this many bytes are
+                                            // mapped on their own (0 disables).
+};
+
+// Initializes allocation mechanism as described by `options`. The memory is
+// split evenly into `options->arenas` arenas, each with its own lock and free
+// list. Threads allocate from their own arena and move on to another one when
+// it is contended or full; blocks are always returned to the arena they came
+// from. A thread freeing a block of an arena other than its own pushes it onto
+// that arena's lock-free remote-free queue instead of taking the arena's lock;
+// queued blocks are freed in a batch the next time the arena is locked.
+// `mmanager_initialize(size, policy)` is the same as passing one arena and no
+// flags.
+//
+// With a non-zero `guard_sample_rate`, one in that many allocations of at most
+// a page is placed in a separate region, at the end of a page followed by an
+// inaccessible guard page. Overflowing such a block, or touching it after it
+// was freed, faults with a report on stderr; freeing it twice aborts. This
+// installs a SIGSEGV handler for the lifetime of the allocator. Guarded blocks
+// are not profiled and never move.
+//
+// With a non-zero `mmap_threshold`, larger requests get a mapping of their own
+// outside the arenas, which is unmapped when the block is freed and grown or
+// shrunk with mremap() without copying. Mapped blocks are page-aligned, are
+// not profiled and are not seen by compaction, `mmanager_check()` or the
+// arena statistics. A request that cannot be mapped falls back to the arenas.
+void mmanager_initialize_with_options(const struct mmanager_options *options);
+
 // Destroy allocator and frees all memory.
 void mmanager_destroy(void);
 
@@ -20,19 +114,54 @@ void *allocate(size_t size);
 void *allocate_debug(size_t size, int *i);
 
 // Returns a pointer to a memory block for an array of `n` elements of `size`
-// bytes. Returns NULL if the required memory could not be allocated.
-// The returned memory is initialized to zero.
+// bytes. Returns NULL if the required memory could not be allocated, or if
+// `n * size` overflows. The returned memory is initialized to zero.
 void *callocate(size_t n, size_t size);
 
+// Returns a pointer to a memory block of size `size` whose address is a
+// multiple of `alignment`, which must be a power of two. Returns NULL if a
+// suitable block could not be found.
+void *allocate_aligned(size_t alignment, size_t size);
+
 // Changes the size of the memory block pointer to `ptr` to `new_size` bytes.
 // Returns pointer to a (possibly) different memory block with `new_size` bytes.
 // Contents of `ptr` will be unchanged up to the minimum of the old and new
 // sizes. Returns NULL if unable to resize the memory block without changing
-// contents `ptr`.
+// contents `ptr`. The block is resized in place when it is shrunk or when the
+// block after it is free and large enough. A NULL `ptr` behaves like
+// `allocate(new_size)`, and a `new_size` of 0 frees `ptr` and returns NULL.
 void *reallocate(void *ptr, size_t new_size);
 
-// Frees the memory block pointed to by `ptr`. Results in undefined behavior
-// if `ptr` does not point to allocated memory.
+// Handle of a relocatable memory block. Handle blocks may be moved by
+// compaction at any time unless they are pinned, and are only accessed through
+// the pointer returned by `mm_pin()`.
+typedef size_t mm_handle_t;
+
+#define MM_NULL_HANDLE ((mm_handle_t)0)
+
+// Returns the handle of a new relocatable memory block of `size` bytes, or
+// MM_NULL_HANDLE if it could not be allocated.
+mm_handle_t allocate_handle(size_t size);
+
+// Frees the block of `handle`, which must not be pinned.
+void deallocate_handle(mm_handle_t handle);
+
+// Pins the block of `handle` and returns its current address, which stays
+// valid until the matching `mm_unpin()`. Pins nest. Pointers to handle blocks
+// must not be passed to the other functions of this API.
+void *mm_pin(mm_handle_t handle);
+
+// Releases a pin taken by `mm_pin()`. Once the last pin is released, the block
+// may be moved by the next compaction.
+void mm_unpin(mm_handle_t handle);
+
+// Returns the number of bytes usable in the allocated block pointed to by
+// `ptr`, which may be larger than the size that was requested.
+size_t mmanager_usable_size(void *ptr);
+
+// Frees the memory block pointed to by `ptr`. Double frees and most pointers
+// that do not point to an allocated block are detected in constant time and
+// handled as set by `invalid_free_action`; others result in undefined behavior.
 // Note: `ptr` must not be NULL.
 void deallocate(void *ptr);
 
@@ -41,14 +170,120 @@ void deallocate(void *ptr);
 // `after_addresses`. These arrays will be written to so that `before_addresses` 
 // contains addresses of allocated memory before compaction, and `after_addresses`
 // contains addresses of allocated memory after compaction. Returns the number of
-// valid entries in `before_addresses`/`after_addresses`.
+// valid entries in `before_addresses`/`after_addresses`. Pinned handle blocks
+// are never moved; the handles of moved ones are updated.
+//
+// If both arrays are NULL, the moves are kept in a relocation map owned by the
+// allocator instead, to be looked up with `mmanager_relocate()` and
+// `mmanager_fixup()` until the next compaction that is given no arrays.
 size_t mmanager_compact(void **before_addresses, void **after_addresses);
 
+// Compacts the heap a little at a time. Moves blocks like `mmanager_compact()`,
+// but stops once `max_blocks` blocks have been moved or the next move would
+// exceed `max_bytes` bytes (0 means no limit; at least one block is moved per
+// call), and only locks one arena at a time. The next call resumes where this
+// one stopped. The arrays must hold `max_blocks` addresses, or be NULL to use
+// the relocation map. Returns the number of blocks moved, which is 0 once the
+// whole heap is compact.
+size_t mmanager_compact_incremental(size_t max_bytes, size_t max_blocks,
+    void **before_addresses, void **after_addresses);
+
+// Returns the address the block at `ptr` was moved to by the last compaction
+// that recorded its moves in the relocation map, or `ptr` if it was not moved.
+// `ptr` must be the start of a block. Takes O(log n) for n moves.
+void *mmanager_relocate(void *ptr);
+
+// Replaces each non-NULL pointer of `ptrs[0..n)` with `mmanager_relocate()` of it.
+void mmanager_fixup(void **ptrs, size_t n);
+
+// Runs the work of the background maintenance thread on every arena at once:
+// merges deferred frees, compacts unpinned handle blocks and returns the pages
+// of free blocks to the kernel. May be called with or without
+// MMANAGER_BACKGROUND_MAINTENANCE.
+void mmanager_maintain(void);
+
+// Verifies the whole heap in one pass over each arena: block sizes, the free
+// list, block headers, and with MMANAGER_CANARIES and MMANAGER_POISON_FREE the
+// canaries and freed memory. Each problem is handled
+// as set by `invalid_free_action`. Returns the number of problems found.
+size_t mmanager_check(void);
+
 // Returns the amount of available memory in bytes.
 size_t mmanager_available_memory(void);
 
+// Allocator statistics. Byte counts refer to block memory and exclude headers.
+struct mmanager_stats {
+    size_t arena_size;           // Total size of the arena, including headers.
+    size_t allocated_bytes;      // Bytes currently held by allocated blocks.
+    size_t allocated_blocks;     // Number of allocated blocks.
+    size_t peak_allocated_bytes; // Highest value `allocated_bytes` has reached
+                                 // (sum of the per-arena peaks with several arenas).
+    size_t heap_high_water;      // Highest arena offset ever handed out.
+    size_t free_bytes;           // Same as `mmanager_available_memory()`.
+    size_t free_blocks;          // Number of blocks in the free list.
+    size_t largest_free_block;   // Size of the largest free block.
+    size_t remote_frees;         // Blocks freed through another arena's queue.
+    size_t guarded_blocks;       // Live blocks in the guarded region.
+    size_t mapped_blocks;        // Live blocks above the mmap threshold.
+    size_t mapped_bytes;         // Total size of their mappings.
+    size_t invalid_frees;        // Rejected frees of pointers that were not
+                                 // allocated blocks.
+    size_t heap_corruptions;     // Damaged blocks found by frees and checks.
+};
+
+// Fills `stats` with a snapshot of the allocator statistics. External
+// fragmentation can be computed as 1 - largest_free_block / free_bytes.
+void mmanager_get_stats(struct mmanager_stats *stats);
+
+// Starts recording every allocate/deallocate/callocate/mmanager_compact call to
+// the binary trace file at `path` (see mmanager_trace.h for the format). Records
+// are staged in an in-memory buffer of `buffer_records` entries (0 selects a
+// default) that is appended to the file each time it fills up. The file is not
+// a ring buffer and grows for as long as tracing runs: a replay needs the
+// allocation of every block it frees, which wrapping would overwrite. Returns 0
+// on success and -1 if the trace file could not be created.
+int mmanager_trace_start(const char *path, size_t buffer_records);
+
+// Flushes any buffered trace records and stops tracing. Does nothing if no
+// trace is being recorded.
+void mmanager_trace_stop(void);
+
+// Starts the sampling heap profiler. Allocations are sampled as a Poisson
+// process over allocated bytes with a mean of one sample every `sample_period`
+// bytes (0 selects 512 KiB), and the call stack of each sampled allocation is
+// kept until it is deallocated. Unsampled allocations only pay for a
+// thread-local counter update.
+void mmanager_profiler_start(size_t sample_period);
+
+// Stops the profiler and discards all samples.
+void mmanager_profiler_stop(void);
+
+// Writes the live and cumulative sampled allocations, grouped by call stack,
+// to the file descriptor `fd` in the legacy gperftools heap profile format
+// accepted by pprof (e.g. `pprof --text <binary> <profile>`). Returns 0 on
+// success and -1 if a write failed.
+int mmanager_profiler_write(int fd);
+
+// Writes a binary snapshot of every block in the arena (offset, size and
+// state, see mmanager_dump.h for the format) to the file descriptor `fd`. The
+// records are copied in address order while the heap is locked and written
+// after it is unlocked. Returns 0 on success and -1 if a write failed or the
+// snapshot could not be mapped.
+int mmanager_dump(int fd);
+
+// Handlers that keep the allocator usable in the child of a multi-threaded
+// process. Register them with pthread_atfork() if other threads may be inside
+// the allocator when fork() is called.
+void mmanager_fork_prepare(void);
+void mmanager_fork_parent(void);
+void mmanager_fork_child(void);
+
 // Debugging.
 void mmanager_print_free_list(void);
 void mmanager_print_alloc_list(void);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif // MMANAGER_H_
@@ -0,0 +1,124 @@
+#ifndef MMANAGER_HPP_
+#define MMANAGER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+#include "mmanager.h"
+
+/*
+ * C++ adapters for the global mmanager arena, which must have been set up
+ * with `mmanager_initialize()` before any of them is used.
+ *
+ *   mmanager_memory_resource  std::pmr::memory_resource for pmr containers.
+ *   mmanager_allocator<T>     Stateless std::allocator replacement.
+ *
+ * Both throw std::bad_alloc when the arena is exhausted.
+ */
+
+
+namespace mmanager_detail {
+
+// Alignment of blocks returned by `allocate()` when every size is rounded to it.
+constexpr std::size_t default_alignment = 16;
+
+// Allocates `bytes` bytes aligned to `alignment`, or returns nullptr. Sizes are
+// rounded up to the default alignment so that neighbouring blocks stay aligned
+// as well, and over-aligned requests go through `allocate_aligned()`.
+inline void *try_allocate_bytes(std::size_t bytes, std::size_t alignment) noexcept {
+    if (bytes > std::numeric_limits<std::size_t>::max() - default_alignment) {
+        return nullptr;
+    }
+    bytes = bytes == 0 ? default_alignment : (bytes + default_alignment - 1) & ~(default_alignment - 1);
+
+    if (alignment > default_alignment) {
+        return ::allocate_aligned(alignment, bytes);
+    }
+
+    void *ptr = ::allocate(bytes);
+    // Blocks allocated through the C API with odd sizes can leave the arena
+    // misaligned; fall back to an explicitly aligned block then.
+    if (ptr && reinterpret_cast<std::uintptr_t>(ptr) % alignment != 0) {
+        ::deallocate(ptr);
+        ptr = ::allocate_aligned(alignment, bytes);
+    }
+    return ptr;
+}
+
+// Same as `try_allocate_bytes()`, but throws std::bad_alloc on failure.
+inline void *allocate_bytes(std::size_t bytes, std::size_t alignment) {
+    void *ptr = try_allocate_bytes(bytes, alignment);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+} // namespace mmanager_detail
+
+
+// Memory resource backed by the mmanager arena. All instances share the same
+// arena and therefore compare equal.
+class mmanager_memory_resource : public std::pmr::memory_resource {
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        return mmanager_detail::allocate_bytes(bytes, alignment);
+    }
+
+    void do_deallocate(void *ptr, std::size_t, std::size_t) override {
+        ::deallocate(ptr);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return dynamic_cast<const mmanager_memory_resource *>(&other) != nullptr;
+    }
+};
+
+// Returns a process-wide mmanager_memory_resource, e.g. for
+// `std::pmr::set_default_resource()`.
+inline mmanager_memory_resource *mmanager_get_memory_resource() {
+    static mmanager_memory_resource resource;
+    return &resource;
+}
+
+
+// Stateless allocator backed by the mmanager arena. Over-aligned types are
+// supported.
+template <class T>
+class mmanager_allocator {
+public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using is_always_equal = std::true_type;
+
+    mmanager_allocator() noexcept = default;
+
+    template <class U>
+    mmanager_allocator(const mmanager_allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T *>(mmanager_detail::allocate_bytes(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *ptr, std::size_t) noexcept {
+        ::deallocate(ptr);
+    }
+};
+
+template <class T, class U>
+bool operator==(const mmanager_allocator<T> &, const mmanager_allocator<U> &) noexcept {
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const mmanager_allocator<T> &, const mmanager_allocator<U> &) noexcept {
+    return false;
+}
+
+#endif // MMANAGER_HPP_
@@ -0,0 +1,40 @@
+#ifndef MMANAGER_DUMP_H_
+#define MMANAGER_DUMP_H_
+
+#include <stdint.h>
+
+/*
+ * Format of heap snapshots written by `mmanager_dump()`.
+ *
+ * A snapshot is a `struct mmanager_dump_header` followed by one
+ * `struct mmanager_dump_record` per block, in address order, up to the end of
+ * the file. The blocks tile the arena: each block starts `header_size` bytes
+ * after the end of the previous one.
+ */
+
+#define MMANAGER_DUMP_MAGIC "MMDUMP"
+#define MMANAGER_DUMP_VERSION 1
+
+enum mmanager_dump_state {
+    MMANAGER_DUMP_FREE,
+    MMANAGER_DUMP_ALLOCATED
+};
+
+struct mmanager_dump_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t allocation_policy;
+    uint64_t arena_size;
+    uint64_t header_size;
+};
+
+struct mmanager_dump_record {
+    uint64_t offset;     // Offset of the block header from the start of the arena.
+    uint64_t size_state; // Block size in the low 56 bits, state in the high 8 bits.
+};
+
+#define MMANAGER_DUMP_STATE_SHIFT 56
+#define MMANAGER_DUMP_SIZE(record) ((record)->size_state & ((1ull << MMANAGER_DUMP_STATE_SHIFT) - 1))
+#define MMANAGER_DUMP_STATE(record) ((enum mmanager_dump_state)((record)->size_state >> MMANAGER_DUMP_STATE_SHIFT))
+
+#endif // MMANAGER_DUMP_H_
@@ -0,0 +1,192 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "mmanager.hpp"
+
+/*
+ * Replacements for the global operator new and delete, including the sized
+ * (C++14) and aligned (C++17) overloads, that allocate straight from mmanager
+ * without going through malloc. Link the mmanager_new library into a program
+ * to use them.
+ *
+ * The arena is created on the first allocation, which may happen before
+ * main(), so programs using this library must not call mmanager_initialize()
+ * themselves. Its size and policy are read from the environment:
+ *   MMANAGER_ARENA_SIZE  arena size in bytes (default 1 GiB, reserved lazily)
+ *   MMANAGER_POLICY      first, best or worst (default first)
+ *   MMANAGER_ARENAS      number of arenas (default 1)
+ */
+
+
+#define DEFAULT_ARENA_SIZE (1ul << 30)
+
+
+namespace {
+
+// Sets up the allocator from the environment. Returns true for the static in
+// `ensure_initialized()`.
+bool initialize() {
+    size_t arena_size = DEFAULT_ARENA_SIZE;
+    const char *size_env = getenv("MMANAGER_ARENA_SIZE");
+    if (size_env && *size_env) {
+        arena_size = strtoull(size_env, NULL, 0);
+    }
+    arena_size &= ~(mmanager_detail::default_alignment - 1);
+
+    AllocationPolicy policy = FIRST_FIT;
+    const char *policy_env = getenv("MMANAGER_POLICY");
+    if (policy_env && strcmp(policy_env, "best") == 0) {
+        policy = BEST_FIT;
+    }
+    else if (policy_env && strcmp(policy_env, "worst") == 0) {
+        policy = WORST_FIT;
+    }
+
+    size_t arenas = 1;
+    const char *arenas_env = getenv("MMANAGER_ARENAS");
+    if (arenas_env && *arenas_env) {
+        arenas = strtoull(arenas_env, NULL, 0);
+    }
+
+    mmanager_options options = { arena_size, policy, 0, arenas, MMANAGER_ARENA_ROUND_ROBIN };
+    mmanager_initialize_with_options(&options);
+    return true;
+}
+
+// Creates the arena on first use. The initialization of a local static runs
+// exactly once, even with concurrent callers.
+void ensure_initialized() {
+    static const bool initialized = initialize();
+    (void)initialized;
+}
+
+// Allocates like the standard operator new: on failure, the new handler is
+// called until it gives up. Returns nullptr instead of throwing if `nothrow`.
+void *new_block(std::size_t size, std::size_t alignment, bool nothrow) {
+    ensure_initialized();
+    for (;;) {
+        void *ptr = mmanager_detail::try_allocate_bytes(size, alignment);
+        if (ptr) {
+            return ptr;
+        }
+
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            if (nothrow) {
+                return nullptr;
+            }
+            throw std::bad_alloc();
+        }
+        if (nothrow) {
+            try {
+                handler();
+            }
+            catch (const std::bad_alloc &) {
+                return nullptr;
+            }
+        }
+        else {
+            handler();
+        }
+    }
+}
+
+void delete_block(void *ptr) noexcept {
+    if (ptr) {
+        deallocate(ptr);
+    }
+}
+
+// The header is needed anyway to put the block back in the free list, so the
+// size passed to sized delete is only used to catch mismatched deletes.
+void delete_sized_block(void *ptr, std::size_t size) noexcept {
+    if (ptr) {
+        assert(size <= mmanager_usable_size(ptr));
+        deallocate(ptr);
+    }
+}
+
+} // namespace
+
+
+void *operator new(std::size_t size) {
+    return new_block(size, mmanager_detail::default_alignment, false);
+}
+
+void *operator new[](std::size_t size) {
+    return new_block(size, mmanager_detail::default_alignment, false);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    return new_block(size, mmanager_detail::default_alignment, true);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    return new_block(size, mmanager_detail::default_alignment, true);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+    return new_block(size, static_cast<std::size_t>(alignment), false);
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+    return new_block(size, static_cast<std::size_t>(alignment), false);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return new_block(size, static_cast<std::size_t>(alignment), true);
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return new_block(size, static_cast<std::size_t>(alignment), true);
+}
+
+void operator delete(void *ptr) noexcept {
+    delete_block(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    delete_block(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+    delete_block(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+    delete_block(ptr);
+}
+
+void operator delete(void *ptr, std::size_t size) noexcept {
+    delete_sized_block(ptr, size);
+}
+
+void operator delete[](void *ptr, std::size_t size) noexcept {
+    delete_sized_block(ptr, size);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept {
+    delete_block(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept {
+    delete_block(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept {
+    delete_block(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept {
+    delete_block(ptr);
+}
+
+void operator delete(void *ptr, std::size_t size, std::align_val_t) noexcept {
+    delete_sized_block(ptr, size);
+}
+
+void operator delete[](void *ptr, std::size_t size, std::align_val_t) noexcept {
+    delete_sized_block(ptr, size);
+}
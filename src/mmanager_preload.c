@@ -0,0 +1,273 @@
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mmanager.h"
+
+/*
+ * malloc interposition shim. Building this file into a shared library and
+ * loading it with LD_PRELOAD routes malloc, free, calloc, realloc,
+ * posix_memalign, aligned_alloc, memalign, valloc, pvalloc and
+ * malloc_usable_size of an unmodified binary to mmanager.
+ *
+ * The arena is created on the first call. Its size and policy are read from
+ * the environment:
+ *   MMANAGER_ARENA_SIZE  arena size in bytes (default 1 GiB, reserved lazily)
+ *   MMANAGER_POLICY      first, best or worst (default first)
+ *   MMANAGER_ARENAS      number of arenas (default 1)
+ *
+ * Any allocation made while the arena is being set up (for instance by the
+ * dynamic loader or by a library call made during initialization) is served
+ * from a small static bootstrap buffer and is never freed.
+ */
+
+
+#define DEFAULT_ARENA_SIZE (1ul << 30)
+#define BOOTSTRAP_SIZE (64 * 1024)
+#define MALLOC_ALIGNMENT 16
+
+
+// Size prefix of bootstrap allocations, so that realloc() can copy them.
+struct bootstrap_header {
+    size_t size;
+    size_t padding;
+};
+
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static bool initialized = false;
+static __thread bool initializing = false;
+
+static char bootstrap_buffer[BOOTSTRAP_SIZE] __attribute__((aligned(MALLOC_ALIGNMENT)));
+static size_t bootstrap_used = 0;
+
+
+// Creates the arena. Runs once.
+static void initialize(void);
+
+// Returns true if the allocator can be used by this thread, initializing it on
+// first use. Returns false while this thread is still initializing it.
+static bool ensure_initialized(void);
+
+// Serves an allocation from the bootstrap buffer. Returns NULL when it is full.
+static void *bootstrap_allocate(size_t size, size_t alignment);
+
+// Returns true if `ptr` points into the bootstrap buffer.
+static bool is_bootstrap(void *ptr);
+
+// Rounds `size` up to the malloc alignment, treating 0 as 1. Returns 0 if the
+// rounded size overflows.
+static size_t round_size(size_t size);
+
+
+void *malloc(size_t size) {
+    return memalign(MALLOC_ALIGNMENT, size);
+}
+
+void free(void *ptr) {
+    if (!ptr || is_bootstrap(ptr)) {
+        return;
+    }
+    deallocate(ptr);
+}
+
+void *calloc(size_t n, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(n, size, &total)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    size_t rounded = round_size(total);
+    if (rounded == 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (!ensure_initialized()) {
+        // The bootstrap buffer is static and therefore already zeroed.
+        return bootstrap_allocate(rounded, MALLOC_ALIGNMENT);
+    }
+
+    void *ptr = callocate(1, rounded);
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (!ptr) {
+        return malloc(size);
+    }
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    if (is_bootstrap(ptr)) {
+        // Bootstrap memory is never reused, so move it into the arena.
+        size_t old_size = ((struct bootstrap_header *)ptr - 1)->size;
+        void *new_ptr = malloc(size);
+        if (new_ptr) {
+            memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+        }
+        return new_ptr;
+    }
+
+    size_t rounded = round_size(size);
+    void *new_ptr = rounded ? reallocate(ptr, rounded) : NULL;
+    if (!new_ptr) {
+        errno = ENOMEM;
+    }
+    return new_ptr;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+
+    int saved_errno = errno;
+    void *ptr = memalign(alignment, size);
+    if (!ptr) {
+        errno = saved_errno;
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return memalign(alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (alignment < MALLOC_ALIGNMENT) {
+        alignment = MALLOC_ALIGNMENT;
+    }
+
+    size_t rounded = round_size(size);
+    if (rounded == 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (!ensure_initialized()) {
+        return bootstrap_allocate(rounded, alignment);
+    }
+
+    void *ptr = alignment == MALLOC_ALIGNMENT ? allocate(rounded) : allocate_aligned(alignment, rounded);
+    if (!ptr) {
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+void *valloc(size_t size) {
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    return memalign(page_size, (size + page_size - 1) & ~(page_size - 1));
+}
+
+size_t malloc_usable_size(void *ptr) {
+    if (!ptr) {
+        return 0;
+    }
+    if (is_bootstrap(ptr)) {
+        return ((struct bootstrap_header *)ptr - 1)->size;
+    }
+    return mmanager_usable_size(ptr);
+}
+
+static void initialize(void) {
+    initializing = true;
+
+    size_t arena_size = DEFAULT_ARENA_SIZE;
+    const char *size_env = getenv("MMANAGER_ARENA_SIZE");
+    if (size_env && *size_env) {
+        arena_size = strtoull(size_env, NULL, 0);
+    }
+    // Keep every block 16-byte aligned.
+    arena_size &= ~(size_t)(MALLOC_ALIGNMENT - 1);
+
+    enum AllocationPolicy policy = FIRST_FIT;
+    const char *policy_env = getenv("MMANAGER_POLICY");
+    if (policy_env && strcmp(policy_env, "best") == 0) {
+        policy = BEST_FIT;
+    }
+    else if (policy_env && strcmp(policy_env, "worst") == 0) {
+        policy = WORST_FIT;
+    }
+
+    size_t arenas = 1;
+    const char *arenas_env = getenv("MMANAGER_ARENAS");
+    if (arenas_env && *arenas_env) {
+        arenas = strtoull(arenas_env, NULL, 0);
+    }
+
+    struct mmanager_options options = { arena_size, policy, 0, arenas, MMANAGER_ARENA_ROUND_ROBIN };
+    mmanager_initialize_with_options(&options);
+    pthread_atfork(mmanager_fork_prepare, mmanager_fork_parent, mmanager_fork_child);
+
+    __atomic_store_n(&initialized, true, __ATOMIC_RELEASE);
+    initializing = false;
+}
+
+static bool ensure_initialized(void) {
+    if (__atomic_load_n(&initialized, __ATOMIC_ACQUIRE)) {
+        return true;
+    }
+    if (initializing) {
+        return false;
+    }
+    pthread_once(&init_once, initialize);
+    return true;
+}
+
+static void *bootstrap_allocate(size_t size, size_t alignment) {
+    size_t used = __atomic_load_n(&bootstrap_used, __ATOMIC_RELAXED);
+    size_t start;
+    size_t end;
+    do {
+        start = (used + sizeof(struct bootstrap_header) + alignment - 1) & ~(alignment - 1);
+        end = start + size;
+        if (end > BOOTSTRAP_SIZE) {
+            errno = ENOMEM;
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&bootstrap_used, &used, end, false,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    struct bootstrap_header *header = (struct bootstrap_header *)(bootstrap_buffer + start) - 1;
+    header->size = size;
+    return bootstrap_buffer + start;
+}
+
+static bool is_bootstrap(void *ptr) {
+    return (char *)ptr >= bootstrap_buffer && (char *)ptr < bootstrap_buffer + BOOTSTRAP_SIZE;
+}
+
+static size_t round_size(size_t size) {
+    if (size == 0) {
+        size = 1;
+    }
+    if (size > SIZE_MAX - (MALLOC_ALIGNMENT - 1)) {
+        return 0;
+    }
+    return (size + MALLOC_ALIGNMENT - 1) & ~(size_t)(MALLOC_ALIGNMENT - 1);
+}
@@ -0,0 +1,57 @@
+#ifndef MMANAGER_TRACE_H_
+#define MMANAGER_TRACE_H_
+
+#include <stdint.h>
+
+/*
+ * On-disk format of allocation traces written by `mmanager_trace_start()`.
+ *
+ * A trace file is a `struct mmanager_trace_header` followed by a sequence of
+ * fixed-size `struct mmanager_trace_record` entries in the order the calls
+ * were made. Pointers are recorded as ids, which are offsets of the block
+ * memory from the start of the arena. An id is unique among live blocks, so a
+ * replay can map ids to its own pointers.
+ *
+ * Records are only ever appended, so a trace holds every call from the start
+ * of tracing. The file never wraps: a trace missing the allocations of blocks
+ * freed later could not be replayed.
+ */
+
+#define MMANAGER_TRACE_MAGIC "MMTRACE"
+#define MMANAGER_TRACE_VERSION 1
+
+// Id recorded for a failed allocation.
+#define MMANAGER_TRACE_NULL_ID UINT64_MAX
+
+enum mmanager_trace_op {
+    MMANAGER_TRACE_ALLOCATE,   // `id` is the result, `arg` the requested size.
+    MMANAGER_TRACE_DEALLOCATE, // `id` is the freed block, `arg` its block size.
+    MMANAGER_TRACE_CALLOCATE,  // `id` is the result, `arg` the requested size.
+    MMANAGER_TRACE_COMPACT,    // Start of a compaction. Followed by its moves.
+    MMANAGER_TRACE_MOVE,       // `id` is the old id of a block moved by the
+                               // preceding compaction or reallocation, `arg`
+                               // the new id.
+    MMANAGER_TRACE_REALLOCATE, // `id` is the block, `arg` the requested size.
+                               // Followed by a MOVE with the result, whose
+                               // new id is MMANAGER_TRACE_NULL_ID on failure.
+    MMANAGER_TRACE_COMPACT_STEP // Start of an incremental compaction. `id` is
+                               // its block budget, `arg` its byte budget.
+                               // Followed by its moves.
+};
+
+struct mmanager_trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t allocation_policy;
+    uint64_t arena_size;
+};
+
+struct mmanager_trace_record {
+    uint64_t timestamp_ns; // CLOCK_MONOTONIC time of the call.
+    uint64_t id;
+    uint64_t arg;
+    uint32_t thread_id;    // Kernel thread id of the caller.
+    uint32_t op;           // One of `enum mmanager_trace_op`.
+};
+
+#endif // MMANAGER_TRACE_H_
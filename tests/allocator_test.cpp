@@ -0,0 +1,122 @@
+#include <cstdint>
+#include <list>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.hpp"
+
+
+#define MMRY_ALLOC_SIZE (1 << 20)
+
+
+// An over-aligned type.
+struct alignas(64) wide {
+    char bytes[64];
+};
+
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_allocator);
+TEST_SETUP(mmry_alloc_allocator) {
+    mmanager_initialize(MMRY_ALLOC_SIZE, FIRST_FIT);
+}
+TEST_TEAR_DOWN(mmry_alloc_allocator) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_allocator) {
+    RUN_TEST_CASE(mmry_alloc_allocator, Containers);
+    RUN_TEST_CASE(mmry_alloc_allocator, OverAligned);
+    RUN_TEST_CASE(mmry_alloc_allocator, Exhausted);
+    RUN_TEST_CASE(mmry_alloc_allocator, MemoryResource);
+    RUN_TEST_CASE(mmry_alloc_allocator, MemoryResourceAlignment);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_allocator);
+}
+
+// Tests.
+TEST(mmry_alloc_allocator, Containers) {
+    size_t available = mmanager_available_memory();
+    {
+        std::vector<int, mmanager_allocator<int>> vector;
+        std::list<int, mmanager_allocator<int>> list;
+        for (int i = 0; i < 1000; ++i) {
+            vector.push_back(i);
+            list.push_back(i);
+        }
+        TEST_ASSERT_EQUAL_INT(999, vector.back());
+        TEST_ASSERT_EQUAL_INT(999, list.back());
+        TEST_ASSERT_TRUE(mmanager_available_memory() < available);
+        TEST_ASSERT_TRUE(vector.get_allocator() == mmanager_allocator<long>());
+    }
+    TEST_ASSERT_EQUAL_size_t(available, mmanager_available_memory());
+}
+TEST(mmry_alloc_allocator, OverAligned) {
+    // Misalign the arena on purpose through the C API.
+    void *odd = allocate(5);
+
+    mmanager_allocator<wide> allocator;
+    wide *ptr = allocator.allocate(3);
+    TEST_ASSERT_EQUAL_UINT64(0, reinterpret_cast<uintptr_t>(ptr) % alignof(wide));
+    allocator.deallocate(ptr, 3);
+
+    mmanager_allocator<double> doubles;
+    double *numbers = doubles.allocate(1);
+    TEST_ASSERT_EQUAL_UINT64(0, reinterpret_cast<uintptr_t>(numbers) % alignof(double));
+    doubles.deallocate(numbers, 1);
+
+    deallocate(odd);
+}
+TEST(mmry_alloc_allocator, Exhausted) {
+    mmanager_allocator<char> allocator;
+    bool thrown = false;
+    try {
+        allocator.allocate(MMRY_ALLOC_SIZE);
+    }
+    catch (const std::bad_alloc &) {
+        thrown = true;
+    }
+    TEST_ASSERT_TRUE(thrown);
+
+    thrown = false;
+    try {
+        mmanager_allocator<wide>().allocate(SIZE_MAX / 2);
+    }
+    catch (const std::bad_array_new_length &) {
+        thrown = true;
+    }
+    TEST_ASSERT_TRUE(thrown);
+}
+TEST(mmry_alloc_allocator, MemoryResource) {
+    size_t available = mmanager_available_memory();
+    {
+        std::pmr::unordered_map<int, std::pmr::string> map(mmanager_get_memory_resource());
+        for (int i = 0; i < 100; ++i) {
+            map.emplace(i, std::string(100, 'a' + i % 26));
+        }
+        TEST_ASSERT_EQUAL_STRING(std::string(100, 'a' + 42 % 26).c_str(), map.at(42).c_str());
+        TEST_ASSERT_TRUE(mmanager_available_memory() < available);
+    }
+    TEST_ASSERT_EQUAL_size_t(available, mmanager_available_memory());
+
+    mmanager_memory_resource other;
+    TEST_ASSERT_TRUE(other == *mmanager_get_memory_resource());
+    TEST_ASSERT_FALSE(other == *std::pmr::new_delete_resource());
+}
+TEST(mmry_alloc_allocator, MemoryResourceAlignment) {
+    std::pmr::memory_resource *resource = mmanager_get_memory_resource();
+    for (size_t alignment = 1; alignment <= 4096; alignment *= 2) {
+        void *ptr = resource->allocate(24, alignment);
+        TEST_ASSERT_EQUAL_UINT64(0, reinterpret_cast<uintptr_t>(ptr) % alignment);
+        resource->deallocate(ptr, 24, alignment);
+    }
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
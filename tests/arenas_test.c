@@ -0,0 +1,143 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+
+#define HEADER_SIZE 16
+#define N_ARENAS 4
+#define ARENA_SIZE 4096
+#define MMRY_ALLOC_SIZE (N_ARENAS * ARENA_SIZE)
+
+// Start of some arena; arenas are numbered relative to it.
+static char *anchor;
+
+// Returns the number of the arena `ptr` was allocated from, relative to `anchor`.
+static long arena_of(void *ptr);
+
+// Allocates a block of 64 bytes and stores it in `*(void **)arg`.
+static void *allocate_thread(void *arg);
+
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_arenas);
+TEST_SETUP(mmry_alloc_arenas) {
+    struct mmanager_options options = {
+        MMRY_ALLOC_SIZE, FIRST_FIT, 0, N_ARENAS, MMANAGER_ARENA_ROUND_ROBIN
+    };
+    mmanager_initialize_with_options(&options);
+
+    // A block filling a whole arena starts right after the arena's first header.
+    void *whole = allocate(ARENA_SIZE - HEADER_SIZE);
+    anchor = (char *)whole - HEADER_SIZE;
+    deallocate(whole);
+}
+TEST_TEAR_DOWN(mmry_alloc_arenas) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_arenas) {
+    RUN_TEST_CASE(mmry_alloc_arenas, Initial);
+    RUN_TEST_CASE(mmry_alloc_arenas, ThreadsUseDifferentArenas);
+    RUN_TEST_CASE(mmry_alloc_arenas, FullArenaFallsBack);
+    RUN_TEST_CASE(mmry_alloc_arenas, ReallocateAcrossArenas);
+    RUN_TEST_CASE(mmry_alloc_arenas, Stats);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_arenas);
+}
+
+// Tests.
+TEST(mmry_alloc_arenas, Initial) {
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - N_ARENAS * HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_arenas, ThreadsUseDifferentArenas) {
+    void *ptrs[N_ARENAS];
+    pthread_t threads[N_ARENAS];
+    for (int i = 0; i < N_ARENAS; ++i) {
+        pthread_create(&threads[i], NULL, allocate_thread, &ptrs[i]);
+        pthread_join(threads[i], NULL);
+    }
+
+    // Round-robin assignment gives consecutive threads consecutive arenas.
+    for (int i = 0; i < N_ARENAS; ++i) {
+        TEST_ASSERT_NOT_NULL(ptrs[i]);
+        for (int j = 0; j < i; ++j) {
+            TEST_ASSERT_TRUE(arena_of(ptrs[i]) != arena_of(ptrs[j]));
+        }
+    }
+
+    // Blocks freed by this thread go back to the arenas they came from.
+    for (int i = 0; i < N_ARENAS; ++i) {
+        deallocate(ptrs[i]);
+    }
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - N_ARENAS * HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_arenas, FullArenaFallsBack) {
+    void *first = allocate(ARENA_SIZE - HEADER_SIZE);
+    TEST_ASSERT_NOT_NULL(first);
+
+    // The home arena is full, so this comes from another one.
+    void *second = allocate(64);
+    TEST_ASSERT_NOT_NULL(second);
+    TEST_ASSERT_TRUE(arena_of(first) != arena_of(second));
+
+    // No arena can hold more than its own size.
+    TEST_ASSERT_NULL(allocate(ARENA_SIZE));
+
+    deallocate(first);
+    deallocate(second);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - N_ARENAS * HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_arenas, ReallocateAcrossArenas) {
+    char *ptr = allocate(64);
+    void *filler = allocate(ARENA_SIZE - 3 * HEADER_SIZE - 64 - 256);
+    TEST_ASSERT_EQUAL_INT64(arena_of(ptr), arena_of(filler));
+    memset(ptr, 'x', 64);
+
+    // Too big for the rest of the arena.
+    char *new_ptr = reallocate(ptr, 1024);
+    TEST_ASSERT_NOT_NULL(new_ptr);
+    TEST_ASSERT_TRUE(arena_of(new_ptr) != arena_of(filler));
+    TEST_ASSERT_EACH_EQUAL_CHAR('x', new_ptr, 64);
+
+    deallocate(new_ptr);
+    deallocate(filler);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - N_ARENAS * HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_arenas, Stats) {
+    void *ptrs[N_ARENAS];
+    pthread_t threads[N_ARENAS];
+    for (int i = 0; i < N_ARENAS; ++i) {
+        pthread_create(&threads[i], NULL, allocate_thread, &ptrs[i]);
+        pthread_join(threads[i], NULL);
+    }
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE, stats.arena_size);
+    TEST_ASSERT_EQUAL_size_t(N_ARENAS * 64, stats.allocated_bytes);
+    TEST_ASSERT_EQUAL_size_t(N_ARENAS, stats.allocated_blocks);
+    TEST_ASSERT_EQUAL_size_t(N_ARENAS, stats.free_blocks);
+    TEST_ASSERT_EQUAL_size_t(ARENA_SIZE - 2 * HEADER_SIZE - 64, stats.largest_free_block);
+
+    for (int i = 0; i < N_ARENAS; ++i) {
+        deallocate(ptrs[i]);
+    }
+}
+
+static long arena_of(void *ptr) {
+    long offset = (char *)ptr - anchor;
+    return offset >= 0 ? offset / ARENA_SIZE : (offset - ARENA_SIZE + 1) / ARENA_SIZE;
+}
+
+static void *allocate_thread(void *arg) {
+    *(void **)arg = allocate(64);
+    return NULL;
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
@@ -0,0 +1,168 @@
+#include <new>
+#include <thread>
+#include <vector>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "basic_mmanager.hpp"
+
+
+#define HEADER_SIZE 16
+#define MMRY_ALLOC_SIZE 2048
+
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_basic_mmanager);
+TEST_SETUP(mmry_alloc_basic_mmanager) {
+}
+TEST_TEAR_DOWN(mmry_alloc_basic_mmanager) {
+}
+TEST_GROUP_RUNNER(mmry_alloc_basic_mmanager) {
+    RUN_TEST_CASE(mmry_alloc_basic_mmanager, HeaderLayout);
+    RUN_TEST_CASE(mmry_alloc_basic_mmanager, FirstFit);
+    RUN_TEST_CASE(mmry_alloc_basic_mmanager, BestFit);
+    RUN_TEST_CASE(mmry_alloc_basic_mmanager, BestFitTie);
+    RUN_TEST_CASE(mmry_alloc_basic_mmanager, WorstFit);
+    RUN_TEST_CASE(mmry_alloc_basic_mmanager, WorstFitTie);
+    RUN_TEST_CASE(mmry_alloc_basic_mmanager, WorstFitTakesExactFit);
+    RUN_TEST_CASE(mmry_alloc_basic_mmanager, ArenaTooSmall);
+    RUN_TEST_CASE(mmry_alloc_basic_mmanager, Exhausted);
+    RUN_TEST_CASE(mmry_alloc_basic_mmanager, CountingStats);
+    RUN_TEST_CASE(mmry_alloc_basic_mmanager, SpinLockThreads);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_basic_mmanager);
+}
+
+// Leaves free blocks of 64, 32 and 128 bytes (in address order) and returns
+// the addresses at which they start.
+template <class Heap>
+static std::vector<void *> make_holes(Heap &heap) {
+    std::vector<void *> holes;
+    size_t sizes[] = { 64, 32, 128 };
+    std::vector<void *> blockers;
+    for (size_t size : sizes) {
+        holes.push_back(heap.allocate(size));
+        blockers.push_back(heap.allocate(16));
+    }
+    for (void *hole : holes) {
+        heap.deallocate(hole);
+    }
+    return holes;
+}
+
+// Leaves two free blocks of `size` bytes, separated by an allocated block, and
+// fills the rest of the arena. Returns the addresses at which they start.
+template <class Heap>
+static std::vector<void *> make_equal_holes(Heap &heap, size_t size) {
+    std::vector<void *> holes;
+    holes.push_back(heap.allocate(size));
+    heap.allocate(16);
+    holes.push_back(heap.allocate(size));
+    heap.allocate(heap.available_memory() - HEADER_SIZE);
+    for (void *hole : holes) {
+        heap.deallocate(hole);
+    }
+    return holes;
+}
+
+// Tests.
+TEST(mmry_alloc_basic_mmanager, HeaderLayout) {
+    TEST_ASSERT_EQUAL_size_t(HEADER_SIZE, sizeof(mmanager_header));
+}
+TEST(mmry_alloc_basic_mmanager, FirstFit) {
+    basic_mmanager<mmanager_first_fit, mmanager_no_lock> heap(MMRY_ALLOC_SIZE);
+    void *ptr1 = heap.allocate(8);
+    void *ptr2 = heap.allocate(8);
+    TEST_ASSERT_EQUAL_PTR((char *)ptr1 + 8 + HEADER_SIZE, ptr2);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - 3 * HEADER_SIZE - 16, heap.available_memory());
+
+    heap.deallocate(ptr1);
+    heap.deallocate(ptr2);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - HEADER_SIZE, heap.available_memory());
+
+    basic_mmanager<mmanager_first_fit, mmanager_no_lock> holes_heap(MMRY_ALLOC_SIZE);
+    std::vector<void *> holes = make_holes(holes_heap);
+    TEST_ASSERT_EQUAL_PTR(holes[0], holes_heap.allocate(24));
+}
+TEST(mmry_alloc_basic_mmanager, BestFit) {
+    basic_mmanager<mmanager_best_fit, mmanager_no_lock> heap(MMRY_ALLOC_SIZE);
+    std::vector<void *> holes = make_holes(heap);
+    TEST_ASSERT_EQUAL_PTR(holes[1], heap.allocate(24));
+}
+TEST(mmry_alloc_basic_mmanager, BestFitTie) {
+    basic_mmanager<mmanager_best_fit, mmanager_no_lock> heap(MMRY_ALLOC_SIZE);
+    std::vector<void *> holes = make_equal_holes(heap, 64);
+    TEST_ASSERT_EQUAL_PTR(holes[0], heap.allocate(24));
+}
+TEST(mmry_alloc_basic_mmanager, WorstFit) {
+    basic_mmanager<mmanager_worst_fit, mmanager_no_lock> heap(MMRY_ALLOC_SIZE);
+    std::vector<void *> holes = make_holes(heap);
+    void *ptr = heap.allocate(24);
+    // The tail of the arena is the largest free block.
+    TEST_ASSERT_TRUE(ptr > holes[2]);
+}
+TEST(mmry_alloc_basic_mmanager, WorstFitTie) {
+    basic_mmanager<mmanager_worst_fit, mmanager_no_lock> heap(MMRY_ALLOC_SIZE);
+    std::vector<void *> holes = make_equal_holes(heap, 64);
+    TEST_ASSERT_EQUAL_PTR(holes[0], heap.allocate(24));
+}
+TEST(mmry_alloc_basic_mmanager, WorstFitTakesExactFit) {
+    // WORST_FIT in mmanager.c fails here.
+    basic_mmanager<mmanager_worst_fit, mmanager_no_lock> heap(MMRY_ALLOC_SIZE);
+    void *ptr = heap.allocate(MMRY_ALLOC_SIZE - HEADER_SIZE);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_size_t(0, heap.available_memory());
+    heap.deallocate(ptr);
+}
+TEST(mmry_alloc_basic_mmanager, ArenaTooSmall) {
+    bool thrown = false;
+    try {
+        basic_mmanager<> heap(HEADER_SIZE);
+    }
+    catch (const std::bad_alloc &) {
+        thrown = true;
+    }
+    TEST_ASSERT_TRUE(thrown);
+}
+TEST(mmry_alloc_basic_mmanager, Exhausted) {
+    basic_mmanager<> heap(MMRY_ALLOC_SIZE);
+    TEST_ASSERT_NULL(heap.allocate(MMRY_ALLOC_SIZE));
+    void *ptr = heap.allocate(MMRY_ALLOC_SIZE - HEADER_SIZE);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_size_t(0, heap.available_memory());
+    heap.deallocate(ptr);
+}
+TEST(mmry_alloc_basic_mmanager, CountingStats) {
+    basic_mmanager<mmanager_first_fit, mmanager_no_lock, mmanager_header, mmanager_counting_stats> heap(
+        MMRY_ALLOC_SIZE);
+    void *ptr1 = heap.allocate(64);
+    void *ptr2 = heap.allocate(32);
+    heap.deallocate(ptr1);
+
+    TEST_ASSERT_EQUAL_size_t(32, heap.stats().allocated_bytes);
+    TEST_ASSERT_EQUAL_size_t(1, heap.stats().allocated_blocks);
+    TEST_ASSERT_EQUAL_size_t(96, heap.stats().peak_allocated_bytes);
+    TEST_ASSERT_EQUAL_size_t(2 * HEADER_SIZE + 64 + 32, heap.stats().heap_high_water);
+
+    heap.deallocate(ptr2);
+}
+TEST(mmry_alloc_basic_mmanager, SpinLockThreads) {
+    basic_mmanager<mmanager_first_fit, mmanager_spin_lock> heap(1 << 20);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&heap] {
+            for (int j = 0; j < 10000; ++j) {
+                heap.deallocate(heap.allocate(16 + j % 64));
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    TEST_ASSERT_EQUAL_size_t((1 << 20) - HEADER_SIZE, heap.available_memory());
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
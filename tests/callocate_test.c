@@ -0,0 +1,137 @@
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+
+#define HEADER_SIZE 16
+#define FREE_POISON 0xdd
+#define MMRY_ALLOC_SIZE (1024 * 1024)
+#define BLOCK_SIZE 64
+#define LARGE_BLOCK_SIZE (512 * 1024)
+
+
+// Returns the number of pages of [ptr, ptr + size) that are resident.
+static size_t resident_pages(void *ptr, size_t size) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)ptr + page_size - 1) & ~(page_size - 1);
+    uintptr_t end = ((uintptr_t)ptr + size) & ~(page_size - 1);
+    unsigned char pages[LARGE_BLOCK_SIZE / 4096 + 1];
+    size_t n_pages = (end - start) / page_size;
+    TEST_ASSERT_TRUE(n_pages <= sizeof(pages));
+    TEST_ASSERT_EQUAL_INT(0, mincore((void *)start, end - start, pages));
+
+    size_t resident = 0;
+    for (size_t i = 0; i < n_pages; ++i) {
+        resident += pages[i] & 1;
+    }
+    return resident;
+}
+
+static void assert_zero(const unsigned char *ptr, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (ptr[i] != 0) {
+            TEST_FAIL_MESSAGE("memory is not zero");
+        }
+    }
+}
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_callocate);
+TEST_SETUP(mmry_alloc_callocate) {
+    struct mmanager_options options = {
+        .size = MMRY_ALLOC_SIZE,
+        .allocation_policy = FIRST_FIT,
+        .flags = MMANAGER_POISON_FREE,
+    };
+    mmanager_initialize_with_options(&options);
+}
+TEST_TEAR_DOWN(mmry_alloc_callocate) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_callocate) {
+    RUN_TEST_CASE(mmry_alloc_callocate, OverflowReturnsNull);
+    RUN_TEST_CASE(mmry_alloc_callocate, FailureReturnsNull);
+    RUN_TEST_CASE(mmry_alloc_callocate, ReusedMemoryIsZeroed);
+    RUN_TEST_CASE(mmry_alloc_callocate, StaleHeadersAreZeroed);
+    RUN_TEST_CASE(mmry_alloc_callocate, UntouchedMemoryIsNotWritten);
+    RUN_TEST_CASE(mmry_alloc_callocate, TrimmedMemoryIsNotWritten);
+    RUN_TEST_CASE(mmry_alloc_callocate, PoisonedTailIsZeroed);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_callocate);
+}
+
+// Tests.
+TEST(mmry_alloc_callocate, OverflowReturnsNull) {
+    size_t available = mmanager_available_memory();
+    TEST_ASSERT_NULL(callocate(SIZE_MAX / 2 + 1, 2));
+    TEST_ASSERT_NULL(callocate((size_t)1 << 33, (size_t)1 << 33));
+    TEST_ASSERT_EQUAL_size_t(available, mmanager_available_memory());
+}
+TEST(mmry_alloc_callocate, FailureReturnsNull) {
+    TEST_ASSERT_NULL(callocate(2, MMRY_ALLOC_SIZE));
+}
+TEST(mmry_alloc_callocate, ReusedMemoryIsZeroed) {
+    unsigned char *ptr = allocate(BLOCK_SIZE);
+    allocate(BLOCK_SIZE);
+    memset(ptr, 'a', BLOCK_SIZE);
+    deallocate(ptr);
+
+    unsigned char *zeroed = callocate(BLOCK_SIZE / 8, 8);
+    TEST_ASSERT_EQUAL_PTR(ptr, zeroed);
+    assert_zero(zeroed, BLOCK_SIZE);
+}
+TEST(mmry_alloc_callocate, StaleHeadersAreZeroed) {
+    // Both blocks and the header between them are merged into the rest of the
+    // arena, part of which was never written.
+    unsigned char *first = allocate(BLOCK_SIZE);
+    unsigned char *second = allocate(BLOCK_SIZE);
+    memset(first, 'a', BLOCK_SIZE);
+    memset(second, 'b', BLOCK_SIZE);
+    deallocate(second);
+    deallocate(first);
+
+    unsigned char *zeroed = callocate(4, BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_PTR(first, zeroed);
+    assert_zero(zeroed, 4 * BLOCK_SIZE);
+}
+TEST(mmry_alloc_callocate, UntouchedMemoryIsNotWritten) {
+    allocate(BLOCK_SIZE);
+    unsigned char *ptr = callocate(1, LARGE_BLOCK_SIZE);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_size_t(0, resident_pages(ptr, LARGE_BLOCK_SIZE));
+    assert_zero(ptr, LARGE_BLOCK_SIZE);
+}
+TEST(mmry_alloc_callocate, TrimmedMemoryIsNotWritten) {
+    unsigned char *ptr = allocate(LARGE_BLOCK_SIZE);
+    memset(ptr, 'a', LARGE_BLOCK_SIZE);
+    deallocate(ptr);
+    mmanager_maintain();
+
+    unsigned char *zeroed = callocate(1, LARGE_BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_PTR(ptr, zeroed);
+    // Only the partial pages at both ends are cleared.
+    TEST_ASSERT_EQUAL_size_t(0, resident_pages(zeroed, LARGE_BLOCK_SIZE));
+    assert_zero(zeroed, LARGE_BLOCK_SIZE);
+}
+TEST(mmry_alloc_callocate, PoisonedTailIsZeroed) {
+    // Compaction poisons the free tail of the arena, including memory that
+    // was never written before.
+    void *first = allocate(BLOCK_SIZE);
+    allocate(BLOCK_SIZE);
+    deallocate(first);
+    TEST_ASSERT_EQUAL_size_t(1, mmanager_compact(NULL, NULL));
+
+    unsigned char *zeroed = callocate(1, LARGE_BLOCK_SIZE);
+    TEST_ASSERT_NOT_NULL(zeroed);
+    assert_zero(zeroed, LARGE_BLOCK_SIZE);
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
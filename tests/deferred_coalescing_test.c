@@ -0,0 +1,120 @@
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+
+#define HEADER_SIZE 16
+#define MMRY_ALLOC_SIZE 4096
+#define BLOCK_SIZE 32
+#define COALESCE_THRESHOLD 4
+
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_deferred_coalescing);
+TEST_SETUP(mmry_alloc_deferred_coalescing) {
+    struct mmanager_options options = {
+        .size = MMRY_ALLOC_SIZE,
+        .allocation_policy = FIRST_FIT,
+        .flags = MMANAGER_DEFERRED_COALESCING,
+        .coalesce_threshold = COALESCE_THRESHOLD,
+    };
+    mmanager_initialize_with_options(&options);
+}
+TEST_TEAR_DOWN(mmry_alloc_deferred_coalescing) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_deferred_coalescing) {
+    RUN_TEST_CASE(mmry_alloc_deferred_coalescing, SameSizeIsReused);
+    RUN_TEST_CASE(mmry_alloc_deferred_coalescing, SameSizeClassIsReused);
+    RUN_TEST_CASE(mmry_alloc_deferred_coalescing, TooSmallBlockIsSkipped);
+    RUN_TEST_CASE(mmry_alloc_deferred_coalescing, FailedAllocationCoalesces);
+    RUN_TEST_CASE(mmry_alloc_deferred_coalescing, ThresholdCoalesces);
+    RUN_TEST_CASE(mmry_alloc_deferred_coalescing, StatisticsIncludeDeferredFrees);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_deferred_coalescing);
+}
+
+// Tests.
+TEST(mmry_alloc_deferred_coalescing, SameSizeIsReused) {
+    void *first = allocate(BLOCK_SIZE);
+    void *second = allocate(BLOCK_SIZE);
+    void *third = allocate(BLOCK_SIZE);
+    deallocate(first);
+    deallocate(third);
+
+    // The last freed block of the size class comes back first, where first
+    // fit would have returned `first`.
+    TEST_ASSERT_EQUAL_PTR(third, allocate(BLOCK_SIZE));
+    TEST_ASSERT_EQUAL_PTR(first, allocate(BLOCK_SIZE));
+    (void)second;
+}
+TEST(mmry_alloc_deferred_coalescing, SameSizeClassIsReused) {
+    void *ptr = allocate(BLOCK_SIZE);
+    allocate(BLOCK_SIZE);
+    deallocate(ptr);
+
+    void *reused = allocate(BLOCK_SIZE - 8);
+    TEST_ASSERT_EQUAL_PTR(ptr, reused);
+    TEST_ASSERT_EQUAL_size_t(BLOCK_SIZE, mmanager_usable_size(reused));
+}
+TEST(mmry_alloc_deferred_coalescing, TooSmallBlockIsSkipped) {
+    void *ptr = allocate(BLOCK_SIZE - 8);
+    allocate(BLOCK_SIZE);
+    deallocate(ptr);
+
+    void *other = allocate(BLOCK_SIZE);
+    TEST_ASSERT_TRUE(other != ptr);
+}
+TEST(mmry_alloc_deferred_coalescing, FailedAllocationCoalesces) {
+    // Fill the whole arena with small blocks.
+    void *ptrs[MMRY_ALLOC_SIZE / (HEADER_SIZE + BLOCK_SIZE)];
+    size_t n_blocks = sizeof(ptrs) / sizeof(*ptrs);
+    for (size_t i = 0; i < n_blocks; ++i) {
+        ptrs[i] = allocate(BLOCK_SIZE);
+        TEST_ASSERT_NOT_NULL(ptrs[i]);
+    }
+
+    // Freeing fewer blocks than the threshold leaves them queued, and only
+    // their merge fits the next request.
+    for (size_t i = 0; i < COALESCE_THRESHOLD - 1; ++i) {
+        deallocate(ptrs[i]);
+    }
+    void *merged = allocate(2 * BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_PTR(ptrs[0], merged);
+}
+TEST(mmry_alloc_deferred_coalescing, ThresholdCoalesces) {
+    void *ptrs[COALESCE_THRESHOLD];
+    for (int i = 0; i < COALESCE_THRESHOLD; ++i) {
+        ptrs[i] = allocate(BLOCK_SIZE);
+    }
+    allocate(BLOCK_SIZE);
+    for (int i = 0; i < COALESCE_THRESHOLD; ++i) {
+        deallocate(ptrs[i]);
+    }
+
+    // The quick lists were merged into one free block at the start of the
+    // arena, which first fit now splits.
+    void *large = allocate(COALESCE_THRESHOLD * BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_PTR(ptrs[0], large);
+}
+TEST(mmry_alloc_deferred_coalescing, StatisticsIncludeDeferredFrees) {
+    void *ptrs[COALESCE_THRESHOLD - 1];
+    for (int i = 0; i < COALESCE_THRESHOLD - 1; ++i) {
+        ptrs[i] = allocate(BLOCK_SIZE);
+    }
+    for (int i = 0; i < COALESCE_THRESHOLD - 1; ++i) {
+        deallocate(ptrs[i]);
+    }
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(0, stats.allocated_blocks);
+    TEST_ASSERT_EQUAL_size_t(1, stats.free_blocks);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - HEADER_SIZE, mmanager_available_memory());
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
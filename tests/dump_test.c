@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+#include "mmanager_dump.h"
+
+
+#define HEADER_SIZE 16
+#define MMRY_ALLOC_SIZE 2048
+#define MAX_RECORDS 16
+#define N 6
+#define LARGE_ALLOC_SIZE (1024 * 1024)
+#define MANY_BLOCKS 10000
+
+static struct mmanager_dump_header dump_header;
+static struct mmanager_dump_record records[MAX_RECORDS];
+
+// Dumps the heap to a temporary file, reads it back into `dump_header`/`records`
+// and returns the number of records.
+static size_t dump_and_read(void);
+
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_dump);
+TEST_SETUP(mmry_alloc_dump) {
+    mmanager_initialize(MMRY_ALLOC_SIZE, FIRST_FIT);
+}
+TEST_TEAR_DOWN(mmry_alloc_dump) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_dump) {
+    RUN_TEST_CASE(mmry_alloc_dump, EmptyHeap);
+    RUN_TEST_CASE(mmry_alloc_dump, MixedBlocks);
+    RUN_TEST_CASE(mmry_alloc_dump, ManyBlocks);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_dump);
+}
+
+// Tests.
+TEST(mmry_alloc_dump, EmptyHeap) {
+    TEST_ASSERT_EQUAL_size_t(1, dump_and_read());
+    TEST_ASSERT_EQUAL_MEMORY(MMANAGER_DUMP_MAGIC, dump_header.magic, sizeof(MMANAGER_DUMP_MAGIC));
+    TEST_ASSERT_EQUAL_UINT64(MMRY_ALLOC_SIZE, dump_header.arena_size);
+    TEST_ASSERT_EQUAL_UINT64(HEADER_SIZE, dump_header.header_size);
+
+    TEST_ASSERT_EQUAL_UINT64(0, records[0].offset);
+    TEST_ASSERT_EQUAL_UINT64(MMRY_ALLOC_SIZE - HEADER_SIZE, MMANAGER_DUMP_SIZE(&records[0]));
+    TEST_ASSERT_EQUAL_INT(MMANAGER_DUMP_FREE, MMANAGER_DUMP_STATE(&records[0]));
+}
+TEST(mmry_alloc_dump, MixedBlocks) {
+    void *ptrs[N];
+    for (int i = 0; i < N; ++i) {
+        ptrs[i] = allocate(8 * (i + 1));
+    }
+    deallocate(ptrs[1]);
+    deallocate(ptrs[4]);
+
+    // Blocks: A(8) F(16) A(24) A(32) F(40) A(48) F(rest).
+    TEST_ASSERT_EQUAL_size_t(N + 1, dump_and_read());
+    uint64_t offset = 0;
+    uint64_t total = 0;
+    for (int i = 0; i <= N; ++i) {
+        TEST_ASSERT_EQUAL_UINT64(offset, records[i].offset);
+        uint64_t size = MMANAGER_DUMP_SIZE(&records[i]);
+        if (i < N) {
+            TEST_ASSERT_EQUAL_UINT64(8 * (i + 1), size);
+        }
+        enum mmanager_dump_state expected = (i == 1 || i == 4 || i == N)
+            ? MMANAGER_DUMP_FREE : MMANAGER_DUMP_ALLOCATED;
+        TEST_ASSERT_EQUAL_INT(expected, MMANAGER_DUMP_STATE(&records[i]));
+        offset += HEADER_SIZE + size;
+        total += HEADER_SIZE + size;
+    }
+    TEST_ASSERT_EQUAL_UINT64(MMRY_ALLOC_SIZE, total);
+}
+
+TEST(mmry_alloc_dump, ManyBlocks) {
+    // More blocks than the first snapshot is mapped for.
+    mmanager_destroy();
+    mmanager_initialize(LARGE_ALLOC_SIZE, FIRST_FIT);
+    for (int i = 0; i < MANY_BLOCKS; ++i) {
+        TEST_ASSERT_NOT_NULL(allocate(16));
+    }
+
+    FILE *file = tmpfile();
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_EQUAL_INT(0, mmanager_dump(fileno(file)));
+    rewind(file);
+    TEST_ASSERT_EQUAL_size_t(1, fread(&dump_header, sizeof(dump_header), 1, file));
+
+    size_t n = 0;
+    uint64_t offset = 0;
+    struct mmanager_dump_record record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        TEST_ASSERT_EQUAL_UINT64(offset, record.offset);
+        offset += HEADER_SIZE + MMANAGER_DUMP_SIZE(&record);
+        ++n;
+    }
+    fclose(file);
+    TEST_ASSERT_EQUAL_size_t(MANY_BLOCKS + 1, n);
+    TEST_ASSERT_EQUAL_UINT64(LARGE_ALLOC_SIZE, offset);
+}
+
+static size_t dump_and_read(void) {
+    FILE *file = tmpfile();
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_EQUAL_INT(0, mmanager_dump(fileno(file)));
+
+    rewind(file);
+    TEST_ASSERT_EQUAL_size_t(1, fread(&dump_header, sizeof(dump_header), 1, file));
+    size_t n = fread(records, sizeof(*records), MAX_RECORDS, file);
+    fclose(file);
+    return n;
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
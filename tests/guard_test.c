@@ -0,0 +1,284 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+
+#define MMRY_ALLOC_SIZE (64 * 1024)
+#define GUARD_SLOTS 4
+#define BLOCK_SIZE 100
+#define ROUNDED_BLOCK_SIZE 112
+
+// AddressSanitizer takes over SIGSEGV and reports the deliberate faults itself.
+#ifdef __SANITIZE_ADDRESS__
+#define SKIP_UNDER_ASAN() TEST_IGNORE_MESSAGE("reported by AddressSanitizer")
+#else
+#define SKIP_UNDER_ASAN()
+#endif
+
+// Runs `body` in a child process and returns the signal that killed it, or 0
+// if it exited normally.
+static int child_signal(void (*body)(void)) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Keep the report of the expected fault out of the test output.
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDERR_FILENO);
+        body();
+        _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+}
+
+// Runs `body` in a child process, collects what it writes to stderr in
+// `report`, and returns whether it was killed by SIGSEGV.
+static bool child_faults_with_report(void (*body)(void), char *report, size_t size) {
+    int fds[2];
+    TEST_ASSERT_EQUAL_INT(0, pipe(fds));
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDERR_FILENO);
+        body();
+        _exit(0);
+    }
+    close(fds[1]);
+
+    size_t length = 0;
+    ssize_t n;
+    while (length + 1 < size && (n = read(fds[0], report + length, size - 1 - length)) > 0) {
+        length += (size_t)n;
+    }
+    report[length] = '\0';
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV;
+}
+
+static char *foreign_page;
+
+// An application handler that maps in `foreign_page` on demand and leaves
+// every other fault to the default action.
+static void foreign_fault_handler(int signal, siginfo_t *info, void *context) {
+    (void)context;
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    char *address = info->si_addr;
+    if (address >= foreign_page && address < foreign_page + page_size) {
+        mprotect(foreign_page, page_size, PROT_READ | PROT_WRITE);
+        return;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    sigemptyset(&action.sa_mask);
+    sigaction(signal, &action, NULL);
+}
+
+static void overflow(void) {
+    char *ptr = allocate(BLOCK_SIZE);
+    ptr[ROUNDED_BLOCK_SIZE] = 'x';
+}
+
+static void use_after_free(void) {
+    volatile char *ptr = allocate(BLOCK_SIZE);
+    ptr[0] = 'x';
+    deallocate((void *)ptr);
+    ptr[0] = 'y';
+}
+
+static void double_free(void) {
+    void *ptr = allocate(BLOCK_SIZE);
+    deallocate(ptr);
+    deallocate(ptr);
+}
+
+// Faults once under the application's handler, then overflows a guarded block.
+static void foreign_fault_then_overflow(void) {
+    mmanager_destroy();
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    foreign_page = mmap(NULL, page_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = foreign_fault_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, NULL);
+
+    struct mmanager_options options = {
+        .size = MMRY_ALLOC_SIZE,
+        .allocation_policy = FIRST_FIT,
+        .guard_sample_rate = 1,
+        .guard_slots = GUARD_SLOTS,
+    };
+    mmanager_initialize_with_options(&options);
+    ((volatile char *)foreign_page)[0] = 'x';
+    overflow();
+}
+
+static void in_bounds(void) {
+    char *ptr = allocate(BLOCK_SIZE);
+    memset(ptr, 'x', ROUNDED_BLOCK_SIZE);
+    deallocate(ptr);
+}
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_guard);
+TEST_SETUP(mmry_alloc_guard) {
+    struct mmanager_options options = {
+        .size = MMRY_ALLOC_SIZE,
+        .allocation_policy = FIRST_FIT,
+        .guard_sample_rate = 1,
+        .guard_slots = GUARD_SLOTS,
+    };
+    mmanager_initialize_with_options(&options);
+}
+TEST_TEAR_DOWN(mmry_alloc_guard) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_guard) {
+    RUN_TEST_CASE(mmry_alloc_guard, BlockEndsAtPageEnd);
+    RUN_TEST_CASE(mmry_alloc_guard, InBoundsAccessIsFine);
+    RUN_TEST_CASE(mmry_alloc_guard, OverflowFaults);
+    RUN_TEST_CASE(mmry_alloc_guard, UseAfterFreeFaults);
+    RUN_TEST_CASE(mmry_alloc_guard, DoubleFreeAborts);
+    RUN_TEST_CASE(mmry_alloc_guard, FullRegionFallsBackToArena);
+    RUN_TEST_CASE(mmry_alloc_guard, LargeBlocksAreNotGuarded);
+    RUN_TEST_CASE(mmry_alloc_guard, Reallocate);
+    RUN_TEST_CASE(mmry_alloc_guard, CallocateZeroesReusedSlot);
+    RUN_TEST_CASE(mmry_alloc_guard, ZeroSizeBlock);
+    RUN_TEST_CASE(mmry_alloc_guard, ForeignFaultKeepsDetection);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_guard);
+}
+
+// Tests.
+TEST(mmry_alloc_guard, BlockEndsAtPageEnd) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    char *ptr = allocate(BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_UINT64(0, ((uintptr_t)ptr + ROUNDED_BLOCK_SIZE) % page_size);
+    TEST_ASSERT_EQUAL_size_t(ROUNDED_BLOCK_SIZE, mmanager_usable_size(ptr));
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(1, stats.guarded_blocks);
+    TEST_ASSERT_EQUAL_size_t(0, stats.allocated_blocks);
+
+    deallocate(ptr);
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(0, stats.guarded_blocks);
+}
+TEST(mmry_alloc_guard, InBoundsAccessIsFine) {
+    TEST_ASSERT_EQUAL_INT(0, child_signal(in_bounds));
+}
+TEST(mmry_alloc_guard, OverflowFaults) {
+    SKIP_UNDER_ASAN();
+    TEST_ASSERT_EQUAL_INT(SIGSEGV, child_signal(overflow));
+}
+TEST(mmry_alloc_guard, UseAfterFreeFaults) {
+    SKIP_UNDER_ASAN();
+    TEST_ASSERT_EQUAL_INT(SIGSEGV, child_signal(use_after_free));
+}
+TEST(mmry_alloc_guard, DoubleFreeAborts) {
+    TEST_ASSERT_EQUAL_INT(SIGABRT, child_signal(double_free));
+}
+TEST(mmry_alloc_guard, FullRegionFallsBackToArena) {
+    void *ptrs[GUARD_SLOTS + 1];
+    for (int i = 0; i < GUARD_SLOTS + 1; ++i) {
+        ptrs[i] = allocate(BLOCK_SIZE);
+        TEST_ASSERT_NOT_NULL(ptrs[i]);
+    }
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(GUARD_SLOTS, stats.guarded_blocks);
+    TEST_ASSERT_EQUAL_size_t(1, stats.allocated_blocks);
+
+    for (int i = 0; i < GUARD_SLOTS + 1; ++i) {
+        deallocate(ptrs[i]);
+    }
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(0, stats.guarded_blocks);
+    TEST_ASSERT_EQUAL_size_t(0, stats.allocated_blocks);
+}
+TEST(mmry_alloc_guard, LargeBlocksAreNotGuarded) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    void *ptr = allocate(page_size + 1);
+    TEST_ASSERT_NOT_NULL(ptr);
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(0, stats.guarded_blocks);
+    TEST_ASSERT_EQUAL_size_t(1, stats.allocated_blocks);
+    deallocate(ptr);
+}
+TEST(mmry_alloc_guard, Reallocate) {
+    char *ptr = allocate(BLOCK_SIZE);
+    memset(ptr, 'r', BLOCK_SIZE);
+
+    char *new_ptr = reallocate(ptr, 2 * BLOCK_SIZE);
+    TEST_ASSERT_NOT_NULL(new_ptr);
+    TEST_ASSERT_TRUE(new_ptr != ptr);
+    for (int i = 0; i < BLOCK_SIZE; ++i) {
+        TEST_ASSERT_EQUAL_CHAR('r', new_ptr[i]);
+    }
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(1, stats.guarded_blocks);
+    deallocate(new_ptr);
+}
+TEST(mmry_alloc_guard, CallocateZeroesReusedSlot) {
+    // Go around all slots so that the first one is used again.
+    for (int i = 0; i < GUARD_SLOTS; ++i) {
+        char *ptr = allocate(BLOCK_SIZE);
+        memset(ptr, 'x', BLOCK_SIZE);
+        deallocate(ptr);
+    }
+    char *zeroed = callocate(1, BLOCK_SIZE);
+    for (int i = 0; i < BLOCK_SIZE; ++i) {
+        TEST_ASSERT_EQUAL_CHAR(0, zeroed[i]);
+    }
+    deallocate(zeroed);
+}
+
+TEST(mmry_alloc_guard, ZeroSizeBlock) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    char *ptr = callocate(0, BLOCK_SIZE);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_NOT_EQUAL(0, (uintptr_t)ptr % page_size);
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(1, stats.guarded_blocks);
+
+    deallocate(ptr);
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(0, stats.guarded_blocks);
+    TEST_ASSERT_EQUAL_size_t(0, stats.invalid_frees);
+}
+TEST(mmry_alloc_guard, ForeignFaultKeepsDetection) {
+    SKIP_UNDER_ASAN();
+    char report[256];
+    TEST_ASSERT_TRUE(child_faults_with_report(foreign_fault_then_overflow, report, sizeof(report)));
+    TEST_ASSERT_NOT_NULL(strstr(report, "mmanager: buffer overflow at 0x"));
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
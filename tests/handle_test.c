@@ -0,0 +1,176 @@
+#include <stdint.h>
+#include <string.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+
+#define HEADER_SIZE 16
+#define HANDLE_PREFIX_SIZE 16
+#define MMRY_ALLOC_SIZE 4096
+#define N_HANDLES 8
+#define BLOCK_SIZE 64
+
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_handle);
+TEST_SETUP(mmry_alloc_handle) {
+    mmanager_initialize(MMRY_ALLOC_SIZE, FIRST_FIT);
+}
+TEST_TEAR_DOWN(mmry_alloc_handle) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_handle) {
+    RUN_TEST_CASE(mmry_alloc_handle, AllocateAndFree);
+    RUN_TEST_CASE(mmry_alloc_handle, CompactionMovesUnpinnedBlocks);
+    RUN_TEST_CASE(mmry_alloc_handle, PinnedBlockIsNotMoved);
+    RUN_TEST_CASE(mmry_alloc_handle, NestedPins);
+    RUN_TEST_CASE(mmry_alloc_handle, BlocksAbovePinnedBlockAreCompacted);
+    RUN_TEST_CASE(mmry_alloc_handle, SlotsAreReused);
+    RUN_TEST_CASE(mmry_alloc_handle, AllocateTooMuch);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_handle);
+}
+
+// Tests.
+TEST(mmry_alloc_handle, AllocateAndFree) {
+    mm_handle_t handle = allocate_handle(BLOCK_SIZE);
+    TEST_ASSERT_TRUE(handle != MM_NULL_HANDLE);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - (2 * HEADER_SIZE + HANDLE_PREFIX_SIZE + BLOCK_SIZE),
+        mmanager_available_memory());
+
+    char *ptr = mm_pin(handle);
+    TEST_ASSERT_EQUAL_UINT64(0, (uintptr_t)ptr % 16);
+    memset(ptr, 'h', BLOCK_SIZE);
+    mm_unpin(handle);
+
+    deallocate_handle(handle);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_handle, CompactionMovesUnpinnedBlocks) {
+    mm_handle_t handles[N_HANDLES];
+    for (int i = 0; i < N_HANDLES; ++i) {
+        handles[i] = allocate_handle(BLOCK_SIZE);
+        memset(mm_pin(handles[i]), 'a' + i, BLOCK_SIZE);
+        mm_unpin(handles[i]);
+    }
+    char *last = mm_pin(handles[N_HANDLES - 1]);
+    mm_unpin(handles[N_HANDLES - 1]);
+
+    for (int i = 0; i < N_HANDLES; i += 2) {
+        deallocate_handle(handles[i]);
+    }
+
+    void *before[N_HANDLES];
+    void *after[N_HANDLES];
+    size_t n = mmanager_compact(before, after);
+    TEST_ASSERT_EQUAL_size_t(N_HANDLES / 2, n);
+    TEST_ASSERT_EQUAL_PTR(last, before[n - 1]);
+
+    // Handles still lead to the contents, wherever the blocks are now.
+    for (int i = 1; i < N_HANDLES; i += 2) {
+        char *ptr = mm_pin(handles[i]);
+        TEST_ASSERT_EACH_EQUAL_CHAR('a' + i, ptr, BLOCK_SIZE);
+        mm_unpin(handles[i]);
+    }
+    TEST_ASSERT_EQUAL_PTR(after[n - 1], mm_pin(handles[N_HANDLES - 1]));
+    mm_unpin(handles[N_HANDLES - 1]);
+
+    for (int i = 1; i < N_HANDLES; i += 2) {
+        deallocate_handle(handles[i]);
+    }
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_handle, PinnedBlockIsNotMoved) {
+    void *hole = allocate(BLOCK_SIZE);
+    mm_handle_t handle = allocate_handle(BLOCK_SIZE);
+    deallocate(hole);
+
+    char *pinned = mm_pin(handle);
+    memset(pinned, 'p', BLOCK_SIZE);
+
+    void *before[1];
+    void *after[1];
+    TEST_ASSERT_EQUAL_size_t(0, mmanager_compact(before, after));
+    TEST_ASSERT_EQUAL_PTR(pinned, mm_pin(handle));
+    mm_unpin(handle);
+    mm_unpin(handle);
+
+    // Once unpinned, the block moves into the hole.
+    TEST_ASSERT_EQUAL_size_t(1, mmanager_compact(before, after));
+    char *moved = mm_pin(handle);
+    TEST_ASSERT_TRUE(moved < pinned);
+    TEST_ASSERT_EQUAL_PTR(moved, after[0]);
+    TEST_ASSERT_EACH_EQUAL_CHAR('p', moved, BLOCK_SIZE);
+    mm_unpin(handle);
+
+    deallocate_handle(handle);
+}
+TEST(mmry_alloc_handle, NestedPins) {
+    void *hole = allocate(BLOCK_SIZE);
+    mm_handle_t handle = allocate_handle(BLOCK_SIZE);
+    deallocate(hole);
+
+    void *ptr = mm_pin(handle);
+    TEST_ASSERT_EQUAL_PTR(ptr, mm_pin(handle));
+    mm_unpin(handle);
+
+    // Still pinned once.
+    void *before[1];
+    void *after[1];
+    TEST_ASSERT_EQUAL_size_t(0, mmanager_compact(before, after));
+    mm_unpin(handle);
+    TEST_ASSERT_EQUAL_size_t(1, mmanager_compact(before, after));
+
+    deallocate_handle(handle);
+}
+TEST(mmry_alloc_handle, BlocksAbovePinnedBlockAreCompacted) {
+    void *hole1 = allocate(BLOCK_SIZE);
+    mm_handle_t pinned_handle = allocate_handle(BLOCK_SIZE);
+    void *hole2 = allocate(BLOCK_SIZE);
+    double *raw = allocate(sizeof(*raw));
+    *raw = 42.0;
+    deallocate(hole1);
+    deallocate(hole2);
+
+    // The free space below the pinned block stays, the rest is gathered.
+    void *pinned = mm_pin(pinned_handle);
+    void *before[2];
+    void *after[2];
+    TEST_ASSERT_EQUAL_size_t(1, mmanager_compact(before, after));
+    TEST_ASSERT_EQUAL_PTR(raw, before[0]);
+    TEST_ASSERT_EQUAL_PTR(hole2, after[0]);
+    raw = after[0];
+    TEST_ASSERT_EQUAL_DOUBLE(42.0, *raw);
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(2, stats.free_blocks);
+
+    TEST_ASSERT_EQUAL_PTR(pinned, mm_pin(pinned_handle));
+    mm_unpin(pinned_handle);
+    mm_unpin(pinned_handle);
+    deallocate(raw);
+    deallocate_handle(pinned_handle);
+}
+TEST(mmry_alloc_handle, SlotsAreReused) {
+    mm_handle_t first = allocate_handle(BLOCK_SIZE);
+    deallocate_handle(first);
+    mm_handle_t second = allocate_handle(2 * BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_UINT64(first, second);
+    deallocate_handle(second);
+}
+TEST(mmry_alloc_handle, AllocateTooMuch) {
+    TEST_ASSERT_EQUAL_UINT64(MM_NULL_HANDLE, allocate_handle(MMRY_ALLOC_SIZE));
+
+    // The slot of the failed allocation is not lost.
+    mm_handle_t handle = allocate_handle(BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_UINT64(1, handle);
+    deallocate_handle(handle);
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
@@ -0,0 +1,200 @@
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+
+#define HEADER_SIZE 16
+#define CANARY_SIZE 16
+#define FREE_POISON 0xdd
+#define MMRY_ALLOC_SIZE 4096
+#define BLOCK_SIZE 64
+
+// AddressSanitizer reports the deliberate heap errors of some tests itself,
+// before the allocator can.
+#ifdef __SANITIZE_ADDRESS__
+#define SKIP_UNDER_ASAN() TEST_IGNORE_MESSAGE("reported by AddressSanitizer")
+#else
+#define SKIP_UNDER_ASAN()
+#endif
+
+static void initialize(size_t check_interval_ms) {
+    struct mmanager_options options = {
+        .size = MMRY_ALLOC_SIZE,
+        .allocation_policy = FIRST_FIT,
+        .flags = MMANAGER_CANARIES | MMANAGER_POISON_FREE,
+        .invalid_free_action = MMANAGER_INVALID_FREE_IGNORE,
+        .check_interval_ms = check_interval_ms,
+    };
+    mmanager_initialize_with_options(&options);
+}
+
+static size_t heap_corruptions(void) {
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    return stats.heap_corruptions;
+}
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_heap_check);
+TEST_SETUP(mmry_alloc_heap_check) {
+    initialize(0);
+}
+TEST_TEAR_DOWN(mmry_alloc_heap_check) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_heap_check) {
+    RUN_TEST_CASE(mmry_alloc_heap_check, CleanHeapPasses);
+    RUN_TEST_CASE(mmry_alloc_heap_check, UsableSizeExcludesCanary);
+    RUN_TEST_CASE(mmry_alloc_heap_check, HugeRequestsFail);
+    RUN_TEST_CASE(mmry_alloc_heap_check, OverflowIsFoundOnFree);
+    RUN_TEST_CASE(mmry_alloc_heap_check, OverflowIsFoundByCheck);
+    RUN_TEST_CASE(mmry_alloc_heap_check, FreedMemoryIsPoisoned);
+    RUN_TEST_CASE(mmry_alloc_heap_check, WriteAfterFreeIsFound);
+    RUN_TEST_CASE(mmry_alloc_heap_check, SmashedHeaderIsFound);
+    RUN_TEST_CASE(mmry_alloc_heap_check, CopiedHeaderIsFound);
+    RUN_TEST_CASE(mmry_alloc_heap_check, ReallocateAndCompact);
+    RUN_TEST_CASE(mmry_alloc_heap_check, BackgroundCheck);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_heap_check);
+}
+
+// Tests.
+TEST(mmry_alloc_heap_check, CleanHeapPasses) {
+    TEST_ASSERT_EQUAL_size_t(0, mmanager_check());
+
+    void *ptrs[8];
+    for (int i = 0; i < 8; ++i) {
+        ptrs[i] = i % 3 ? allocate(BLOCK_SIZE + i) : allocate_aligned(64, BLOCK_SIZE);
+        memset(ptrs[i], 'a', BLOCK_SIZE);
+    }
+    for (int i = 0; i < 8; i += 2) {
+        deallocate(ptrs[i]);
+    }
+    TEST_ASSERT_EQUAL_size_t(0, mmanager_check());
+    TEST_ASSERT_EQUAL_size_t(0, heap_corruptions());
+}
+TEST(mmry_alloc_heap_check, UsableSizeExcludesCanary) {
+    void *ptr = allocate(BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_size_t(BLOCK_SIZE, mmanager_usable_size(ptr));
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - 2 * HEADER_SIZE - BLOCK_SIZE - CANARY_SIZE,
+        mmanager_available_memory());
+}
+TEST(mmry_alloc_heap_check, HugeRequestsFail) {
+    // The canary must not wrap the size around to a small block.
+    TEST_ASSERT_NULL(allocate(SIZE_MAX - 4));
+    TEST_ASSERT_NULL(allocate_aligned(64, SIZE_MAX - 4));
+
+    void *ptr = allocate(BLOCK_SIZE);
+    TEST_ASSERT_NULL(reallocate(ptr, SIZE_MAX - 4));
+    TEST_ASSERT_EQUAL_size_t(BLOCK_SIZE, mmanager_usable_size(ptr));
+    TEST_ASSERT_EQUAL_size_t(0, mmanager_check());
+}
+TEST(mmry_alloc_heap_check, OverflowIsFoundOnFree) {
+    SKIP_UNDER_ASAN();
+    char *ptr = allocate(BLOCK_SIZE);
+    ptr[BLOCK_SIZE] = 'x';
+    deallocate(ptr);
+    TEST_ASSERT_EQUAL_size_t(1, heap_corruptions());
+
+    // The block was still freed.
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_heap_check, OverflowIsFoundByCheck) {
+    SKIP_UNDER_ASAN();
+    char *ptr = allocate(BLOCK_SIZE);
+    allocate(BLOCK_SIZE);
+    ptr[BLOCK_SIZE + CANARY_SIZE - 1] = 'x';
+    TEST_ASSERT_EQUAL_size_t(1, mmanager_check());
+    TEST_ASSERT_EQUAL_size_t(1, heap_corruptions());
+}
+TEST(mmry_alloc_heap_check, FreedMemoryIsPoisoned) {
+    SKIP_UNDER_ASAN();
+    unsigned char *ptr = allocate(BLOCK_SIZE);
+    allocate(BLOCK_SIZE);
+    memset(ptr, 'a', BLOCK_SIZE);
+    deallocate(ptr);
+    for (int i = 0; i < BLOCK_SIZE; ++i) {
+        TEST_ASSERT_EQUAL_HEX8(FREE_POISON, ptr[i]);
+    }
+}
+TEST(mmry_alloc_heap_check, WriteAfterFreeIsFound) {
+    SKIP_UNDER_ASAN();
+    allocate(BLOCK_SIZE);
+    char *freed = allocate(BLOCK_SIZE);
+    allocate(BLOCK_SIZE);
+    deallocate(freed);
+
+    freed[BLOCK_SIZE / 2] = 'x';
+    TEST_ASSERT_EQUAL_size_t(1, mmanager_check());
+}
+TEST(mmry_alloc_heap_check, SmashedHeaderIsFound) {
+    SKIP_UNDER_ASAN();
+    char *ptr = allocate(BLOCK_SIZE);
+    allocate(BLOCK_SIZE);
+
+    // Overwrite the size of the next block's header, which would otherwise
+    // send the free list walks off the end of the arena.
+    memset(ptr + BLOCK_SIZE + CANARY_SIZE, 0xff, 8);
+    TEST_ASSERT_TRUE(mmanager_check() >= 1);
+}
+TEST(mmry_alloc_heap_check, CopiedHeaderIsFound) {
+    SKIP_UNDER_ASAN();
+    char *first = allocate(BLOCK_SIZE);
+    char *second = allocate(BLOCK_SIZE);
+
+    // A header copied from a block of the same size keeps the walk intact, but
+    // belongs to another address.
+    memcpy(first - HEADER_SIZE, second - HEADER_SIZE, HEADER_SIZE);
+    TEST_ASSERT_EQUAL_size_t(1, mmanager_check());
+    TEST_ASSERT_EQUAL_size_t(1, heap_corruptions());
+
+    deallocate(first);
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(1, stats.invalid_frees);
+    deallocate(second);
+    TEST_ASSERT_EQUAL_size_t(1, mmanager_check());
+}
+TEST(mmry_alloc_heap_check, ReallocateAndCompact) {
+    void *first = allocate(BLOCK_SIZE);
+    char *ptr = allocate(BLOCK_SIZE);
+    allocate(BLOCK_SIZE);
+    memset(ptr, 'r', BLOCK_SIZE);
+
+    ptr = reallocate(ptr, BLOCK_SIZE / 2);
+    TEST_ASSERT_EQUAL_size_t(0, mmanager_check());
+    ptr = reallocate(ptr, 4 * BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_size_t(0, mmanager_check());
+    TEST_ASSERT_EQUAL_CHAR('r', ptr[BLOCK_SIZE / 2 - 1]);
+
+    deallocate(first);
+    void *before[4];
+    void *after[4];
+    TEST_ASSERT_TRUE(mmanager_compact(before, after) > 0);
+    TEST_ASSERT_EQUAL_size_t(0, mmanager_check());
+    TEST_ASSERT_EQUAL_size_t(0, heap_corruptions());
+}
+TEST(mmry_alloc_heap_check, BackgroundCheck) {
+    SKIP_UNDER_ASAN();
+    mmanager_destroy();
+    initialize(1);
+
+    char *ptr = allocate(BLOCK_SIZE);
+    allocate(BLOCK_SIZE);
+    ptr[BLOCK_SIZE] = 'x';
+
+    // Wait up to a second for the thread to find it.
+    for (int i = 0; i < 1000 && heap_corruptions() == 0; ++i) {
+        nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+    }
+    TEST_ASSERT_TRUE(heap_corruptions() > 0);
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
@@ -0,0 +1,116 @@
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+
+#define HEADER_SIZE 16
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define MMRY_ALLOC_SIZE (4 * HUGE_PAGE_SIZE)
+#define BLOCK_SIZE 64
+
+
+// Returns the number of pages of [ptr, ptr + size) that are resident.
+static size_t resident_pages(void *ptr, size_t size) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)ptr + page_size - 1) & ~(page_size - 1);
+    uintptr_t end = ((uintptr_t)ptr + size) & ~(page_size - 1);
+    unsigned char pages[MMRY_ALLOC_SIZE / 4096 + 1];
+    size_t n_pages = (end - start) / page_size;
+    TEST_ASSERT_TRUE(n_pages <= sizeof(pages));
+    TEST_ASSERT_EQUAL_INT(0, mincore((void *)start, end - start, pages));
+
+    size_t resident = 0;
+    for (size_t i = 0; i < n_pages; ++i) {
+        resident += pages[i] & 1;
+    }
+    return resident;
+}
+
+static void initialize(size_t arenas) {
+    struct mmanager_options options = {
+        .size = MMRY_ALLOC_SIZE,
+        .allocation_policy = FIRST_FIT,
+        .flags = MMANAGER_HUGE_PAGES,
+        .arenas = arenas,
+    };
+    mmanager_initialize_with_options(&options);
+}
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_huge_pages);
+TEST_SETUP(mmry_alloc_huge_pages) {
+    initialize(1);
+}
+TEST_TEAR_DOWN(mmry_alloc_huge_pages) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_huge_pages) {
+    RUN_TEST_CASE(mmry_alloc_huge_pages, ArenaIsAligned);
+    RUN_TEST_CASE(mmry_alloc_huge_pages, ArenasAreAligned);
+    RUN_TEST_CASE(mmry_alloc_huge_pages, PartialHugePagesAreNotTrimmed);
+    RUN_TEST_CASE(mmry_alloc_huge_pages, WholeHugePagesAreTrimmed);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_huge_pages);
+}
+
+// Tests.
+TEST(mmry_alloc_huge_pages, ArenaIsAligned) {
+    char *ptr = allocate(BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_size_t(0, (uintptr_t)(ptr - HEADER_SIZE) % HUGE_PAGE_SIZE);
+    memset(ptr, 'a', BLOCK_SIZE);
+    deallocate(ptr);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_huge_pages, ArenasAreAligned) {
+    mmanager_destroy();
+    initialize(2);
+
+    // Fill the first arena so that the next block comes from the second one.
+    char *first = allocate(MMRY_ALLOC_SIZE / 2 - HEADER_SIZE);
+    char *second = allocate(BLOCK_SIZE);
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(second);
+    TEST_ASSERT_EQUAL_size_t(0, (uintptr_t)(first - HEADER_SIZE) % HUGE_PAGE_SIZE);
+    TEST_ASSERT_EQUAL_size_t(0, (uintptr_t)(second - HEADER_SIZE) % HUGE_PAGE_SIZE);
+}
+TEST(mmry_alloc_huge_pages, PartialHugePagesAreNotTrimmed) {
+    // The free block before `kept` ends inside the first huge page.
+    char *ptr = allocate(HUGE_PAGE_SIZE / 2);
+    char *kept = allocate(BLOCK_SIZE);
+    memset(ptr, 'a', HUGE_PAGE_SIZE / 2);
+    memset(kept, 'k', BLOCK_SIZE);
+    size_t resident = resident_pages(ptr, HUGE_PAGE_SIZE / 2);
+    deallocate(ptr);
+
+    mmanager_maintain();
+    TEST_ASSERT_EQUAL_size_t(resident, resident_pages(ptr, HUGE_PAGE_SIZE / 2));
+}
+TEST(mmry_alloc_huge_pages, WholeHugePagesAreTrimmed) {
+    char *ptr = allocate(3 * HUGE_PAGE_SIZE);
+    memset(ptr, 'a', 3 * HUGE_PAGE_SIZE);
+    deallocate(ptr);
+
+    mmanager_maintain();
+    // Only the huge pages after the first one, which holds the header, go.
+    TEST_ASSERT_TRUE(resident_pages(ptr, HUGE_PAGE_SIZE - HEADER_SIZE) > 0);
+    TEST_ASSERT_EQUAL_size_t(0, resident_pages(ptr - HEADER_SIZE + HUGE_PAGE_SIZE, 3 * HUGE_PAGE_SIZE));
+
+    // The trimmed memory reads back as zero.
+    char *zeroed = callocate(1, 3 * HUGE_PAGE_SIZE);
+    TEST_ASSERT_EQUAL_PTR(ptr, zeroed);
+    for (size_t i = 0; i < 3 * HUGE_PAGE_SIZE; ++i) {
+        if (zeroed[i] != 0) {
+            TEST_FAIL_MESSAGE("memory is not zero");
+        }
+    }
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
@@ -0,0 +1,249 @@
+#include <stdint.h>
+#include <string.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+
+#define HEADER_SIZE 16
+#define MMRY_ALLOC_SIZE 4096
+#define N_BLOCKS 16
+#define BLOCK_SIZE 64
+
+static void *blocks[N_BLOCKS];
+
+// Allocates N_BLOCKS blocks, fills each with its index and frees every other one.
+static void fill_with_holes(void);
+
+// Replaces the pointers in `blocks` that were moved from `before` to `after`.
+static void relocate(void **before, void **after, size_t n);
+
+// Checks that every remaining block still holds its index.
+static void check_contents(void);
+
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_incremental_compaction);
+TEST_SETUP(mmry_alloc_incremental_compaction) {
+    mmanager_initialize(MMRY_ALLOC_SIZE, FIRST_FIT);
+}
+TEST_TEAR_DOWN(mmry_alloc_incremental_compaction) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_incremental_compaction) {
+    RUN_TEST_CASE(mmry_alloc_incremental_compaction, NothingToDo);
+    RUN_TEST_CASE(mmry_alloc_incremental_compaction, BlockBudget);
+    RUN_TEST_CASE(mmry_alloc_incremental_compaction, ByteBudget);
+    RUN_TEST_CASE(mmry_alloc_incremental_compaction, OversizedBlockStillMoves);
+    RUN_TEST_CASE(mmry_alloc_incremental_compaction, SameResultAsFullCompaction);
+    RUN_TEST_CASE(mmry_alloc_incremental_compaction, Arenas);
+    RUN_TEST_CASE(mmry_alloc_incremental_compaction, OverlappingMoves);
+    RUN_TEST_CASE(mmry_alloc_incremental_compaction, ChangesBelowStopPoint);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_incremental_compaction);
+}
+
+// Tests.
+TEST(mmry_alloc_incremental_compaction, NothingToDo) {
+    void *before[1];
+    void *after[1];
+    TEST_ASSERT_EQUAL_size_t(0, mmanager_compact_incremental(0, 1, before, after));
+
+    void *ptr = allocate(BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_size_t(0, mmanager_compact_incremental(0, 1, before, after));
+    deallocate(ptr);
+}
+TEST(mmry_alloc_incremental_compaction, BlockBudget) {
+    fill_with_holes();
+
+    // One block per call until the heap is compact.
+    void *before[1];
+    void *after[1];
+    size_t calls = 0;
+    size_t n;
+    while ((n = mmanager_compact_incremental(0, 1, before, after)) > 0) {
+        TEST_ASSERT_EQUAL_size_t(1, n);
+        TEST_ASSERT_TRUE((char *)after[0] < (char *)before[0]);
+        relocate(before, after, n);
+        ++calls;
+    }
+    TEST_ASSERT_EQUAL_size_t(N_BLOCKS / 2, calls);
+    check_contents();
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(1, stats.free_blocks);
+}
+TEST(mmry_alloc_incremental_compaction, ByteBudget) {
+    fill_with_holes();
+
+    // Three blocks fit in the budget, a fourth does not.
+    void *before[N_BLOCKS];
+    void *after[N_BLOCKS];
+    size_t n = mmanager_compact_incremental(3 * BLOCK_SIZE + BLOCK_SIZE / 2, 0, before, after);
+    TEST_ASSERT_EQUAL_size_t(3, n);
+    relocate(before, after, n);
+
+    n = mmanager_compact_incremental(0, 0, before, after);
+    TEST_ASSERT_EQUAL_size_t(N_BLOCKS / 2 - 3, n);
+    relocate(before, after, n);
+    check_contents();
+}
+TEST(mmry_alloc_incremental_compaction, OversizedBlockStillMoves) {
+    fill_with_holes();
+
+    void *before[N_BLOCKS];
+    void *after[N_BLOCKS];
+    size_t n = mmanager_compact_incremental(1, 0, before, after);
+    TEST_ASSERT_EQUAL_size_t(1, n);
+    relocate(before, after, n);
+    check_contents();
+}
+TEST(mmry_alloc_incremental_compaction, SameResultAsFullCompaction) {
+    fill_with_holes();
+
+    void *before[N_BLOCKS];
+    void *after[N_BLOCKS];
+    size_t n;
+    while ((n = mmanager_compact_incremental(0, 3, before, after)) > 0) {
+        TEST_ASSERT_TRUE(n <= 3);
+        relocate(before, after, n);
+    }
+    check_contents();
+
+    // Nothing is left for a full compaction.
+    TEST_ASSERT_EQUAL_size_t(0, mmanager_compact(before, after));
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - (N_BLOCKS / 2 + 1) * HEADER_SIZE - N_BLOCKS / 2 * BLOCK_SIZE,
+        mmanager_available_memory());
+}
+TEST(mmry_alloc_incremental_compaction, Arenas) {
+    mmanager_destroy();
+    struct mmanager_options options = { 2 * MMRY_ALLOC_SIZE, FIRST_FIT, 0, 2, MMANAGER_ARENA_ROUND_ROBIN };
+    mmanager_initialize_with_options(&options);
+
+    // Leave holes in both arenas: the first filler takes this thread's arena,
+    // the second the other one.
+    void *fillers[2];
+    void *holes[2];
+    for (int i = 0; i < 2; ++i) {
+        holes[i] = allocate(BLOCK_SIZE);
+        TEST_ASSERT_NOT_NULL(allocate(BLOCK_SIZE));
+        fillers[i] = allocate(MMRY_ALLOC_SIZE - 3 * HEADER_SIZE - 2 * BLOCK_SIZE);
+        TEST_ASSERT_NOT_NULL(fillers[i]);
+    }
+    deallocate(holes[0]);
+    deallocate(holes[1]);
+
+    // Each arena is visited in turn, one block per call.
+    void *before[1];
+    void *after[1];
+    size_t moved = 0;
+    size_t n;
+    while ((n = mmanager_compact_incremental(0, 1, before, after)) > 0) {
+        moved += n;
+        TEST_ASSERT_TRUE(moved <= 4);
+    }
+    TEST_ASSERT_EQUAL_size_t(4, moved);
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(2, stats.free_blocks);
+}
+
+TEST(mmry_alloc_incremental_compaction, OverlappingMoves) {
+    // Small holes below large blocks, so that every block overlaps its new
+    // location.
+    for (int i = 0; i < N_BLOCKS; ++i) {
+        blocks[i] = allocate(i % 2 ? 4 * BLOCK_SIZE : 16);
+        memset(blocks[i], i, i % 2 ? 4 * BLOCK_SIZE : 16);
+    }
+    for (int i = 0; i < N_BLOCKS; i += 2) {
+        deallocate(blocks[i]);
+        blocks[i] = NULL;
+    }
+
+    void *before[N_BLOCKS];
+    void *after[N_BLOCKS];
+    size_t n;
+    while ((n = mmanager_compact_incremental(5 * BLOCK_SIZE, 0, before, after)) > 0) {
+        relocate(before, after, n);
+        for (int i = 1; i < N_BLOCKS; i += 2) {
+            TEST_ASSERT_EACH_EQUAL_CHAR(i, blocks[i], 4 * BLOCK_SIZE);
+        }
+    }
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(1, stats.free_blocks);
+    TEST_ASSERT_EQUAL_size_t(N_BLOCKS / 2, stats.allocated_blocks);
+}
+
+TEST(mmry_alloc_incremental_compaction, ChangesBelowStopPoint) {
+    fill_with_holes();
+
+    void *before[N_BLOCKS];
+    void *after[N_BLOCKS];
+    size_t n = mmanager_compact_incremental(0, 2, before, after);
+    TEST_ASSERT_EQUAL_size_t(2, n);
+    relocate(before, after, n);
+
+    // Free a block that was already moved and fill the gap the stopped pass
+    // left, both below where the next pass would continue.
+    deallocate(blocks[1]);
+    blocks[1] = NULL;
+    char *small = allocate(96);
+    memset(small, 'x', 96);
+
+    while ((n = mmanager_compact_incremental(0, 2, before, after)) > 0) {
+        relocate(before, after, n);
+        for (size_t i = 0; i < n; ++i) {
+            if (before[i] == small) {
+                small = after[i];
+            }
+        }
+    }
+    check_contents();
+    TEST_ASSERT_EACH_EQUAL_CHAR('x', small, 96);
+    TEST_ASSERT_EQUAL_size_t(0, mmanager_check());
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(1, stats.free_blocks);
+    TEST_ASSERT_EQUAL_size_t(N_BLOCKS / 2, stats.allocated_blocks);
+}
+
+static void fill_with_holes(void) {
+    for (int i = 0; i < N_BLOCKS; ++i) {
+        blocks[i] = allocate(BLOCK_SIZE);
+        memset(blocks[i], i, BLOCK_SIZE);
+    }
+    for (int i = 0; i < N_BLOCKS; i += 2) {
+        deallocate(blocks[i]);
+        blocks[i] = NULL;
+    }
+}
+
+static void relocate(void **before, void **after, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        for (int j = 0; j < N_BLOCKS; ++j) {
+            if (blocks[j] == before[i]) {
+                blocks[j] = after[i];
+                break;
+            }
+        }
+    }
+}
+
+static void check_contents(void) {
+    for (int i = 0; i < N_BLOCKS; ++i) {
+        if (blocks[i]) {
+            TEST_ASSERT_EACH_EQUAL_CHAR(i, blocks[i], BLOCK_SIZE);
+        }
+    }
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
@@ -0,0 +1,144 @@
+#include <signal.h>
+#include <stdint.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+
+#define HEADER_SIZE 16
+#define MMRY_ALLOC_SIZE 4096
+#define BLOCK_SIZE 64
+
+
+static void initialize(unsigned flags, enum mmanager_invalid_free_action action) {
+    struct mmanager_options options = {
+        .size = MMRY_ALLOC_SIZE,
+        .allocation_policy = FIRST_FIT,
+        .flags = flags,
+        .invalid_free_action = action,
+    };
+    mmanager_initialize_with_options(&options);
+}
+
+static size_t invalid_frees(void) {
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    return stats.invalid_frees;
+}
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_invalid_free);
+TEST_SETUP(mmry_alloc_invalid_free) {
+    initialize(0, MMANAGER_INVALID_FREE_IGNORE);
+}
+TEST_TEAR_DOWN(mmry_alloc_invalid_free) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_invalid_free) {
+    RUN_TEST_CASE(mmry_alloc_invalid_free, ValidFreesAreNotCounted);
+    RUN_TEST_CASE(mmry_alloc_invalid_free, DoubleFree);
+    RUN_TEST_CASE(mmry_alloc_invalid_free, DoubleFreeAfterCoalescing);
+    RUN_TEST_CASE(mmry_alloc_invalid_free, InteriorPointer);
+    RUN_TEST_CASE(mmry_alloc_invalid_free, PointerOutsideHeap);
+    RUN_TEST_CASE(mmry_alloc_invalid_free, ReallocateFreedBlock);
+    RUN_TEST_CASE(mmry_alloc_invalid_free, DoubleFreeOfDeferredBlock);
+    RUN_TEST_CASE(mmry_alloc_invalid_free, AbortByDefault);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_invalid_free);
+}
+
+// Tests.
+TEST(mmry_alloc_invalid_free, ValidFreesAreNotCounted) {
+    void *ptr = allocate(BLOCK_SIZE);
+    ptr = reallocate(ptr, 2 * BLOCK_SIZE);
+    deallocate(ptr);
+    TEST_ASSERT_EQUAL_size_t(0, invalid_frees());
+}
+TEST(mmry_alloc_invalid_free, DoubleFree) {
+    void *first = allocate(BLOCK_SIZE);
+    void *second = allocate(BLOCK_SIZE);
+    deallocate(first);
+    deallocate(first);
+    TEST_ASSERT_EQUAL_size_t(1, invalid_frees());
+
+    // The free list was left intact.
+    deallocate(second);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_invalid_free, DoubleFreeAfterCoalescing) {
+    void *first = allocate(BLOCK_SIZE);
+    void *second = allocate(BLOCK_SIZE);
+    void *third = allocate(BLOCK_SIZE);
+    deallocate(second);
+    deallocate(first);
+
+    // The header of `second` is now inside the free block of `first`.
+    deallocate(second);
+    TEST_ASSERT_EQUAL_size_t(1, invalid_frees());
+
+    deallocate(third);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_invalid_free, InteriorPointer) {
+    char *ptr = allocate(BLOCK_SIZE);
+    deallocate(ptr + HEADER_SIZE);
+    TEST_ASSERT_EQUAL_size_t(1, invalid_frees());
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(1, stats.allocated_blocks);
+    deallocate(ptr);
+}
+TEST(mmry_alloc_invalid_free, PointerOutsideHeap) {
+    char buffer[2 * HEADER_SIZE] = { 0 };
+    deallocate(buffer + HEADER_SIZE);
+    TEST_ASSERT_EQUAL_size_t(1, invalid_frees());
+}
+TEST(mmry_alloc_invalid_free, ReallocateFreedBlock) {
+    void *ptr = allocate(BLOCK_SIZE);
+    allocate(BLOCK_SIZE);
+    deallocate(ptr);
+    TEST_ASSERT_NULL(reallocate(ptr, 2 * BLOCK_SIZE));
+    TEST_ASSERT_EQUAL_size_t(1, invalid_frees());
+}
+TEST(mmry_alloc_invalid_free, DoubleFreeOfDeferredBlock) {
+    mmanager_destroy();
+    initialize(MMANAGER_DEFERRED_COALESCING, MMANAGER_INVALID_FREE_IGNORE);
+
+    void *ptr = allocate(BLOCK_SIZE);
+    deallocate(ptr);
+    deallocate(ptr);
+    TEST_ASSERT_EQUAL_size_t(1, invalid_frees());
+
+    // The quick list holds the block once.
+    TEST_ASSERT_EQUAL_PTR(ptr, allocate(BLOCK_SIZE));
+    TEST_ASSERT_TRUE(allocate(BLOCK_SIZE) != ptr);
+}
+TEST(mmry_alloc_invalid_free, AbortByDefault) {
+    mmanager_destroy();
+    initialize(0, MMANAGER_INVALID_FREE_ABORT);
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Keep the report out of the test output.
+        close(STDERR_FILENO);
+        void *ptr = allocate(BLOCK_SIZE);
+        deallocate(ptr);
+        deallocate(ptr);
+        _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    TEST_ASSERT_TRUE(WIFSIGNALED(status));
+    TEST_ASSERT_EQUAL_INT(SIGABRT, WTERMSIG(status));
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
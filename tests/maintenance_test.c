@@ -0,0 +1,202 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+
+#define HEADER_SIZE 16
+#define HANDLE_PREFIX_SIZE 16
+#define MMRY_ALLOC_SIZE (1024 * 1024)
+#define BLOCK_SIZE 64
+#define N_BLOCKS 64
+#define LARGE_BLOCK_SIZE (512 * 1024)
+#define HANDLE_BLOCK_SIZE (64 * 1024)
+#define N_HANDLE_BLOCKS 6
+
+
+// Returns the number of pages of [ptr, ptr + size) that are resident.
+static size_t resident_pages(void *ptr, size_t size) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)ptr + page_size - 1) & ~(page_size - 1);
+    uintptr_t end = ((uintptr_t)ptr + size) & ~(page_size - 1);
+    unsigned char pages[LARGE_BLOCK_SIZE / 4096 + 1];
+    size_t n_pages = (end - start) / page_size;
+    TEST_ASSERT_TRUE(n_pages <= sizeof(pages));
+    TEST_ASSERT_EQUAL_INT(0, mincore((void *)start, end - start, pages));
+
+    size_t resident = 0;
+    for (size_t i = 0; i < n_pages; ++i) {
+        resident += pages[i] & 1;
+    }
+    return resident;
+}
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_maintenance);
+TEST_SETUP(mmry_alloc_maintenance) {
+    struct mmanager_options options = {
+        .size = MMRY_ALLOC_SIZE,
+        .allocation_policy = FIRST_FIT,
+        .flags = MMANAGER_BACKGROUND_MAINTENANCE,
+        .maintenance_interval_ms = 1,
+        .maintenance_duty_cycle = 50,
+    };
+    mmanager_initialize_with_options(&options);
+}
+TEST_TEAR_DOWN(mmry_alloc_maintenance) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_maintenance) {
+    RUN_TEST_CASE(mmry_alloc_maintenance, FreedMemoryIsAvailable);
+    RUN_TEST_CASE(mmry_alloc_maintenance, AllocationMergesDeferredFrees);
+    RUN_TEST_CASE(mmry_alloc_maintenance, FreePagesAreTrimmed);
+    RUN_TEST_CASE(mmry_alloc_maintenance, HandleBlocksAreCompacted);
+    RUN_TEST_CASE(mmry_alloc_maintenance, ThreadCompactsHandleBlocks);
+    RUN_TEST_CASE(mmry_alloc_maintenance, ThreadCompactsHandleBlocksInSteps);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_maintenance);
+}
+
+// Tests.
+TEST(mmry_alloc_maintenance, FreedMemoryIsAvailable) {
+    void *ptrs[N_BLOCKS];
+    for (int i = 0; i < N_BLOCKS; ++i) {
+        ptrs[i] = allocate(BLOCK_SIZE);
+    }
+    for (int i = 0; i < N_BLOCKS; i += 2) {
+        deallocate(ptrs[i]);
+    }
+    for (int i = 1; i < N_BLOCKS; i += 2) {
+        deallocate(ptrs[i]);
+    }
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(0, stats.allocated_blocks);
+    TEST_ASSERT_EQUAL_size_t(1, stats.free_blocks);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - HEADER_SIZE, stats.free_bytes);
+}
+TEST(mmry_alloc_maintenance, AllocationMergesDeferredFrees) {
+    // Fill the whole arena, so the only room left is in deferred frees.
+    size_t n_blocks = MMRY_ALLOC_SIZE / (HEADER_SIZE + BLOCK_SIZE);
+    void *first = allocate(BLOCK_SIZE);
+    void *previous = first;
+    for (size_t i = 1; i < n_blocks; ++i) {
+        previous = allocate(BLOCK_SIZE);
+        TEST_ASSERT_NOT_NULL(previous);
+    }
+    TEST_ASSERT_NULL(allocate(BLOCK_SIZE));
+
+    // Free two neighbours; only their merge fits the next request.
+    deallocate(first);
+    deallocate((char *)first + HEADER_SIZE + BLOCK_SIZE);
+    void *merged = allocate(2 * BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_PTR(first, merged);
+    (void)previous;
+}
+TEST(mmry_alloc_maintenance, FreePagesAreTrimmed) {
+    char *ptr = allocate(LARGE_BLOCK_SIZE);
+    memset(ptr, 'x', LARGE_BLOCK_SIZE);
+    TEST_ASSERT_TRUE(resident_pages(ptr, LARGE_BLOCK_SIZE) > 0);
+
+    deallocate(ptr);
+    mmanager_maintain();
+    TEST_ASSERT_EQUAL_size_t(0, resident_pages(ptr, LARGE_BLOCK_SIZE));
+
+    // Trimmed memory reads back as zero and can be reused.
+    char *reused = callocate(1, LARGE_BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_PTR(ptr, reused);
+    TEST_ASSERT_EQUAL_CHAR(0, reused[LARGE_BLOCK_SIZE / 2]);
+    deallocate(reused);
+}
+TEST(mmry_alloc_maintenance, HandleBlocksAreCompacted) {
+    char *raw_below = allocate(BLOCK_SIZE);
+    mm_handle_t freed = allocate_handle(BLOCK_SIZE);
+    mm_handle_t kept = allocate_handle(BLOCK_SIZE);
+    char *raw_above = allocate(BLOCK_SIZE);
+    char *freed_address = mm_pin(freed);
+    mm_unpin(freed);
+    memset(mm_pin(kept), 'k', BLOCK_SIZE);
+    mm_unpin(kept);
+    memset(raw_above, 'r', BLOCK_SIZE);
+
+    deallocate_handle(freed);
+    mmanager_maintain();
+
+    // The handle block moved down into the hole; the raw block above it did not.
+    char *kept_address = mm_pin(kept);
+    TEST_ASSERT_EQUAL_PTR(freed_address, kept_address);
+    for (int i = 0; i < BLOCK_SIZE; ++i) {
+        TEST_ASSERT_EQUAL_CHAR('k', kept_address[i]);
+        TEST_ASSERT_EQUAL_CHAR('r', raw_above[i]);
+    }
+    mm_unpin(kept);
+
+    deallocate_handle(kept);
+    deallocate(raw_above);
+    deallocate(raw_below);
+}
+TEST(mmry_alloc_maintenance, ThreadCompactsHandleBlocks) {
+    mm_handle_t freed = allocate_handle(BLOCK_SIZE);
+    mm_handle_t kept = allocate_handle(BLOCK_SIZE);
+    char *freed_address = mm_pin(freed);
+    mm_unpin(freed);
+    deallocate_handle(freed);
+
+    // Wait up to a second for the thread to move the block.
+    bool moved = false;
+    for (int i = 0; i < 1000 && !moved; ++i) {
+        moved = mm_pin(kept) == freed_address;
+        mm_unpin(kept);
+        if (!moved) {
+            nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+        }
+    }
+    TEST_ASSERT_TRUE(moved);
+    deallocate_handle(kept);
+}
+TEST(mmry_alloc_maintenance, ThreadCompactsHandleBlocksInSteps) {
+    // The blocks above the hole take more than one pass of the thread to move.
+    char *hole = allocate(BLOCK_SIZE);
+    mm_handle_t handles[N_HANDLE_BLOCKS];
+    char *addresses[N_HANDLE_BLOCKS];
+    for (int i = 0; i < N_HANDLE_BLOCKS; ++i) {
+        handles[i] = allocate_handle(HANDLE_BLOCK_SIZE);
+        addresses[i] = mm_pin(handles[i]);
+        memset(addresses[i], i, HANDLE_BLOCK_SIZE);
+        mm_unpin(handles[i]);
+    }
+    deallocate(hole);
+
+    // Wait up to a second for the thread to move the last block.
+    char *expected = addresses[N_HANDLE_BLOCKS - 1] - (BLOCK_SIZE + HEADER_SIZE);
+    bool moved = false;
+    for (int i = 0; i < 1000 && !moved; ++i) {
+        moved = mm_pin(handles[N_HANDLE_BLOCKS - 1]) == expected;
+        mm_unpin(handles[N_HANDLE_BLOCKS - 1]);
+        if (!moved) {
+            nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+        }
+    }
+    TEST_ASSERT_TRUE(moved);
+
+    for (int i = 0; i < N_HANDLE_BLOCKS; ++i) {
+        char *address = mm_pin(handles[i]);
+        TEST_ASSERT_EQUAL_PTR(addresses[i] - (BLOCK_SIZE + HEADER_SIZE), address);
+        TEST_ASSERT_EACH_EQUAL_CHAR(i, address, HANDLE_BLOCK_SIZE);
+        mm_unpin(handles[i]);
+        deallocate_handle(handles[i]);
+    }
+    TEST_ASSERT_EQUAL_size_t(0, mmanager_check());
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
@@ -0,0 +1,179 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+
+#define MMRY_ALLOC_SIZE (64 * 1024)
+#define MMAP_THRESHOLD (16 * 1024)
+#define LARGE_BLOCK_SIZE (1024 * 1024)
+#define N_LARGE_BLOCKS 200
+
+
+static struct mmanager_stats get_stats(void) {
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    return stats;
+}
+
+static void fill(unsigned char *ptr, size_t size, unsigned char seed) {
+    for (size_t i = 0; i < size; ++i) {
+        ptr[i] = (unsigned char)(seed + i);
+    }
+}
+
+static void assert_filled(const unsigned char *ptr, size_t size, unsigned char seed) {
+    for (size_t i = 0; i < size; ++i) {
+        if (ptr[i] != (unsigned char)(seed + i)) {
+            TEST_FAIL_MESSAGE("contents changed");
+        }
+    }
+}
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_mmap);
+TEST_SETUP(mmry_alloc_mmap) {
+    struct mmanager_options options = {
+        .size = MMRY_ALLOC_SIZE,
+        .allocation_policy = FIRST_FIT,
+        .invalid_free_action = MMANAGER_INVALID_FREE_IGNORE,
+        .mmap_threshold = MMAP_THRESHOLD,
+    };
+    mmanager_initialize_with_options(&options);
+}
+TEST_TEAR_DOWN(mmry_alloc_mmap) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_mmap) {
+    RUN_TEST_CASE(mmry_alloc_mmap, LargeRequestsAreMapped);
+    RUN_TEST_CASE(mmry_alloc_mmap, SmallRequestsUseTheArena);
+    RUN_TEST_CASE(mmry_alloc_mmap, MappedCallocateIsZeroed);
+    RUN_TEST_CASE(mmry_alloc_mmap, MappedBlocksArePageAligned);
+    RUN_TEST_CASE(mmry_alloc_mmap, ReallocateResizesMapping);
+    RUN_TEST_CASE(mmry_alloc_mmap, ReallocateMovesGrowingBlockOutOfArena);
+    RUN_TEST_CASE(mmry_alloc_mmap, DoubleFreeIsRejected);
+    RUN_TEST_CASE(mmry_alloc_mmap, ManyMappedBlocks);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_mmap);
+}
+
+// Tests.
+TEST(mmry_alloc_mmap, LargeRequestsAreMapped) {
+    // The block does not even fit in the arena.
+    unsigned char *ptr = allocate(LARGE_BLOCK_SIZE);
+    TEST_ASSERT_NOT_NULL(ptr);
+    fill(ptr, LARGE_BLOCK_SIZE, 1);
+    TEST_ASSERT_EQUAL_size_t(LARGE_BLOCK_SIZE, mmanager_usable_size(ptr));
+
+    struct mmanager_stats stats = get_stats();
+    TEST_ASSERT_EQUAL_size_t(1, stats.mapped_blocks);
+    TEST_ASSERT_EQUAL_size_t(LARGE_BLOCK_SIZE, stats.mapped_bytes);
+    TEST_ASSERT_EQUAL_size_t(0, stats.allocated_blocks);
+
+    deallocate(ptr);
+    stats = get_stats();
+    TEST_ASSERT_EQUAL_size_t(0, stats.mapped_blocks);
+    TEST_ASSERT_EQUAL_size_t(0, stats.mapped_bytes);
+    TEST_ASSERT_EQUAL_size_t(0, stats.invalid_frees);
+}
+TEST(mmry_alloc_mmap, SmallRequestsUseTheArena) {
+    void *ptr = allocate(MMAP_THRESHOLD);
+    TEST_ASSERT_NOT_NULL(ptr);
+
+    struct mmanager_stats stats = get_stats();
+    TEST_ASSERT_EQUAL_size_t(0, stats.mapped_blocks);
+    TEST_ASSERT_EQUAL_size_t(1, stats.allocated_blocks);
+    deallocate(ptr);
+}
+TEST(mmry_alloc_mmap, MappedCallocateIsZeroed) {
+    unsigned char *ptr = callocate(LARGE_BLOCK_SIZE / 8, 8);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_size_t(1, get_stats().mapped_blocks);
+    for (size_t i = 0; i < LARGE_BLOCK_SIZE; ++i) {
+        if (ptr[i] != 0) {
+            TEST_FAIL_MESSAGE("memory is not zero");
+        }
+    }
+    deallocate(ptr);
+}
+TEST(mmry_alloc_mmap, MappedBlocksArePageAligned) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    void *ptr = allocate_aligned(page_size, LARGE_BLOCK_SIZE + 1);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_size_t(0, (uintptr_t)ptr % page_size);
+    TEST_ASSERT_EQUAL_size_t(LARGE_BLOCK_SIZE + page_size, mmanager_usable_size(ptr));
+    TEST_ASSERT_EQUAL_size_t(1, get_stats().mapped_blocks);
+    deallocate(ptr);
+}
+TEST(mmry_alloc_mmap, ReallocateResizesMapping) {
+    unsigned char *ptr = allocate(LARGE_BLOCK_SIZE);
+    fill(ptr, LARGE_BLOCK_SIZE, 2);
+
+    ptr = reallocate(ptr, 8 * LARGE_BLOCK_SIZE);
+    TEST_ASSERT_NOT_NULL(ptr);
+    assert_filled(ptr, LARGE_BLOCK_SIZE, 2);
+    TEST_ASSERT_EQUAL_size_t(8 * LARGE_BLOCK_SIZE, mmanager_usable_size(ptr));
+    memset(ptr + LARGE_BLOCK_SIZE, 'x', 7 * LARGE_BLOCK_SIZE);
+
+    ptr = reallocate(ptr, LARGE_BLOCK_SIZE / 2);
+    TEST_ASSERT_NOT_NULL(ptr);
+    assert_filled(ptr, LARGE_BLOCK_SIZE / 2, 2);
+
+    struct mmanager_stats stats = get_stats();
+    TEST_ASSERT_EQUAL_size_t(1, stats.mapped_blocks);
+    TEST_ASSERT_EQUAL_size_t(LARGE_BLOCK_SIZE / 2, stats.mapped_bytes);
+    deallocate(ptr);
+    TEST_ASSERT_EQUAL_size_t(0, get_stats().mapped_blocks);
+}
+TEST(mmry_alloc_mmap, ReallocateMovesGrowingBlockOutOfArena) {
+    unsigned char *ptr = allocate(MMAP_THRESHOLD / 2);
+    fill(ptr, MMAP_THRESHOLD / 2, 3);
+
+    ptr = reallocate(ptr, LARGE_BLOCK_SIZE);
+    TEST_ASSERT_NOT_NULL(ptr);
+    assert_filled(ptr, MMAP_THRESHOLD / 2, 3);
+
+    struct mmanager_stats stats = get_stats();
+    TEST_ASSERT_EQUAL_size_t(1, stats.mapped_blocks);
+    TEST_ASSERT_EQUAL_size_t(0, stats.allocated_blocks);
+    deallocate(ptr);
+}
+TEST(mmry_alloc_mmap, DoubleFreeIsRejected) {
+    void *ptr = allocate(LARGE_BLOCK_SIZE);
+    deallocate(ptr);
+    deallocate(ptr);
+    TEST_ASSERT_EQUAL_size_t(1, get_stats().invalid_frees);
+    TEST_ASSERT_NULL(reallocate(ptr, 2 * LARGE_BLOCK_SIZE));
+    TEST_ASSERT_EQUAL_size_t(2, get_stats().invalid_frees);
+}
+TEST(mmry_alloc_mmap, ManyMappedBlocks) {
+    unsigned char *ptrs[N_LARGE_BLOCKS];
+    for (int i = 0; i < N_LARGE_BLOCKS; ++i) {
+        ptrs[i] = allocate(2 * MMAP_THRESHOLD);
+        TEST_ASSERT_NOT_NULL(ptrs[i]);
+        fill(ptrs[i], 2 * MMAP_THRESHOLD, (unsigned char)i);
+    }
+    TEST_ASSERT_EQUAL_size_t(N_LARGE_BLOCKS, get_stats().mapped_blocks);
+
+    // Free every other block, then check that the rest are still tracked.
+    for (int i = 0; i < N_LARGE_BLOCKS; i += 2) {
+        deallocate(ptrs[i]);
+    }
+    for (int i = 1; i < N_LARGE_BLOCKS; i += 2) {
+        TEST_ASSERT_EQUAL_size_t(2 * MMAP_THRESHOLD, mmanager_usable_size(ptrs[i]));
+        assert_filled(ptrs[i], 2 * MMAP_THRESHOLD, (unsigned char)i);
+        deallocate(ptrs[i]);
+    }
+
+    struct mmanager_stats stats = get_stats();
+    TEST_ASSERT_EQUAL_size_t(0, stats.mapped_blocks);
+    TEST_ASSERT_EQUAL_size_t(0, stats.invalid_frees);
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
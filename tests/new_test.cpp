@@ -0,0 +1,98 @@
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+/*
+ * Linked with the mmanager_new library, so every operator new and delete in
+ * this program goes through mmanager. The arena is created by the first
+ * allocation and must not be initialized or destroyed here.
+ */
+
+
+// An over-aligned type.
+struct alignas(256) wide {
+    char bytes[256];
+};
+
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_new);
+TEST_SETUP(mmry_alloc_new) {
+}
+TEST_TEAR_DOWN(mmry_alloc_new) {
+}
+TEST_GROUP_RUNNER(mmry_alloc_new) {
+    RUN_TEST_CASE(mmry_alloc_new, NewDelete);
+    RUN_TEST_CASE(mmry_alloc_new, ArrayNewDelete);
+    RUN_TEST_CASE(mmry_alloc_new, AlignedNewDelete);
+    RUN_TEST_CASE(mmry_alloc_new, Nothrow);
+    RUN_TEST_CASE(mmry_alloc_new, Containers);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_new);
+}
+
+// Tests.
+TEST(mmry_alloc_new, NewDelete) {
+    size_t available = mmanager_available_memory();
+    long *value = new long(42);
+    TEST_ASSERT_TRUE(mmanager_available_memory() < available);
+    TEST_ASSERT_EQUAL_size_t(16, mmanager_usable_size(value));
+    delete value;
+    TEST_ASSERT_EQUAL_size_t(available, mmanager_available_memory());
+}
+TEST(mmry_alloc_new, ArrayNewDelete) {
+    size_t available = mmanager_available_memory();
+    int *values = new int[100];
+    TEST_ASSERT_TRUE(mmanager_usable_size(values) >= 100 * sizeof(int));
+    delete[] values;
+    TEST_ASSERT_EQUAL_size_t(available, mmanager_available_memory());
+}
+TEST(mmry_alloc_new, AlignedNewDelete) {
+    size_t available = mmanager_available_memory();
+    wide *one = new wide;
+    wide *many = new wide[3];
+    TEST_ASSERT_EQUAL_UINT64(0, reinterpret_cast<uintptr_t>(one) % alignof(wide));
+    TEST_ASSERT_EQUAL_UINT64(0, reinterpret_cast<uintptr_t>(many) % alignof(wide));
+    delete[] many;
+    delete one;
+    TEST_ASSERT_EQUAL_size_t(available, mmanager_available_memory());
+}
+TEST(mmry_alloc_new, Nothrow) {
+    size_t available = mmanager_available_memory();
+    TEST_ASSERT_NULL(operator new(available + 1, std::nothrow));
+
+    bool thrown = false;
+    try {
+        operator delete(operator new(available + 1));
+    }
+    catch (const std::bad_alloc &) {
+        thrown = true;
+    }
+    TEST_ASSERT_TRUE(thrown);
+}
+TEST(mmry_alloc_new, Containers) {
+    size_t available = mmanager_available_memory();
+    {
+        std::vector<std::string> strings;
+        for (int i = 0; i < 100; ++i) {
+            strings.push_back(std::string(64, 'a' + i % 26));
+        }
+        auto shared = std::make_shared<std::vector<std::string>>(strings);
+        TEST_ASSERT_EQUAL_size_t(100, shared->size());
+        TEST_ASSERT_TRUE(mmanager_available_memory() < available);
+    }
+    TEST_ASSERT_EQUAL_size_t(available, mmanager_available_memory());
+}
+
+int main(int argc, const char **argv) {
+    // Create the arena before the tests measure it.
+    delete new char;
+    return UnityMain(argc, argv, RunAllTests);
+}
@@ -0,0 +1,69 @@
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+
+#define HEADER_SIZE 16
+#define MMRY_ALLOC_SIZE 2048
+
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_no_locking);
+TEST_SETUP(mmry_alloc_no_locking) {
+    struct mmanager_options options = { MMRY_ALLOC_SIZE, BEST_FIT, MMANAGER_NO_LOCKING };
+    mmanager_initialize_with_options(&options);
+}
+TEST_TEAR_DOWN(mmry_alloc_no_locking) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_no_locking) {
+    RUN_TEST_CASE(mmry_alloc_no_locking, AllocDealloc);
+    RUN_TEST_CASE(mmry_alloc_no_locking, PolicyIsApplied);
+    RUN_TEST_CASE(mmry_alloc_no_locking, Compact);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_no_locking);
+}
+
+// Tests.
+TEST(mmry_alloc_no_locking, AllocDealloc) {
+    void *ptr1 = allocate(64);
+    void *ptr2 = callocate(4, 8);
+    TEST_ASSERT_EQUAL_PTR((char *)ptr1 + 64 + HEADER_SIZE, ptr2);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - 3 * HEADER_SIZE - 96, mmanager_available_memory());
+
+    deallocate(ptr1);
+    deallocate(ptr2);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_no_locking, PolicyIsApplied) {
+    void *big = allocate(128);
+    void *blocker1 = allocate(16);
+    void *small = allocate(32);
+    void *blocker2 = allocate(16);
+    deallocate(big);
+    deallocate(small);
+
+    // Best fit picks the 32-byte hole over the earlier 128-byte one.
+    TEST_ASSERT_EQUAL_PTR(small, allocate(24));
+
+    deallocate(blocker1);
+    deallocate(blocker2);
+}
+TEST(mmry_alloc_no_locking, Compact) {
+    void *ptr1 = allocate(32);
+    void *ptr2 = allocate(32);
+    deallocate(ptr1);
+
+    void *before[1];
+    void *after[1];
+    TEST_ASSERT_EQUAL_size_t(1, mmanager_compact(before, after));
+    TEST_ASSERT_EQUAL_PTR(ptr2, before[0]);
+    TEST_ASSERT_EQUAL_PTR(ptr1, after[0]);
+    deallocate(after[0]);
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
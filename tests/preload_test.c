@@ -0,0 +1,106 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+/*
+ * Runs with LD_PRELOAD pointing at the mmanager_preload library (see
+ * CMakeLists.txt), so the standard allocation functions below are served by
+ * mmanager.
+ */
+
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_preload);
+TEST_SETUP(mmry_alloc_preload) {
+}
+TEST_TEAR_DOWN(mmry_alloc_preload) {
+}
+TEST_GROUP_RUNNER(mmry_alloc_preload) {
+    RUN_TEST_CASE(mmry_alloc_preload, Interposed);
+    RUN_TEST_CASE(mmry_alloc_preload, Malloc);
+    RUN_TEST_CASE(mmry_alloc_preload, Calloc);
+    RUN_TEST_CASE(mmry_alloc_preload, CallocOverflow);
+    RUN_TEST_CASE(mmry_alloc_preload, Realloc);
+    RUN_TEST_CASE(mmry_alloc_preload, Aligned);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_preload);
+}
+
+// Tests.
+TEST(mmry_alloc_preload, Interposed) {
+    TEST_ASSERT_NOT_NULL(dlsym(RTLD_DEFAULT, "mmanager_available_memory"));
+}
+TEST(mmry_alloc_preload, Malloc) {
+    void *ptr = malloc(1);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_UINT64(0, (uintptr_t)ptr % 16);
+    TEST_ASSERT_EQUAL_size_t(16, malloc_usable_size(ptr));
+    free(ptr);
+
+    ptr = malloc(0);
+    TEST_ASSERT_NOT_NULL(ptr);
+    free(ptr);
+    free(NULL);
+}
+TEST(mmry_alloc_preload, Calloc) {
+    unsigned char *ptr = calloc(100, 10);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EACH_EQUAL_UINT8(0, ptr, 1000);
+    free(ptr);
+}
+TEST(mmry_alloc_preload, CallocOverflow) {
+    // Keep the compiler from rejecting the obviously oversized request.
+    volatile size_t n = SIZE_MAX / 2;
+    errno = 0;
+    TEST_ASSERT_NULL(calloc(n, 3));
+    TEST_ASSERT_EQUAL_INT(ENOMEM, errno);
+}
+TEST(mmry_alloc_preload, Realloc) {
+    char *ptr = realloc(NULL, 10);
+    TEST_ASSERT_NOT_NULL(ptr);
+    memcpy(ptr, "mmanager!", 10);
+
+    ptr = realloc(ptr, 100000);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_STRING("mmanager!", ptr);
+
+    ptr = realloc(ptr, 5);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_MEMORY("mmana", ptr, 5);
+
+    TEST_ASSERT_NULL(realloc(ptr, 0));
+}
+TEST(mmry_alloc_preload, Aligned) {
+    void *ptr = NULL;
+    TEST_ASSERT_EQUAL_INT(0, posix_memalign(&ptr, 4096, 100));
+    TEST_ASSERT_EQUAL_UINT64(0, (uintptr_t)ptr % 4096);
+    free(ptr);
+    TEST_ASSERT_EQUAL_INT(EINVAL, posix_memalign(&ptr, 24, 100));
+    TEST_ASSERT_EQUAL_INT(EINVAL, posix_memalign(&ptr, 4, 100));
+
+    ptr = aligned_alloc(256, 512);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_UINT64(0, (uintptr_t)ptr % 256);
+    free(ptr);
+
+    ptr = memalign(64, 10);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_UINT64(0, (uintptr_t)ptr % 64);
+    free(ptr);
+
+    ptr = valloc(1);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_UINT64(0, (uintptr_t)ptr % 4096);
+    free(ptr);
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
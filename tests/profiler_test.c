@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+
+#define MMRY_ALLOC_SIZE 65536
+#define PROFILE_SIZE 65536
+#define N 8
+
+static char profile[PROFILE_SIZE];
+
+// Writes the profile to a temporary file and reads it back into `profile`.
+static void write_and_read_profile(void);
+
+// Parses the totals line at the start of `profile`.
+static void read_totals(size_t *live_count, size_t *live_bytes, size_t *total_count, size_t *total_bytes);
+
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_profiler);
+TEST_SETUP(mmry_alloc_profiler) {
+    mmanager_initialize(MMRY_ALLOC_SIZE, FIRST_FIT);
+}
+TEST_TEAR_DOWN(mmry_alloc_profiler) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_profiler) {
+    RUN_TEST_CASE(mmry_alloc_profiler, EmptyProfile);
+    RUN_TEST_CASE(mmry_alloc_profiler, EverySampledWhilstLive);
+    RUN_TEST_CASE(mmry_alloc_profiler, SampleFollowsCompaction);
+    RUN_TEST_CASE(mmry_alloc_profiler, SparseSampling);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_profiler);
+}
+
+// Tests.
+TEST(mmry_alloc_profiler, EmptyProfile) {
+    mmanager_profiler_start(0);
+    write_and_read_profile();
+
+    size_t live_count, live_bytes, total_count, total_bytes;
+    read_totals(&live_count, &live_bytes, &total_count, &total_bytes);
+    TEST_ASSERT_EQUAL_size_t(0, live_count);
+    TEST_ASSERT_EQUAL_size_t(0, total_count);
+    TEST_ASSERT_NOT_NULL(strstr(profile, "@ heap_v2/524288\n"));
+    TEST_ASSERT_NOT_NULL(strstr(profile, "\nMAPPED_LIBRARIES:\n"));
+}
+TEST(mmry_alloc_profiler, EverySampledWhilstLive) {
+    // A period of one byte samples every allocation.
+    mmanager_profiler_start(1);
+    void *ptrs[N];
+    for (int i = 0; i < N; ++i) {
+        ptrs[i] = allocate(16);
+    }
+    for (int i = 0; i < N; i += 2) {
+        deallocate(ptrs[i]);
+    }
+    write_and_read_profile();
+
+    size_t live_count, live_bytes, total_count, total_bytes;
+    read_totals(&live_count, &live_bytes, &total_count, &total_bytes);
+    TEST_ASSERT_EQUAL_size_t(N / 2, live_count);
+    TEST_ASSERT_EQUAL_size_t(N / 2 * 16, live_bytes);
+    TEST_ASSERT_EQUAL_size_t(N, total_count);
+    TEST_ASSERT_EQUAL_size_t(N * 16, total_bytes);
+
+    // All allocations come from the same call site.
+    TEST_ASSERT_NOT_NULL(strstr(profile, "\n     4:       64 [     8:      128] @ 0x"));
+
+    for (int i = 1; i < N; i += 2) {
+        deallocate(ptrs[i]);
+    }
+    write_and_read_profile();
+    read_totals(&live_count, &live_bytes, &total_count, &total_bytes);
+    TEST_ASSERT_EQUAL_size_t(0, live_count);
+    TEST_ASSERT_EQUAL_size_t(N, total_count);
+}
+TEST(mmry_alloc_profiler, SampleFollowsCompaction) {
+    void *ptr1 = allocate(32);
+    mmanager_profiler_start(1);
+    void *ptr2 = allocate(32);
+    deallocate(ptr1);
+
+    void *before[1];
+    void *after[1];
+    TEST_ASSERT_EQUAL_size_t(1, mmanager_compact(before, after));
+    TEST_ASSERT_EQUAL_PTR(ptr2, before[0]);
+
+    // The moved sample must still be released by deallocating its new address.
+    deallocate(after[0]);
+    write_and_read_profile();
+
+    size_t live_count, live_bytes, total_count, total_bytes;
+    read_totals(&live_count, &live_bytes, &total_count, &total_bytes);
+    TEST_ASSERT_EQUAL_size_t(0, live_count);
+    TEST_ASSERT_EQUAL_size_t(1, total_count);
+}
+TEST(mmry_alloc_profiler, SparseSampling) {
+    // With a large period only a small fraction of allocations is sampled.
+    mmanager_profiler_start(4096);
+    for (int i = 0; i < 1000; ++i) {
+        deallocate(allocate(16));
+    }
+    write_and_read_profile();
+
+    size_t live_count, live_bytes, total_count, total_bytes;
+    read_totals(&live_count, &live_bytes, &total_count, &total_bytes);
+    TEST_ASSERT_EQUAL_size_t(0, live_count);
+    TEST_ASSERT_TRUE(total_count < 100);
+}
+
+static void write_and_read_profile(void) {
+    FILE *file = tmpfile();
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_EQUAL_INT(0, mmanager_profiler_write(fileno(file)));
+
+    rewind(file);
+    size_t n = fread(profile, 1, PROFILE_SIZE - 1, file);
+    profile[n] = '\0';
+    fclose(file);
+}
+
+static void read_totals(size_t *live_count, size_t *live_bytes, size_t *total_count, size_t *total_bytes) {
+    TEST_ASSERT_EQUAL_INT(4, sscanf(profile, "heap profile: %zu: %zu [%zu: %zu]",
+        live_count, live_bytes, total_count, total_bytes));
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
@@ -0,0 +1,144 @@
+#include <stdint.h>
+#include <string.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+
+#define HEADER_SIZE 16
+#define MMRY_ALLOC_SIZE 4096
+
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_reallocate);
+TEST_SETUP(mmry_alloc_reallocate) {
+    mmanager_initialize(MMRY_ALLOC_SIZE, FIRST_FIT);
+}
+TEST_TEAR_DOWN(mmry_alloc_reallocate) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_reallocate) {
+    RUN_TEST_CASE(mmry_alloc_reallocate, NullPointerAllocates);
+    RUN_TEST_CASE(mmry_alloc_reallocate, ZeroSizeDeallocates);
+    RUN_TEST_CASE(mmry_alloc_reallocate, ShrinkInPlace);
+    RUN_TEST_CASE(mmry_alloc_reallocate, GrowInPlace);
+    RUN_TEST_CASE(mmry_alloc_reallocate, GrowByMoving);
+    RUN_TEST_CASE(mmry_alloc_reallocate, GrowFails);
+    RUN_TEST_CASE(mmry_alloc_reallocate, Aligned);
+    RUN_TEST_CASE(mmry_alloc_reallocate, AlignedKeepsLeadingGap);
+    RUN_TEST_CASE(mmry_alloc_reallocate, HugeAlignedRequestFails);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_reallocate);
+}
+
+// Tests.
+TEST(mmry_alloc_reallocate, NullPointerAllocates) {
+    void *ptr = reallocate(NULL, 32);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_size_t(32, mmanager_usable_size(ptr));
+    deallocate(ptr);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_reallocate, ZeroSizeDeallocates) {
+    void *ptr = allocate(32);
+    TEST_ASSERT_NULL(reallocate(ptr, 0));
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_reallocate, ShrinkInPlace) {
+    char *ptr = allocate(128);
+    memset(ptr, 'a', 128);
+
+    char *new_ptr = reallocate(ptr, 32);
+    TEST_ASSERT_EQUAL_PTR(ptr, new_ptr);
+    TEST_ASSERT_EQUAL_size_t(32, mmanager_usable_size(new_ptr));
+    TEST_ASSERT_EACH_EQUAL_CHAR('a', new_ptr, 32);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - 2 * HEADER_SIZE - 32, mmanager_available_memory());
+
+    deallocate(new_ptr);
+}
+TEST(mmry_alloc_reallocate, GrowInPlace) {
+    char *ptr = allocate(32);
+    memset(ptr, 'b', 32);
+
+    char *new_ptr = reallocate(ptr, 256);
+    TEST_ASSERT_EQUAL_PTR(ptr, new_ptr);
+    TEST_ASSERT_EQUAL_size_t(256, mmanager_usable_size(new_ptr));
+    TEST_ASSERT_EACH_EQUAL_CHAR('b', new_ptr, 32);
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(256, stats.allocated_bytes);
+    TEST_ASSERT_EQUAL_size_t(1, stats.allocated_blocks);
+
+    deallocate(new_ptr);
+}
+TEST(mmry_alloc_reallocate, GrowByMoving) {
+    char *ptr = allocate(32);
+    void *blocker = allocate(32);
+    memset(ptr, 'c', 32);
+
+    char *new_ptr = reallocate(ptr, 256);
+    TEST_ASSERT_NOT_NULL(new_ptr);
+    TEST_ASSERT_TRUE(new_ptr != ptr);
+    TEST_ASSERT_EACH_EQUAL_CHAR('c', new_ptr, 32);
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(256 + 32, stats.allocated_bytes);
+    TEST_ASSERT_EQUAL_size_t(2, stats.allocated_blocks);
+
+    deallocate(new_ptr);
+    deallocate(blocker);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_reallocate, GrowFails) {
+    char *ptr = allocate(32);
+    void *blocker = allocate(32);
+    memset(ptr, 'd', 32);
+
+    // The original block is left untouched.
+    TEST_ASSERT_NULL(reallocate(ptr, MMRY_ALLOC_SIZE));
+    TEST_ASSERT_EQUAL_size_t(32, mmanager_usable_size(ptr));
+    TEST_ASSERT_EACH_EQUAL_CHAR('d', ptr, 32);
+
+    deallocate(ptr);
+    deallocate(blocker);
+}
+TEST(mmry_alloc_reallocate, Aligned) {
+    size_t alignments[] = { 16, 64, 256, 1024 };
+    for (size_t i = 0; i < sizeof(alignments) / sizeof(*alignments); ++i) {
+        void *ptr = allocate_aligned(alignments[i], 48);
+        TEST_ASSERT_NOT_NULL(ptr);
+        TEST_ASSERT_EQUAL_UINT64(0, (uintptr_t)ptr % alignments[i]);
+        TEST_ASSERT_EQUAL_size_t(48, mmanager_usable_size(ptr));
+        deallocate(ptr);
+    }
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_reallocate, AlignedKeepsLeadingGap) {
+    void *small = allocate(16);
+    void *ptr = allocate_aligned(1024, 64);
+    TEST_ASSERT_NOT_NULL(ptr);
+    TEST_ASSERT_EQUAL_UINT64(0, (uintptr_t)ptr % 1024);
+
+    // The gap in front of the aligned block remains usable.
+    void *filler = allocate(16);
+    TEST_ASSERT_TRUE((char *)filler < (char *)ptr);
+
+    deallocate(filler);
+    deallocate(ptr);
+    deallocate(small);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_reallocate, HugeAlignedRequestFails) {
+    TEST_ASSERT_NULL(allocate_aligned(64, SIZE_MAX - 15));
+    TEST_ASSERT_NULL(allocate_aligned(1024, SIZE_MAX - 1023));
+    TEST_ASSERT_EQUAL_size_t(0, mmanager_check());
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - HEADER_SIZE, mmanager_available_memory());
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
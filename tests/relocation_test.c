@@ -0,0 +1,141 @@
+#include <stdint.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+
+#define HEADER_SIZE 16
+#define MMRY_ALLOC_SIZE (256 * 1024)
+#define N1 32
+#define N2 4096
+
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_relocation);
+TEST_SETUP(mmry_alloc_relocation) {
+    mmanager_initialize(MMRY_ALLOC_SIZE, FIRST_FIT);
+}
+TEST_TEAR_DOWN(mmry_alloc_relocation) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_relocation) {
+    RUN_TEST_CASE(mmry_alloc_relocation, EmptyMap);
+    RUN_TEST_CASE(mmry_alloc_relocation, FixupAfterCompaction);
+    RUN_TEST_CASE(mmry_alloc_relocation, UnmovedBlocks);
+    RUN_TEST_CASE(mmry_alloc_relocation, ArraysLeaveMapAlone);
+    RUN_TEST_CASE(mmry_alloc_relocation, NextCompactionReplacesMap);
+    RUN_TEST_CASE(mmry_alloc_relocation, Incremental);
+    RUN_TEST_CASE(mmry_alloc_relocation, ManyBlocks);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_relocation);
+}
+
+// Tests.
+TEST(mmry_alloc_relocation, EmptyMap) {
+    int *ptr = allocate(sizeof(*ptr));
+    TEST_ASSERT_EQUAL_PTR(ptr, mmanager_relocate(ptr));
+    deallocate(ptr);
+}
+TEST(mmry_alloc_relocation, FixupAfterCompaction) {
+    int *arr[N1];
+    for (int i = 0; i < N1; ++i) {
+        arr[i] = allocate(sizeof(*arr[i]));
+        *arr[i] = i * i;
+    }
+    for (int i = 0; i < N1; ++i) {
+        if (i % 5 == 0 || i % 7 == 0) {
+            deallocate(arr[i]);
+            arr[i] = NULL;
+        }
+    }
+
+    size_t n = mmanager_compact(NULL, NULL);
+    TEST_ASSERT_TRUE(n > 0);
+    mmanager_fixup((void **)arr, N1);
+
+    for (int i = 0; i < N1; ++i) {
+        if (i % 5 == 0 || i % 7 == 0) {
+            TEST_ASSERT_NULL(arr[i]);
+        }
+        else {
+            TEST_ASSERT_EQUAL_INT(i * i, *arr[i]);
+        }
+    }
+}
+TEST(mmry_alloc_relocation, UnmovedBlocks) {
+    int *first = allocate(sizeof(*first));
+    int *hole = allocate(sizeof(*hole));
+    int *last = allocate(sizeof(*last));
+    deallocate(hole);
+
+    TEST_ASSERT_EQUAL_size_t(1, mmanager_compact(NULL, NULL));
+    TEST_ASSERT_EQUAL_PTR(first, mmanager_relocate(first));
+    TEST_ASSERT_EQUAL_PTR(hole, mmanager_relocate(last));
+}
+TEST(mmry_alloc_relocation, ArraysLeaveMapAlone) {
+    int *first_hole = allocate(sizeof(*first_hole));
+    int *ptr = allocate(sizeof(*ptr));
+    deallocate(first_hole);
+    TEST_ASSERT_EQUAL_size_t(1, mmanager_compact(NULL, NULL));
+
+    int *hole = allocate(sizeof(*hole));
+    int *other = allocate(sizeof(*other));
+    deallocate(hole);
+    void *before[1];
+    void *after[1];
+    TEST_ASSERT_EQUAL_size_t(1, mmanager_compact(before, after));
+
+    // Still the moves of the first compaction.
+    TEST_ASSERT_EQUAL_PTR(first_hole, mmanager_relocate(ptr));
+    TEST_ASSERT_EQUAL_PTR(other, mmanager_relocate(other));
+}
+TEST(mmry_alloc_relocation, NextCompactionReplacesMap) {
+    int *hole = allocate(sizeof(*hole));
+    int *ptr = allocate(sizeof(*ptr));
+    deallocate(hole);
+    TEST_ASSERT_EQUAL_size_t(1, mmanager_compact(NULL, NULL));
+    TEST_ASSERT_EQUAL_PTR(hole, mmanager_relocate(ptr));
+
+    TEST_ASSERT_EQUAL_size_t(0, mmanager_compact(NULL, NULL));
+    TEST_ASSERT_EQUAL_PTR(ptr, mmanager_relocate(ptr));
+}
+TEST(mmry_alloc_relocation, Incremental) {
+    int *arr[N1];
+    for (int i = 0; i < N1; ++i) {
+        arr[i] = allocate(sizeof(*arr[i]));
+        *arr[i] = i;
+    }
+    for (int i = 0; i < N1; i += 2) {
+        deallocate(arr[i]);
+        arr[i] = NULL;
+    }
+
+    while (mmanager_compact_incremental(0, 3, NULL, NULL) > 0) {
+        mmanager_fixup((void **)arr, N1);
+    }
+    for (int i = 1; i < N1; i += 2) {
+        TEST_ASSERT_EQUAL_INT(i, *arr[i]);
+    }
+}
+TEST(mmry_alloc_relocation, ManyBlocks) {
+    // More moves than the map starts out with.
+    static int *arr[N2];
+    for (int i = 0; i < N2; ++i) {
+        arr[i] = allocate(sizeof(*arr[i]));
+        *arr[i] = i;
+    }
+    deallocate(arr[0]);
+    arr[0] = NULL;
+
+    TEST_ASSERT_EQUAL_size_t(N2 - 1, mmanager_compact(NULL, NULL));
+    mmanager_fixup((void **)arr, N2);
+    for (int i = 1; i < N2; ++i) {
+        TEST_ASSERT_EQUAL_INT(i, *arr[i]);
+    }
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
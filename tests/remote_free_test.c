@@ -0,0 +1,364 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+
+#define HEADER_SIZE 16
+#define N_ARENAS 4
+#define ARENA_SIZE (64 * 1024)
+#define MMRY_ALLOC_SIZE (N_ARENAS * ARENA_SIZE)
+#define N_THREADS 4
+#define N_BLOCKS 512
+#define N_MIXED_BLOCKS 1000
+#define N_ROUNDS 5
+#define N_CHECKED_BLOCKS 2000
+
+static void *checked_blocks[N_CHECKED_BLOCKS];
+static int freed_count;
+
+// Blocks of one round of the maintenance test: raw blocks and handle blocks in
+// turn, every other handle block freed again.
+struct mixed_blocks {
+    void *raw[N_MIXED_BLOCKS];
+    mm_handle_t handles[N_MIXED_BLOCKS];
+};
+
+struct handoff {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int step;
+    void *first;
+    void *second;
+};
+
+// Allocates a block of 64 bytes and stores it in `*(void **)arg`.
+static void *allocate_thread(void *arg);
+
+// Deallocates the block `arg`.
+static void *deallocate_thread(void *arg);
+
+// Allocates `handoff->first`, waits for it to be freed by another thread, then
+// allocates `handoff->second`.
+static void *owner_thread(void *arg);
+
+// Allocates N_BLOCKS blocks into the array `arg`.
+static void *allocate_many_thread(void *arg);
+
+// Deallocates the N_BLOCKS blocks of the array `arg`.
+static void *deallocate_many_thread(void *arg);
+
+// Fills the `struct mixed_blocks` `arg`.
+static void *allocate_mixed_thread(void *arg);
+
+// Deallocates the raw blocks of the `struct mixed_blocks` `arg`.
+static void *deallocate_raw_thread(void *arg);
+
+// Allocates N_CHECKED_BLOCKS blocks into `checked_blocks`.
+static void *allocate_checked_thread(void *arg);
+
+// Deallocates the blocks of `checked_blocks`, counting them in `freed_count`.
+static void *free_checked_thread(void *arg);
+
+// Blocks until `handoff->step` reaches `step`.
+static void wait_for_step(struct handoff *handoff, int step);
+
+// Sets `handoff->step` to `step`.
+static void set_step(struct handoff *handoff, int step);
+
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_remote_free);
+TEST_SETUP(mmry_alloc_remote_free) {
+    struct mmanager_options options = {
+        MMRY_ALLOC_SIZE, FIRST_FIT, 0, N_ARENAS, MMANAGER_ARENA_ROUND_ROBIN
+    };
+    mmanager_initialize_with_options(&options);
+}
+TEST_TEAR_DOWN(mmry_alloc_remote_free) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_remote_free) {
+    RUN_TEST_CASE(mmry_alloc_remote_free, LocalFreeIsNotQueued);
+    RUN_TEST_CASE(mmry_alloc_remote_free, RemoteFreeIsQueued);
+    RUN_TEST_CASE(mmry_alloc_remote_free, OwnerDrainsOnAllocation);
+    RUN_TEST_CASE(mmry_alloc_remote_free, TinyBlockIsFreedDirectly);
+    RUN_TEST_CASE(mmry_alloc_remote_free, ConcurrentRemoteFrees);
+    RUN_TEST_CASE(mmry_alloc_remote_free, MaintenanceDuringRemoteFrees);
+    RUN_TEST_CASE(mmry_alloc_remote_free, CheckDuringRemoteFrees);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_remote_free);
+}
+
+// Tests.
+TEST(mmry_alloc_remote_free, LocalFreeIsNotQueued) {
+    void *ptr = allocate(64);
+    deallocate(ptr);
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(0, stats.remote_frees);
+    TEST_ASSERT_EQUAL_size_t(0, stats.allocated_blocks);
+}
+TEST(mmry_alloc_remote_free, RemoteFreeIsQueued) {
+    // Threads take their arenas in turn on first use, so these two get
+    // different ones.
+    void *ptr;
+    pthread_t thread;
+    pthread_create(&thread, NULL, allocate_thread, &ptr);
+    pthread_join(thread, NULL);
+    TEST_ASSERT_NOT_NULL(ptr);
+
+    pthread_create(&thread, NULL, deallocate_thread, ptr);
+    pthread_join(thread, NULL);
+
+    // Getting the statistics drains the queue.
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(1, stats.remote_frees);
+    TEST_ASSERT_EQUAL_size_t(0, stats.allocated_blocks);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - N_ARENAS * HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_remote_free, OwnerDrainsOnAllocation) {
+    struct handoff handoff = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, NULL, NULL };
+    pthread_t owner;
+    pthread_create(&owner, NULL, owner_thread, &handoff);
+    wait_for_step(&handoff, 1);
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, deallocate_thread, handoff.first);
+    pthread_join(thread, NULL);
+
+    set_step(&handoff, 2);
+    pthread_join(owner, NULL);
+
+    // The queued block was freed before the search, so first fit reuses it.
+    TEST_ASSERT_NOT_NULL(handoff.first);
+    TEST_ASSERT_EQUAL_PTR(handoff.first, handoff.second);
+
+    deallocate(handoff.second);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - N_ARENAS * HEADER_SIZE, mmanager_available_memory());
+}
+TEST(mmry_alloc_remote_free, TinyBlockIsFreedDirectly) {
+    // Too small to hold the queue link.
+    void *tiny = allocate(1);
+    pthread_t thread;
+    pthread_create(&thread, NULL, deallocate_thread, tiny);
+    pthread_join(thread, NULL);
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(0, stats.remote_frees);
+    TEST_ASSERT_EQUAL_size_t(0, stats.allocated_blocks);
+}
+TEST(mmry_alloc_remote_free, ConcurrentRemoteFrees) {
+    static void *blocks[N_THREADS][N_BLOCKS];
+    pthread_t threads[N_THREADS];
+    for (int i = 0; i < N_THREADS; ++i) {
+        pthread_create(&threads[i], NULL, allocate_many_thread, blocks[i]);
+    }
+    for (int i = 0; i < N_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // Every thread frees the blocks of another one while the owners of the
+    // arenas keep allocating.
+    pthread_t freeing[N_THREADS];
+    for (int i = 0; i < N_THREADS; ++i) {
+        pthread_create(&freeing[i], NULL, deallocate_many_thread, blocks[(i + 1) % N_THREADS]);
+    }
+    for (int i = 0; i < N_THREADS; ++i) {
+        pthread_create(&threads[i], NULL, allocate_many_thread, blocks[i] + N_BLOCKS / 2);
+    }
+    for (int i = 0; i < N_THREADS; ++i) {
+        pthread_join(freeing[i], NULL);
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < N_THREADS; ++i) {
+        for (int j = N_BLOCKS / 2; j < N_BLOCKS; ++j) {
+            if (blocks[i][j]) {
+                deallocate(blocks[i][j]);
+            }
+        }
+    }
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(0, stats.allocated_blocks);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - N_ARENAS * HEADER_SIZE, mmanager_available_memory());
+}
+
+TEST(mmry_alloc_remote_free, MaintenanceDuringRemoteFrees) {
+    // The maintenance thread compacts handle blocks past raw blocks that are
+    // being freed into the queue of their arena.
+    mmanager_destroy();
+    struct mmanager_options options = {
+        .size = MMRY_ALLOC_SIZE * 4,
+        .allocation_policy = FIRST_FIT,
+        .flags = MMANAGER_BACKGROUND_MAINTENANCE,
+        .arenas = 2,
+        .maintenance_interval_ms = 1,
+        .maintenance_duty_cycle = 50,
+        .invalid_free_action = MMANAGER_INVALID_FREE_IGNORE,
+    };
+    mmanager_initialize_with_options(&options);
+
+    static struct mixed_blocks blocks;
+    for (int round = 0; round < N_ROUNDS; ++round) {
+        // Threads take their arenas in turn, so the raw blocks are freed
+        // from the other arena.
+        pthread_t thread;
+        pthread_create(&thread, NULL, allocate_mixed_thread, &blocks);
+        pthread_join(thread, NULL);
+        pthread_create(&thread, NULL, deallocate_raw_thread, &blocks);
+        pthread_join(thread, NULL);
+        nanosleep(&(struct timespec){ 0, 20000000 }, NULL);
+
+        TEST_ASSERT_EQUAL_size_t(0, mmanager_check());
+        for (int i = 1; i < N_MIXED_BLOCKS; i += 2) {
+            char *ptr = mm_pin(blocks.handles[i]);
+            TEST_ASSERT_EACH_EQUAL_CHAR((char)i, ptr, 64);
+            mm_unpin(blocks.handles[i]);
+            deallocate_handle(blocks.handles[i]);
+        }
+    }
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(0, stats.allocated_blocks);
+}
+
+TEST(mmry_alloc_remote_free, CheckDuringRemoteFrees) {
+    // Blocks freed into the queue of their arena while the heap is checked
+    // are not damage.
+    mmanager_destroy();
+    struct mmanager_options options = {
+        .size = MMRY_ALLOC_SIZE * 4,
+        .allocation_policy = FIRST_FIT,
+        .arenas = 2,
+        .invalid_free_action = MMANAGER_INVALID_FREE_IGNORE,
+    };
+    mmanager_initialize_with_options(&options);
+
+    // Threads take their arenas in turn, so the blocks are freed from the
+    // other arena. They are all allocated first: a check holding the lock of
+    // the owner's arena would send its allocations to the other one.
+    __atomic_store_n(&freed_count, 0, __ATOMIC_RELAXED);
+    pthread_t thread;
+    pthread_create(&thread, NULL, allocate_checked_thread, NULL);
+    pthread_join(thread, NULL);
+    pthread_create(&thread, NULL, free_checked_thread, NULL);
+
+    size_t problems = 0;
+    while (__atomic_load_n(&freed_count, __ATOMIC_ACQUIRE) < N_CHECKED_BLOCKS) {
+        problems += mmanager_check();
+    }
+    pthread_join(thread, NULL);
+    problems += mmanager_check();
+    TEST_ASSERT_EQUAL_size_t(0, problems);
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(0, stats.heap_corruptions);
+    TEST_ASSERT_EQUAL_size_t(0, stats.allocated_blocks);
+    TEST_ASSERT_EQUAL_size_t(N_CHECKED_BLOCKS, stats.remote_frees);
+}
+
+static void *allocate_thread(void *arg) {
+    *(void **)arg = allocate(64);
+    return NULL;
+}
+
+static void *deallocate_thread(void *arg) {
+    deallocate(arg);
+    return NULL;
+}
+
+static void *owner_thread(void *arg) {
+    struct handoff *handoff = arg;
+    handoff->first = allocate(64);
+    set_step(handoff, 1);
+    wait_for_step(handoff, 2);
+    handoff->second = allocate(64);
+    return NULL;
+}
+
+static void *allocate_many_thread(void *arg) {
+    void **blocks = arg;
+    for (int i = 0; i < N_BLOCKS / 2; ++i) {
+        blocks[i] = allocate(32);
+        memset(blocks[i], 0xab, 32);
+    }
+    return NULL;
+}
+
+static void *deallocate_many_thread(void *arg) {
+    void **blocks = arg;
+    for (int i = 0; i < N_BLOCKS / 2; ++i) {
+        deallocate(blocks[i]);
+    }
+    return NULL;
+}
+
+static void *allocate_mixed_thread(void *arg) {
+    struct mixed_blocks *blocks = arg;
+    for (int i = 0; i < N_MIXED_BLOCKS; ++i) {
+        blocks->raw[i] = allocate(64);
+        blocks->handles[i] = allocate_handle(64);
+        memset(mm_pin(blocks->handles[i]), (char)i, 64);
+        mm_unpin(blocks->handles[i]);
+    }
+    for (int i = 0; i < N_MIXED_BLOCKS; i += 2) {
+        deallocate_handle(blocks->handles[i]);
+    }
+    return NULL;
+}
+
+static void *deallocate_raw_thread(void *arg) {
+    struct mixed_blocks *blocks = arg;
+    for (int i = 0; i < N_MIXED_BLOCKS; ++i) {
+        deallocate(blocks->raw[i]);
+    }
+    return NULL;
+}
+
+static void *allocate_checked_thread(void *arg) {
+    (void)arg;
+    for (int i = 0; i < N_CHECKED_BLOCKS; ++i) {
+        checked_blocks[i] = allocate(64);
+    }
+    return NULL;
+}
+
+static void *free_checked_thread(void *arg) {
+    (void)arg;
+    for (int i = 0; i < N_CHECKED_BLOCKS; ++i) {
+        deallocate(checked_blocks[i]);
+        __atomic_store_n(&freed_count, i + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static void wait_for_step(struct handoff *handoff, int step) {
+    pthread_mutex_lock(&handoff->lock);
+    while (handoff->step < step) {
+        pthread_cond_wait(&handoff->cond, &handoff->lock);
+    }
+    pthread_mutex_unlock(&handoff->lock);
+}
+
+static void set_step(struct handoff *handoff, int step) {
+    pthread_mutex_lock(&handoff->lock);
+    handoff->step = step;
+    pthread_cond_broadcast(&handoff->cond);
+    pthread_mutex_unlock(&handoff->lock);
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
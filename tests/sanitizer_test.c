@@ -0,0 +1,113 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+
+#ifdef __SANITIZE_ADDRESS__
+#include <sanitizer/asan_interface.h>
+#endif
+
+
+#define HEADER_SIZE 16
+#define MMRY_ALLOC_SIZE 4096
+#define BLOCK_SIZE 64
+
+
+// These tests only run in builds configured with -DMMANAGER_SANITIZE=ON.
+#ifdef __SANITIZE_ADDRESS__
+#define REQUIRE_ASAN()
+#else
+#define REQUIRE_ASAN() TEST_IGNORE_MESSAGE("needs -DMMANAGER_SANITIZE=ON")
+#endif
+
+// Returns true if any of the `size` bytes at `ptr` is poisoned.
+static bool is_poisoned(void *ptr, size_t size) {
+#ifdef __SANITIZE_ADDRESS__
+    return __asan_region_is_poisoned(ptr, size) != NULL;
+#else
+    (void)ptr;
+    (void)size;
+    return false;
+#endif
+}
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_sanitizer);
+TEST_SETUP(mmry_alloc_sanitizer) {
+    mmanager_initialize(MMRY_ALLOC_SIZE, FIRST_FIT);
+}
+TEST_TEAR_DOWN(mmry_alloc_sanitizer) {
+    mmanager_destroy();
+}
+TEST_GROUP_RUNNER(mmry_alloc_sanitizer) {
+    RUN_TEST_CASE(mmry_alloc_sanitizer, AllocatedBlockIsAccessible);
+    RUN_TEST_CASE(mmry_alloc_sanitizer, HeadersArePoisoned);
+    RUN_TEST_CASE(mmry_alloc_sanitizer, FreedBlockIsPoisoned);
+    RUN_TEST_CASE(mmry_alloc_sanitizer, ReallocatedBlockFollowsItsSize);
+    RUN_TEST_CASE(mmry_alloc_sanitizer, MovedBlockIsAccessible);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_sanitizer);
+}
+
+// Tests.
+TEST(mmry_alloc_sanitizer, AllocatedBlockIsAccessible) {
+    REQUIRE_ASAN();
+    char *ptr = allocate(BLOCK_SIZE);
+    TEST_ASSERT_FALSE(is_poisoned(ptr, BLOCK_SIZE));
+    TEST_ASSERT_TRUE(is_poisoned(ptr + BLOCK_SIZE, 1));
+
+    char *zeroed = callocate(4, BLOCK_SIZE / 4);
+    TEST_ASSERT_FALSE(is_poisoned(zeroed, BLOCK_SIZE));
+}
+TEST(mmry_alloc_sanitizer, HeadersArePoisoned) {
+    REQUIRE_ASAN();
+    char *ptr = allocate(BLOCK_SIZE);
+    TEST_ASSERT_TRUE(is_poisoned(ptr - HEADER_SIZE, 1));
+    TEST_ASSERT_TRUE(is_poisoned(ptr - 1, 1));
+}
+TEST(mmry_alloc_sanitizer, FreedBlockIsPoisoned) {
+    REQUIRE_ASAN();
+    char *ptr = allocate(BLOCK_SIZE);
+    deallocate(ptr);
+    TEST_ASSERT_TRUE(is_poisoned(ptr, 1));
+    TEST_ASSERT_TRUE(is_poisoned(ptr + BLOCK_SIZE - 1, 1));
+
+    // The block is accessible again once it is reused.
+    char *reused = allocate(BLOCK_SIZE);
+    TEST_ASSERT_EQUAL_PTR(ptr, reused);
+    TEST_ASSERT_FALSE(is_poisoned(reused, BLOCK_SIZE));
+}
+TEST(mmry_alloc_sanitizer, ReallocatedBlockFollowsItsSize) {
+    REQUIRE_ASAN();
+    char *ptr = allocate(4 * BLOCK_SIZE);
+
+    ptr = reallocate(ptr, BLOCK_SIZE);
+    TEST_ASSERT_FALSE(is_poisoned(ptr, BLOCK_SIZE));
+    TEST_ASSERT_TRUE(is_poisoned(ptr + BLOCK_SIZE, 1));
+
+    ptr = reallocate(ptr, 2 * BLOCK_SIZE);
+    TEST_ASSERT_FALSE(is_poisoned(ptr, 2 * BLOCK_SIZE));
+    TEST_ASSERT_TRUE(is_poisoned(ptr + 2 * BLOCK_SIZE, 1));
+}
+TEST(mmry_alloc_sanitizer, MovedBlockIsAccessible) {
+    REQUIRE_ASAN();
+    char *first = allocate(BLOCK_SIZE);
+    char *second = allocate(BLOCK_SIZE);
+    deallocate(first);
+
+    void *before[1];
+    void *after[1];
+    TEST_ASSERT_EQUAL_size_t(1, mmanager_compact(before, after));
+    TEST_ASSERT_EQUAL_PTR(second, before[0]);
+    TEST_ASSERT_EQUAL_PTR(first, after[0]);
+    TEST_ASSERT_FALSE(is_poisoned(first, BLOCK_SIZE));
+    TEST_ASSERT_TRUE(is_poisoned(first + BLOCK_SIZE, 1));
+    TEST_ASSERT_TRUE(is_poisoned(second + BLOCK_SIZE / 2, 1));
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <unity.h>
+#include <unity_fixture.h>
+
+#include "mmanager.h"
+#include "mmanager_trace.h"
+
+
+#define HEADER_SIZE 16
+#define MMRY_ALLOC_SIZE 2048
+#define MAX_RECORDS 64
+
+static char trace_path[] = "/tmp/mmanager_trace_test_XXXXXX";
+static struct mmanager_trace_header trace_header;
+static struct mmanager_trace_record records[MAX_RECORDS];
+
+// Reads the trace file into `trace_header`/`records` and returns the number of records.
+static size_t read_trace(void);
+
+
+// Test group properties.
+TEST_GROUP(mmry_alloc_trace);
+TEST_SETUP(mmry_alloc_trace) {
+    mmanager_initialize(MMRY_ALLOC_SIZE, FIRST_FIT);
+    strcpy(trace_path + strlen(trace_path) - 6, "XXXXXX");
+    close(mkstemp(trace_path));
+}
+TEST_TEAR_DOWN(mmry_alloc_trace) {
+    mmanager_destroy();
+    unlink(trace_path);
+}
+TEST_GROUP_RUNNER(mmry_alloc_trace) {
+    RUN_TEST_CASE(mmry_alloc_trace, Stats);
+    RUN_TEST_CASE(mmry_alloc_trace, EmptyTrace);
+    RUN_TEST_CASE(mmry_alloc_trace, AllocDealloc);
+    RUN_TEST_CASE(mmry_alloc_trace, FailedAllocation);
+    RUN_TEST_CASE(mmry_alloc_trace, CompactionMoves);
+    RUN_TEST_CASE(mmry_alloc_trace, BufferWrapsAround);
+}
+static void RunAllTests(void) {
+    RUN_TEST_GROUP(mmry_alloc_trace);
+}
+
+// Tests.
+TEST(mmry_alloc_trace, Stats) {
+    void *ptr1 = allocate(64);
+    void *ptr2 = allocate(32);
+    deallocate(ptr1);
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE, stats.arena_size);
+    TEST_ASSERT_EQUAL_size_t(32, stats.allocated_bytes);
+    TEST_ASSERT_EQUAL_size_t(1, stats.allocated_blocks);
+    TEST_ASSERT_EQUAL_size_t(96, stats.peak_allocated_bytes);
+    TEST_ASSERT_EQUAL_size_t(2 * HEADER_SIZE + 64 + 32, stats.heap_high_water);
+    TEST_ASSERT_EQUAL_size_t(mmanager_available_memory(), stats.free_bytes);
+    TEST_ASSERT_EQUAL_size_t(2, stats.free_blocks);
+    TEST_ASSERT_EQUAL_size_t(MMRY_ALLOC_SIZE - (3 * HEADER_SIZE + 64 + 32), stats.largest_free_block);
+
+    deallocate(ptr2);
+}
+TEST(mmry_alloc_trace, EmptyTrace) {
+    TEST_ASSERT_EQUAL_INT(0, mmanager_trace_start(trace_path, 0));
+    mmanager_trace_stop();
+
+    TEST_ASSERT_EQUAL_size_t(0, read_trace());
+    TEST_ASSERT_EQUAL_MEMORY(MMANAGER_TRACE_MAGIC, trace_header.magic, sizeof(trace_header.magic));
+    TEST_ASSERT_EQUAL_UINT32(MMANAGER_TRACE_VERSION, trace_header.version);
+    TEST_ASSERT_EQUAL_UINT32(FIRST_FIT, trace_header.allocation_policy);
+    TEST_ASSERT_EQUAL_UINT64(MMRY_ALLOC_SIZE, trace_header.arena_size);
+}
+TEST(mmry_alloc_trace, AllocDealloc) {
+    TEST_ASSERT_EQUAL_INT(0, mmanager_trace_start(trace_path, 0));
+    void *ptr1 = allocate(8);
+    void *ptr2 = callocate(4, 4);
+    deallocate(ptr1);
+    deallocate(ptr2);
+    mmanager_trace_stop();
+
+    TEST_ASSERT_EQUAL_size_t(4, read_trace());
+    TEST_ASSERT_EQUAL_UINT32(MMANAGER_TRACE_ALLOCATE, records[0].op);
+    TEST_ASSERT_EQUAL_UINT64(HEADER_SIZE, records[0].id);
+    TEST_ASSERT_EQUAL_UINT64(8, records[0].arg);
+    TEST_ASSERT_EQUAL_UINT32(MMANAGER_TRACE_CALLOCATE, records[1].op);
+    TEST_ASSERT_EQUAL_UINT64(2 * HEADER_SIZE + 8, records[1].id);
+    TEST_ASSERT_EQUAL_UINT64(16, records[1].arg);
+    TEST_ASSERT_EQUAL_UINT32(MMANAGER_TRACE_DEALLOCATE, records[2].op);
+    TEST_ASSERT_EQUAL_UINT64(records[0].id, records[2].id);
+    TEST_ASSERT_EQUAL_UINT32(MMANAGER_TRACE_DEALLOCATE, records[3].op);
+    TEST_ASSERT_EQUAL_UINT64(records[1].id, records[3].id);
+
+    for (size_t i = 1; i < 4; ++i) {
+        TEST_ASSERT_TRUE(records[i].timestamp_ns >= records[i - 1].timestamp_ns);
+        TEST_ASSERT_EQUAL_UINT32(records[0].thread_id, records[i].thread_id);
+    }
+}
+TEST(mmry_alloc_trace, FailedAllocation) {
+    TEST_ASSERT_EQUAL_INT(0, mmanager_trace_start(trace_path, 0));
+    void *ptr = allocate(MMRY_ALLOC_SIZE);
+    TEST_ASSERT_NULL(ptr);
+    mmanager_trace_stop();
+
+    TEST_ASSERT_EQUAL_size_t(1, read_trace());
+    TEST_ASSERT_EQUAL_UINT64(MMANAGER_TRACE_NULL_ID, records[0].id);
+    TEST_ASSERT_EQUAL_UINT64(MMRY_ALLOC_SIZE, records[0].arg);
+}
+TEST(mmry_alloc_trace, CompactionMoves) {
+    void *ptr1 = allocate(8);
+    void *ptr2 = allocate(8);
+    deallocate(ptr1);
+
+    TEST_ASSERT_EQUAL_INT(0, mmanager_trace_start(trace_path, 0));
+    void *before[1];
+    void *after[1];
+    TEST_ASSERT_EQUAL_size_t(1, mmanager_compact(before, after));
+    mmanager_trace_stop();
+
+    TEST_ASSERT_EQUAL_size_t(2, read_trace());
+    TEST_ASSERT_EQUAL_UINT32(MMANAGER_TRACE_COMPACT, records[0].op);
+    TEST_ASSERT_EQUAL_UINT32(MMANAGER_TRACE_MOVE, records[1].op);
+    TEST_ASSERT_EQUAL_UINT64((char *)ptr2 - ((char *)ptr1 - HEADER_SIZE), records[1].id);
+    TEST_ASSERT_EQUAL_UINT64(HEADER_SIZE, records[1].arg);
+}
+TEST(mmry_alloc_trace, BufferWrapsAround) {
+    // A tiny buffer forces several flushes while tracing.
+    TEST_ASSERT_EQUAL_INT(0, mmanager_trace_start(trace_path, 3));
+    for (int i = 0; i < 10; ++i) {
+        deallocate(allocate(8));
+    }
+    mmanager_trace_stop();
+
+    TEST_ASSERT_EQUAL_size_t(20, read_trace());
+    for (int i = 0; i < 20; i += 2) {
+        TEST_ASSERT_EQUAL_UINT32(MMANAGER_TRACE_ALLOCATE, records[i].op);
+        TEST_ASSERT_EQUAL_UINT32(MMANAGER_TRACE_DEALLOCATE, records[i + 1].op);
+    }
+}
+
+static size_t read_trace(void) {
+    FILE *file = fopen(trace_path, "rb");
+    TEST_ASSERT_NOT_NULL(file);
+    TEST_ASSERT_EQUAL_size_t(1, fread(&trace_header, sizeof(trace_header), 1, file));
+    size_t n = fread(records, sizeof(*records), MAX_RECORDS, file);
+    fclose(file);
+    return n;
+}
+
+int main(int argc, const char **argv) {
+    return UnityMain(argc, argv, RunAllTests);
+}
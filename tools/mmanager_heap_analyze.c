@@ -0,0 +1,241 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mmanager_dump.h"
+
+/*
+ * Offline analyzer for heap snapshots written by `mmanager_dump()`. Prints a
+ * summary, size histograms of allocated and free blocks, a map of how full
+ * each region of the arena is, and the regions holding the most allocated
+ * blocks.
+ *
+ * Usage: mmanager_heap_analyze <dump file> [map rows] [hot regions]
+ */
+
+
+#define READ_CHUNK_RECORDS 4096
+#define MAP_COLUMNS 64
+#define DEFAULT_MAP_ROWS 16
+#define DEFAULT_HOT_REGIONS 8
+#define HISTOGRAM_BUCKETS 64
+#define HISTOGRAM_WIDTH 40
+
+
+// Per-region counters for the fragmentation map and hot regions.
+struct region {
+    uint64_t allocated_bytes;
+    uint64_t allocated_blocks;
+    uint64_t free_blocks;
+};
+
+struct summary {
+    uint64_t blocks[2];
+    uint64_t bytes[2];
+    uint64_t histogram[2][HISTOGRAM_BUCKETS];
+    uint64_t largest_free_block;
+};
+
+
+// Adds the block `record` to `summary` and to the regions it overlaps.
+static void account_block(const struct mmanager_dump_record *record, uint64_t header_size,
+    struct summary *summary, struct region *regions, size_t n_regions, uint64_t region_size);
+
+// Prints a log2 size histogram.
+static void print_histogram(const char *title, const uint64_t *histogram);
+
+// Prints one character per region according to how much of it is allocated.
+static void print_map(const struct region *regions, size_t n_regions, uint64_t region_size);
+
+// Prints the `n` regions holding the most allocated blocks.
+static void print_hot_regions(const struct region *regions, size_t n_regions, uint64_t region_size, size_t n);
+
+// Returns the index of the log2 bucket for `size`.
+static int bucket(uint64_t size);
+
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <dump file> [map rows] [hot regions]\n", argv[0]);
+        return 1;
+    }
+    size_t map_rows = argc > 2 ? strtoul(argv[2], NULL, 0) : DEFAULT_MAP_ROWS;
+    size_t n_hot = argc > 3 ? strtoul(argv[3], NULL, 0) : DEFAULT_HOT_REGIONS;
+    if (map_rows == 0) {
+        map_rows = DEFAULT_MAP_ROWS;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    struct mmanager_dump_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, MMANAGER_DUMP_MAGIC, sizeof(MMANAGER_DUMP_MAGIC)) != 0
+        || header.version != MMANAGER_DUMP_VERSION) {
+        fprintf(stderr, "ERROR: %s is not an mmanager heap dump.\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+
+    size_t n_regions = map_rows * MAP_COLUMNS;
+    uint64_t region_size = (header.arena_size + n_regions - 1) / n_regions;
+    if (region_size == 0) {
+        region_size = 1;
+    }
+    struct region *regions = calloc(n_regions, sizeof(*regions));
+    struct summary summary;
+    memset(&summary, 0, sizeof(summary));
+
+    struct mmanager_dump_record *records = malloc(READ_CHUNK_RECORDS * sizeof(*records));
+    size_t n_read;
+    while ((n_read = fread(records, sizeof(*records), READ_CHUNK_RECORDS, file)) > 0) {
+        for (size_t i = 0; i < n_read; ++i) {
+            account_block(&records[i], header.header_size, &summary, regions, n_regions, region_size);
+        }
+    }
+    free(records);
+    fclose(file);
+
+    uint64_t total_blocks = summary.blocks[MMANAGER_DUMP_FREE] + summary.blocks[MMANAGER_DUMP_ALLOCATED];
+    uint64_t free_bytes = summary.bytes[MMANAGER_DUMP_FREE];
+    printf("arena: %llu bytes, %llu blocks, %llu bytes of headers\n", (unsigned long long)header.arena_size,
+        (unsigned long long)total_blocks, (unsigned long long)(total_blocks * header.header_size));
+    printf("allocated: %llu blocks, %llu bytes\n", (unsigned long long)summary.blocks[MMANAGER_DUMP_ALLOCATED],
+        (unsigned long long)summary.bytes[MMANAGER_DUMP_ALLOCATED]);
+    printf("free: %llu blocks, %llu bytes, largest %llu bytes\n",
+        (unsigned long long)summary.blocks[MMANAGER_DUMP_FREE], (unsigned long long)free_bytes,
+        (unsigned long long)summary.largest_free_block);
+    printf("fragmentation: %.4f\n\n",
+        free_bytes ? 1.0 - (double)summary.largest_free_block / (double)free_bytes : 0.0);
+
+    print_histogram("allocated block sizes", summary.histogram[MMANAGER_DUMP_ALLOCATED]);
+    print_histogram("free block sizes", summary.histogram[MMANAGER_DUMP_FREE]);
+    print_map(regions, n_regions, region_size);
+    print_hot_regions(regions, n_regions, region_size, n_hot);
+
+    free(regions);
+    return 0;
+}
+
+static void account_block(const struct mmanager_dump_record *record, uint64_t header_size,
+    struct summary *summary, struct region *regions, size_t n_regions, uint64_t region_size) {
+    uint64_t size = MMANAGER_DUMP_SIZE(record);
+    enum mmanager_dump_state state = MMANAGER_DUMP_STATE(record);
+    if (state != MMANAGER_DUMP_FREE && state != MMANAGER_DUMP_ALLOCATED) {
+        return;
+    }
+
+    ++summary->blocks[state];
+    summary->bytes[state] += size;
+    ++summary->histogram[state][bucket(size)];
+    if (state == MMANAGER_DUMP_FREE && size > summary->largest_free_block) {
+        summary->largest_free_block = size;
+    }
+
+    size_t first_region = record->offset / region_size;
+    if (first_region >= n_regions) {
+        return;
+    }
+    if (state == MMANAGER_DUMP_FREE) {
+        ++regions[first_region].free_blocks;
+        return;
+    }
+    ++regions[first_region].allocated_blocks;
+
+    // Spread the block's bytes (header included) over the regions it covers.
+    uint64_t start = record->offset;
+    uint64_t end = record->offset + header_size + size;
+    for (size_t i = first_region; i < n_regions && start < end; ++i) {
+        uint64_t region_end = (i + 1) * region_size;
+        uint64_t chunk_end = end < region_end ? end : region_end;
+        regions[i].allocated_bytes += chunk_end - start;
+        start = chunk_end;
+    }
+}
+
+static void print_histogram(const char *title, const uint64_t *histogram) {
+    uint64_t max = 0;
+    int last = -1;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        if (histogram[i] > max) {
+            max = histogram[i];
+        }
+        if (histogram[i]) {
+            last = i;
+        }
+    }
+
+    printf("%s:\n", title);
+    if (last < 0) {
+        printf("  (none)\n\n");
+        return;
+    }
+    for (int i = 0; i <= last; ++i) {
+        uint64_t low = i == 0 ? 0 : 1ull << (i - 1);
+        uint64_t high = (1ull << i) - 1;
+        int width = (int)(histogram[i] * HISTOGRAM_WIDTH / max);
+        printf("  %10llu - %-10llu %10llu |%.*s\n", (unsigned long long)low,
+            (unsigned long long)high, (unsigned long long)histogram[i], width,
+            "########################################");
+    }
+    printf("\n");
+}
+
+static void print_map(const struct region *regions, size_t n_regions, uint64_t region_size) {
+    // From empty to fully allocated.
+    static const char shades[] = " .:-=+*#";
+
+    printf("fragmentation map (%llu bytes per cell, ' ' = free ... '#' = allocated):\n",
+        (unsigned long long)region_size);
+    for (size_t row = 0; row < n_regions / MAP_COLUMNS; ++row) {
+        printf("  %12llx |", (unsigned long long)(row * MAP_COLUMNS * region_size));
+        for (size_t column = 0; column < MAP_COLUMNS; ++column) {
+            const struct region *region = &regions[row * MAP_COLUMNS + column];
+            size_t shade = (size_t)(region->allocated_bytes * (sizeof(shades) - 2) / region_size);
+            if (region->allocated_bytes > 0 && shade == 0) {
+                shade = 1;
+            }
+            putchar(shades[shade]);
+        }
+        printf("|\n");
+    }
+    printf("\n");
+}
+
+static void print_hot_regions(const struct region *regions, size_t n_regions, uint64_t region_size, size_t n) {
+    printf("hot regions (most allocated blocks):\n");
+    printf("  %12s %12s %10s %10s %14s\n", "start", "end", "allocated", "free", "bytes");
+
+    // Selection of the top `n` by repeated scans; `n` is small.
+    char *taken = calloc(n_regions, 1);
+    for (size_t k = 0; k < n; ++k) {
+        size_t best = n_regions;
+        for (size_t i = 0; i < n_regions; ++i) {
+            if (!taken[i] && regions[i].allocated_blocks > 0
+                && (best == n_regions || regions[i].allocated_blocks > regions[best].allocated_blocks)) {
+                best = i;
+            }
+        }
+        if (best == n_regions) {
+            break;
+        }
+        taken[best] = 1;
+        printf("  %12llx %12llx %10llu %10llu %14llu\n", (unsigned long long)(best * region_size),
+            (unsigned long long)((best + 1) * region_size), (unsigned long long)regions[best].allocated_blocks,
+            (unsigned long long)regions[best].free_blocks, (unsigned long long)regions[best].allocated_bytes);
+    }
+    free(taken);
+}
+
+static int bucket(uint64_t size) {
+    int i = 0;
+    while (size > 0 && i < HISTOGRAM_BUCKETS - 1) {
+        size >>= 1;
+        ++i;
+    }
+    return i;
+}
@@ -0,0 +1,396 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mmanager.h"
+#include "mmanager_trace.h"
+
+/*
+ * Replays an allocation trace recorded with `mmanager_trace_start()` against
+ * one or all allocation policies and reports the time spent in the allocator,
+ * peak memory usage and fragmentation.
+ *
+ * Usage: mmanager_replay <trace file> [first|best|worst|all] [arena size]
+ */
+
+
+#define READ_CHUNK_RECORDS 4096
+#define FRAGMENTATION_SAMPLE_INTERVAL 1024
+#define EMPTY_KEY UINT64_MAX
+#define DELETED_KEY (UINT64_MAX - 1)
+
+
+// Open-addressed map from trace ids to replayed pointers.
+struct id_map {
+    uint64_t *keys;
+    void **values;
+    size_t capacity;
+    size_t count;
+    size_t used; // Live entries plus tombstones.
+};
+
+struct replay_result {
+    uint64_t allocator_ns;
+    size_t operations;
+    size_t failed_allocations;
+    size_t compactions;
+    size_t peak_allocated_bytes;
+    size_t heap_high_water;
+    double final_fragmentation;
+    double max_fragmentation;
+    double mean_fragmentation;
+};
+
+
+// Initializes `map` with room for `capacity` entries. `capacity` must be a
+// power of two.
+static void id_map_init(struct id_map *map, size_t capacity);
+
+// Releases the memory held by `map`.
+static void id_map_destroy(struct id_map *map);
+
+// Associates `value` with `key`, replacing any previous value.
+static void id_map_put(struct id_map *map, uint64_t key, void *value);
+
+// Removes `key` from `map` and returns its value, or NULL if it is not present.
+static void *id_map_remove(struct id_map *map, uint64_t key);
+
+// Replays the trace in `file` against `policy` and stores the results in `result`.
+// Returns false if the trace could not be read.
+static bool replay(FILE *file, size_t arena_size, enum AllocationPolicy policy, struct replay_result *result);
+
+// Returns the current external fragmentation of the allocator.
+static double current_fragmentation(void);
+
+// Returns the monotonic clock in nanoseconds.
+static uint64_t now_ns(void);
+
+
+static const char *policy_names[] = { "first", "best", "worst" };
+
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <trace file> [first|best|worst|all] [arena size]\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    struct mmanager_trace_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, MMANAGER_TRACE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != MMANAGER_TRACE_VERSION) {
+        fprintf(stderr, "ERROR: %s is not an mmanager trace.\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+
+    int first_policy = FIRST_FIT;
+    int last_policy = WORST_FIT;
+    if (argc > 2 && strcmp(argv[2], "all") != 0) {
+        first_policy = -1;
+        for (int i = FIRST_FIT; i <= WORST_FIT; ++i) {
+            if (strcmp(argv[2], policy_names[i]) == 0) {
+                first_policy = last_policy = i;
+            }
+        }
+        if (first_policy < 0) {
+            fprintf(stderr, "ERROR: unknown policy '%s'.\n", argv[2]);
+            fclose(file);
+            return 1;
+        }
+    }
+
+    size_t arena_size = argc > 3 ? strtoull(argv[3], NULL, 0) : header.arena_size;
+
+    printf("trace: %s (recorded with %s fit, arena %zu bytes)\n", argv[1],
+        header.allocation_policy <= WORST_FIT ? policy_names[header.allocation_policy] : "unknown",
+        (size_t)header.arena_size);
+    printf("%-6s %10s %12s %8s %10s %14s %14s %8s %8s %8s\n", "policy", "ops", "time_ms", "ns/op",
+        "failed", "peak_bytes", "high_water", "frag", "frag_max", "frag_avg");
+
+    for (int policy = first_policy; policy <= last_policy; ++policy) {
+        struct replay_result result;
+        fseek(file, sizeof(header), SEEK_SET);
+        if (!replay(file, arena_size, policy, &result)) {
+            fprintf(stderr, "ERROR: failed to read %s.\n", argv[1]);
+            fclose(file);
+            return 1;
+        }
+
+        printf("%-6s %10zu %12.3f %8.1f %10zu %14zu %14zu %8.4f %8.4f %8.4f\n", policy_names[policy],
+            result.operations, result.allocator_ns / 1e6,
+            result.operations ? (double)result.allocator_ns / result.operations : 0.0,
+            result.failed_allocations, result.peak_allocated_bytes, result.heap_high_water,
+            result.final_fragmentation, result.max_fragmentation, result.mean_fragmentation);
+    }
+
+    fclose(file);
+    return 0;
+}
+
+static bool replay(FILE *file, size_t arena_size, enum AllocationPolicy policy, struct replay_result *result) {
+    memset(result, 0, sizeof(*result));
+    mmanager_initialize(arena_size, policy);
+
+    struct id_map live;
+    id_map_init(&live, 1024);
+
+    struct mmanager_trace_record *records = malloc(READ_CHUNK_RECORDS * sizeof(*records));
+    size_t samples = 0;
+    double fragmentation_sum = 0.0;
+
+    // Compaction bookkeeping: the moves recorded after a COMPACT or COMPACT_STEP
+    // record are collected and applied to `live` once all of them have been seen.
+    uint64_t *moves = NULL;
+    size_t n_moves = 0;
+    size_t moves_capacity = 0;
+
+    size_t n_read;
+    while ((n_read = fread(records, sizeof(*records), READ_CHUNK_RECORDS, file)) > 0) {
+        for (size_t i = 0; i < n_read; ++i) {
+            struct mmanager_trace_record *record = &records[i];
+
+            // Apply pending moves as soon as the compaction's move records end.
+            if (record->op != MMANAGER_TRACE_MOVE && n_moves > 0) {
+                void **values = malloc(n_moves * sizeof(*values));
+                for (size_t j = 0; j < n_moves; ++j) {
+                    values[j] = id_map_remove(&live, moves[2 * j]);
+                }
+                for (size_t j = 0; j < n_moves; ++j) {
+                    // A failed reallocation leaves the block under its old id.
+                    if (values[j] && moves[2 * j + 1] == MMANAGER_TRACE_NULL_ID) {
+                        id_map_put(&live, moves[2 * j], values[j]);
+                    }
+                    else if (values[j]) {
+                        id_map_put(&live, moves[2 * j + 1], values[j]);
+                    }
+                }
+                free(values);
+                n_moves = 0;
+            }
+
+            switch (record->op) {
+                case MMANAGER_TRACE_ALLOCATE:
+                case MMANAGER_TRACE_CALLOCATE: {
+                    uint64_t start = now_ns();
+                    void *ptr = record->op == MMANAGER_TRACE_ALLOCATE
+                        ? allocate(record->arg) : callocate(1, record->arg);
+                    result->allocator_ns += now_ns() - start;
+
+                    if (!ptr) {
+                        ++result->failed_allocations;
+                    }
+                    else if (record->id != MMANAGER_TRACE_NULL_ID) {
+                        id_map_put(&live, record->id, ptr);
+                    }
+                    else {
+                        // The recorded run failed this allocation, so it is never freed.
+                        deallocate(ptr);
+                    }
+                    break;
+                }
+
+                case MMANAGER_TRACE_DEALLOCATE: {
+                    void *ptr = id_map_remove(&live, record->id);
+                    if (ptr) {
+                        uint64_t start = now_ns();
+                        deallocate(ptr);
+                        result->allocator_ns += now_ns() - start;
+                    }
+                    break;
+                }
+
+                case MMANAGER_TRACE_REALLOCATE: {
+                    // The MOVE record that follows re-keys the block under its new id.
+                    void *ptr = id_map_remove(&live, record->id);
+                    if (ptr) {
+                        uint64_t start = now_ns();
+                        void *new_ptr = reallocate(ptr, record->arg);
+                        result->allocator_ns += now_ns() - start;
+
+                        if (!new_ptr) {
+                            ++result->failed_allocations;
+                        }
+                        id_map_put(&live, record->id, new_ptr ? new_ptr : ptr);
+                    }
+                    break;
+                }
+
+                case MMANAGER_TRACE_COMPACT:
+                case MMANAGER_TRACE_COMPACT_STEP: {
+                    void **before = malloc((live.count + 1) * sizeof(*before));
+                    void **after = malloc((live.count + 1) * sizeof(*after));
+
+                    // An incremental step is replayed with the recorded budgets.
+                    uint64_t start = now_ns();
+                    size_t n = record->op == MMANAGER_TRACE_COMPACT
+                        ? mmanager_compact(before, after)
+                        : mmanager_compact_incremental(record->arg, record->id, before, after);
+                    result->allocator_ns += now_ns() - start;
+                    ++result->compactions;
+
+                    // Patch replayed pointers that were moved by this compaction.
+                    if (n > 0) {
+                        struct id_map relocations;
+                        id_map_init(&relocations, 1024);
+                        for (size_t j = 0; j < n; ++j) {
+                            id_map_put(&relocations, (uint64_t)(uintptr_t)before[j], after[j]);
+                        }
+                        for (size_t slot = 0; slot < live.capacity; ++slot) {
+                            if (live.keys[slot] < DELETED_KEY) {
+                                void *moved = id_map_remove(&relocations, (uint64_t)(uintptr_t)live.values[slot]);
+                                if (moved) {
+                                    live.values[slot] = moved;
+                                }
+                            }
+                        }
+                        id_map_destroy(&relocations);
+                    }
+                    free(before);
+                    free(after);
+                    break;
+                }
+
+                case MMANAGER_TRACE_MOVE:
+                    if (n_moves == moves_capacity) {
+                        moves_capacity = moves_capacity ? 2 * moves_capacity : 64;
+                        moves = realloc(moves, 2 * moves_capacity * sizeof(*moves));
+                    }
+                    moves[2 * n_moves] = record->id;
+                    moves[2 * n_moves + 1] = record->arg;
+                    ++n_moves;
+                    break;
+
+                default:
+                    break;
+            }
+            ++result->operations;
+
+            if (result->operations % FRAGMENTATION_SAMPLE_INTERVAL == 0) {
+                double fragmentation = current_fragmentation();
+                fragmentation_sum += fragmentation;
+                ++samples;
+                if (fragmentation > result->max_fragmentation) {
+                    result->max_fragmentation = fragmentation;
+                }
+            }
+        }
+    }
+    bool ok = !ferror(file);
+
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    result->peak_allocated_bytes = stats.peak_allocated_bytes;
+    result->heap_high_water = stats.heap_high_water;
+    result->final_fragmentation = current_fragmentation();
+    result->mean_fragmentation = samples ? fragmentation_sum / samples : result->final_fragmentation;
+    if (result->final_fragmentation > result->max_fragmentation) {
+        result->max_fragmentation = result->final_fragmentation;
+    }
+
+    free(moves);
+    free(records);
+    id_map_destroy(&live);
+    mmanager_destroy();
+
+    return ok;
+}
+
+static double current_fragmentation(void) {
+    struct mmanager_stats stats;
+    mmanager_get_stats(&stats);
+    if (stats.free_bytes == 0) {
+        return 0.0;
+    }
+    return 1.0 - (double)stats.largest_free_block / (double)stats.free_bytes;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+
+/* * * * * * * * * * * * * * * * * * *
+ * Id map.
+ * * * * * * * * * * * * * * * * * * */
+
+static size_t id_map_slot(uint64_t key, size_t capacity) {
+    // Fibonacci hashing spreads the (aligned) offsets over the table.
+    return (size_t)((key * 11400714819323198485ull) >> 17) & (capacity - 1);
+}
+
+static void id_map_init(struct id_map *map, size_t capacity) {
+    map->keys = malloc(capacity * sizeof(*map->keys));
+    map->values = malloc(capacity * sizeof(*map->values));
+    map->capacity = capacity;
+    map->count = 0;
+    map->used = 0;
+    for (size_t i = 0; i < capacity; ++i) {
+        map->keys[i] = EMPTY_KEY;
+    }
+}
+
+static void id_map_destroy(struct id_map *map) {
+    free(map->keys);
+    free(map->values);
+}
+
+static void id_map_put(struct id_map *map, uint64_t key, void *value) {
+    // Keep the load factor (including tombstones) below one half.
+    if (2 * (map->used + 1) > map->capacity) {
+        struct id_map resized;
+        id_map_init(&resized, 2 * map->count + 2 > map->capacity ? 2 * map->capacity : map->capacity);
+        for (size_t i = 0; i < map->capacity; ++i) {
+            if (map->keys[i] < DELETED_KEY) {
+                id_map_put(&resized, map->keys[i], map->values[i]);
+            }
+        }
+        id_map_destroy(map);
+        *map = resized;
+    }
+
+    size_t slot = id_map_slot(key, map->capacity);
+    size_t insert_slot = SIZE_MAX;
+    while (map->keys[slot] != EMPTY_KEY) {
+        if (map->keys[slot] == key) {
+            map->values[slot] = value;
+            return;
+        }
+        if (map->keys[slot] == DELETED_KEY && insert_slot == SIZE_MAX) {
+            insert_slot = slot;
+        }
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+
+    if (insert_slot == SIZE_MAX) {
+        insert_slot = slot;
+        ++map->used;
+    }
+    map->keys[insert_slot] = key;
+    map->values[insert_slot] = value;
+    ++map->count;
+}
+
+static void *id_map_remove(struct id_map *map, uint64_t key) {
+    size_t slot = id_map_slot(key, map->capacity);
+    while (map->keys[slot] != EMPTY_KEY) {
+        if (map->keys[slot] == key) {
+            map->keys[slot] = DELETED_KEY;
+            --map->count;
+            return map->values[slot];
+        }
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    return NULL;
+}